@@ -0,0 +1,220 @@
+#ifndef BENCH_UTIL_H
+#define BENCH_UTIL_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cmath>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <string>
+#include <iostream>
+#include <algorithm>
+
+namespace etool { namespace bench {
+
+    /// Helpers shared by the benchmark targets:
+    /// reproducible workloads, latency percentiles and CSV rows.
+
+    using clock_type = std::chrono::steady_clock;
+
+    /// every 'sample_every'-th operation is timed on its own
+    static const std::size_t sample_every = 8;
+
+    inline
+    std::vector<std::uint64_t> sequence( std::size_t count )
+    {
+        std::vector<std::uint64_t> res( count );
+        for( std::size_t i = 0; i < count; ++i ) {
+            res[i] = i;
+        }
+        return res;
+    }
+
+    inline
+    std::vector<std::uint64_t> permutation( std::size_t count,
+                                            std::uint64_t seed )
+    {
+        auto res = sequence( count );
+        std::mt19937_64 gen( seed );
+        std::shuffle( res.begin( ), res.end( ), gen );
+        return res;
+    }
+
+    inline
+    std::vector<std::uint64_t> uniform( std::size_t count, std::size_t range,
+                                        std::uint64_t seed )
+    {
+        std::mt19937_64 gen( seed );
+        std::uniform_int_distribution<std::uint64_t> dist( 0, range - 1 );
+        std::vector<std::uint64_t> res( count );
+        for( auto &r: res ) {
+            r = dist( gen );
+        }
+        return res;
+    }
+
+    /// Zipfian ranks in [0, range) as in YCSB (Gray et al.);
+    /// rank 0 is the most popular one
+    struct zipfian {
+
+        zipfian( std::size_t range, double theta, std::uint64_t seed )
+            :range_(range)
+            ,theta_(theta)
+            ,gen_(seed)
+        {
+            for( std::size_t i = 1; i <= range_; ++i ) {
+                zetan_ += 1.0 / std::pow( static_cast<double>( i ), theta_ );
+            }
+            double zeta2 = 1.0 + 1.0 / std::pow( 2.0, theta_ );
+            alpha_ = 1.0 / ( 1.0 - theta_ );
+            eta_   = ( 1.0 - std::pow( 2.0 / range_, 1.0 - theta_ ) )
+                   / ( 1.0 - zeta2 / zetan_ );
+        }
+
+        std::uint64_t next( )
+        {
+            double u  = dist_( gen_ );
+            double uz = u * zetan_;
+            if( uz < 1.0 ) {
+                return 0;
+            }
+            if( uz < 1.0 + std::pow( 0.5, theta_ ) ) {
+                return 1;
+            }
+            auto r = static_cast<std::uint64_t>(
+                        range_ * std::pow( eta_ * u - eta_ + 1.0, alpha_ ) );
+            return r < range_ ? r : range_ - 1;
+        }
+
+    private:
+        std::size_t     range_;
+        double          theta_;
+        double          zetan_ = 0;
+        double          alpha_ = 0;
+        double          eta_   = 0;
+        std::mt19937_64 gen_;
+        std::uniform_real_distribution<double> dist_;
+    };
+
+    inline
+    std::vector<std::uint64_t> zipf( std::size_t count, std::size_t range,
+                                     std::uint64_t seed )
+    {
+        zipfian z( range, 0.99, seed );
+        /// popular ranks are spread over the key space
+        auto spread = permutation( range, seed + 1 );
+        std::vector<std::uint64_t> res( count );
+        for( auto &r: res ) {
+            r = spread[z.next( )];
+        }
+        return res;
+    }
+
+    struct latency {
+
+        void add( double ns )
+        {
+            samples_.push_back( ns );
+        }
+
+        /// 'p' in [0, 1]
+        double percentile( double p )
+        {
+            if( samples_.empty( ) ) {
+                return 0;
+            }
+            auto pos = static_cast<std::size_t>( p * ( samples_.size( ) - 1 ) );
+            std::nth_element( samples_.begin( ), samples_.begin( ) + pos,
+                              samples_.end( ) );
+            return samples_[pos];
+        }
+
+        std::vector<double> samples_;
+    };
+
+    struct result {
+
+        /// adds a measurement of the same kind
+        void append( const result &other )
+        {
+            ops     += other.ops;
+            seconds += other.seconds;
+            lat.samples_.insert( lat.samples_.end( ),
+                                 other.lat.samples_.begin( ),
+                                 other.lat.samples_.end( ) );
+        }
+
+        std::size_t ops     = 0;
+        double      seconds = 0;
+        latency     lat;
+    };
+
+    /// runs call( i ) for i in [0, count)
+    template <typename Call>
+    result timed( std::size_t count, Call call )
+    {
+        result res;
+        res.ops = count;
+        res.lat.samples_.reserve( count / sample_every + 1 );
+
+        auto start = clock_type::now( );
+        for( std::size_t i = 0; i < count; ++i ) {
+            if( i % sample_every == 0 ) {
+                auto b = clock_type::now( );
+                call( i );
+                std::chrono::duration<double, std::nano> d =
+                        clock_type::now( ) - b;
+                res.lat.add( d.count( ) );
+            } else {
+                call( i );
+            }
+        }
+        std::chrono::duration<double> total = clock_type::now( ) - start;
+        res.seconds = total.count( );
+        return res;
+    }
+
+    /// one CSV row per measurement
+    struct report {
+
+        static
+        void header( )
+        {
+            std::cout << "bench,container,node_max,workload,op,"
+                         "ops,seconds,mops,p50_ns,p90_ns,p99_ns,p999_ns\n";
+        }
+
+        static
+        void row( const std::string &bench, const std::string &container,
+                  std::size_t node_max, const std::string &workload,
+                  const std::string &op, result &res )
+        {
+            auto mops = res.seconds > 0 ? res.ops / res.seconds / 1e6 : 0;
+            std::cout << bench     << ","
+                      << container << ","
+                      << node_max  << ","
+                      << workload  << ","
+                      << op        << ","
+                      << res.ops   << ","
+                      << res.seconds << ","
+                      << mops      << ","
+                      << res.lat.percentile( 0.50 )  << ","
+                      << res.lat.percentile( 0.90 )  << ","
+                      << res.lat.percentile( 0.99 )  << ","
+                      << res.lat.percentile( 0.999 ) << "\n";
+        }
+    };
+
+    /// keeps the optimizer from dropping the measured work
+    template <typename T>
+    inline
+    void keep( const T &val )
+    {
+        volatile T sink = val;
+        (void)sink;
+    }
+
+}}
+
+#endif // BENCH_UTIL_H
@@ -0,0 +1,787 @@
+#ifndef BPLUS_TREE_H
+#define BPLUS_TREE_H
+
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include <iterator>
+#include <type_traits>
+
+#include "etool/details/operators.h"
+
+#include "dyn_array.h"
+#include "node_allocator.h"
+#include "node_search.h"
+#include "btree_traits.h"
+
+namespace etool {
+
+/// B+tree variant of btree
+/// Inner nodes keep only separator keys, all the values live in leaves
+/// and leaves are linked into a list, so an in-order scan is a walk
+/// along that list.
+/// Separators are weak bounds: every key of the child 'i' is in
+///     [ keys_[i - 1], keys_[i] ]
+/// so equal keys may sit on both sides of a separator.
+/// There are no parent pointers; insert and erase keep the path
+/// from the root on the stack.
+template <typename ValueTrait, std::size_t LeafMax,
+          std::size_t InnerMax = LeafMax,
+          typename NodeAllocator = slab_allocator< > >
+struct bplus_tree {
+
+    static_assert( LeafMax  > 2, "Leaf maximum must be at least 3" );
+    static_assert( InnerMax > 2, "Inner maximum must be at least 3" );
+
+    static const std::size_t leaf_maximum  = LeafMax;
+    static const std::size_t leaf_minimum  = LeafMax / 2;
+    static const std::size_t inner_maximum = InnerMax;
+    static const std::size_t inner_middle  = InnerMax / 2;
+    static const std::size_t inner_minimum = inner_middle + InnerMax % 2 - 1;
+
+    /// fan-out is at least 2, so 64 levels are never reached
+    static const std::size_t max_height = 64;
+
+    using value_trait = ValueTrait;
+    using value_type  = typename value_trait::value_type;
+    using key_type    = typename value_trait::key_type;
+    using less_cmp    = typename value_trait::less;
+    using key_access  = typename value_trait::key_access;
+
+    using leaf_search  = typename search::select<
+                                        typename value_trait::search,
+                                        value_type, key_type, less_cmp,
+                                        leaf_maximum>::type;
+
+    using inner_search = typename search::select<
+                                        typename value_trait::search,
+                                        key_type, key_type, less_cmp,
+                                        inner_maximum>::type;
+
+    struct cmp {
+
+        static
+        bool equal( const key_type &l, const key_type &r )
+        {
+            using op = details::operators::cmp<key_type, less_cmp>;
+            return op::equal(l, r);
+        }
+
+        static
+        bool less( const key_type &l, const key_type &r )
+        {
+            using op = details::operators::cmp<key_type, less_cmp>;
+            return op::less(l, r);
+        }
+    };
+
+    struct node_base { };
+
+    struct leaf: node_base {
+
+        using value_array = dyn_array<value_type, leaf_maximum>;
+
+        std::size_t size( ) const
+        {
+            return values_.size( );
+        }
+
+        bool full( ) const
+        {
+            return values_.full( );
+        }
+
+        bool has_donor( ) const
+        {
+            return size( ) > leaf_minimum;
+        }
+
+        std::size_t lower_of( const key_type &key ) const
+        {
+            using SP = leaf_search;
+            return SP::template lower<key_access, less_cmp>( values_.begin( ),
+                                                             values_.size( ),
+                                                             key );
+        }
+
+        std::size_t upper_of( const key_type &key ) const
+        {
+            using SP = leaf_search;
+            return SP::template upper<key_access, less_cmp>( values_.begin( ),
+                                                             values_.size( ),
+                                                             key );
+        }
+
+        value_array values_;
+        leaf       *left_  = nullptr;
+        leaf       *right_ = nullptr;
+    };
+
+    struct inner: node_base {
+
+        using key_array     = dyn_array<key_type,    inner_maximum>;
+        using pointer_array = dyn_array<node_base *, inner_maximum + 1>;
+
+        std::size_t size( ) const
+        {
+            return keys_.size( );
+        }
+
+        bool full( ) const
+        {
+            return keys_.full( );
+        }
+
+        bool has_donor( ) const
+        {
+            return size( ) > inner_minimum;
+        }
+
+        std::size_t lower_of( const key_type &key ) const
+        {
+            using SP = inner_search;
+            return SP::template lower<search::identity, less_cmp>(
+                                keys_.begin( ), keys_.size( ), key );
+        }
+
+        std::size_t upper_of( const key_type &key ) const
+        {
+            using SP = inner_search;
+            return SP::template upper<search::identity, less_cmp>(
+                                keys_.begin( ), keys_.size( ), key );
+        }
+
+        key_array     keys_;
+        pointer_array next_;
+    };
+
+    using leaf_pool  = typename NodeAllocator::template pool<leaf>;
+    using inner_pool = typename NodeAllocator::template pool<inner>;
+
+    /// inner nodes from the root down to a leaf
+    /// with the index of the child taken at every one
+    struct path {
+
+        void push( inner *node, std::size_t pos )
+        {
+            steps_[size_++] = std::make_pair( node, pos );
+        }
+
+        std::pair<inner *, std::size_t> pop( )
+        {
+            return steps_[--size_];
+        }
+
+        bool empty( ) const
+        {
+            return size_ == 0;
+        }
+
+        std::pair<inner *, std::size_t> steps_[max_height];
+        std::size_t                     size_ = 0;
+    };
+
+    /// in-order bidirectional iterator; walks the leaf list
+    /// Any insert or erase invalidates all iterators.
+    template <typename LeafT, typename ValueT>
+    struct basic_iterator {
+
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type        = typename bplus_tree::value_type;
+        using difference_type   = std::ptrdiff_t;
+        using pointer           = ValueT *;
+        using reference         = ValueT &;
+
+        basic_iterator( ) = default;
+
+        basic_iterator( const bplus_tree *tree, LeafT *node, std::size_t pos )
+            :tree_(tree)
+            ,node_(node)
+            ,pos_(pos)
+        { }
+
+        template <typename L, typename V>
+        basic_iterator( const basic_iterator<L, V> &other )
+            :tree_(other.tree_)
+            ,node_(other.node_)
+            ,pos_(other.pos_)
+        { }
+
+        reference operator * ( ) const
+        {
+            return node_->values_[pos_];
+        }
+
+        pointer operator -> ( ) const
+        {
+            return &node_->values_[pos_];
+        }
+
+        basic_iterator &operator ++ ( )
+        {
+            if( ++pos_ == node_->size( ) ) {
+                node_ = node_->right_;
+                pos_  = 0;
+            }
+            return *this;
+        }
+
+        basic_iterator &operator -- ( )
+        {
+            if( !node_ ) {
+                node_ = tree_->last_;
+                pos_  = node_->size( );
+            } else if( pos_ == 0 ) {
+                node_ = node_->left_;
+                pos_  = node_->size( );
+            }
+            --pos_;
+            return *this;
+        }
+
+        basic_iterator operator ++ ( int )
+        {
+            basic_iterator tmp(*this);
+            ++(*this);
+            return tmp;
+        }
+
+        basic_iterator operator -- ( int )
+        {
+            basic_iterator tmp(*this);
+            --(*this);
+            return tmp;
+        }
+
+        template <typename L, typename V>
+        bool operator == ( const basic_iterator<L, V> &other ) const
+        {
+            return (node_ == other.node_) && (pos_ == other.pos_);
+        }
+
+        template <typename L, typename V>
+        bool operator != ( const basic_iterator<L, V> &other ) const
+        {
+            return !(*this == other);
+        }
+
+        const bplus_tree *tree_ = nullptr;
+        LeafT            *node_ = nullptr;
+        std::size_t       pos_  = 0;
+    };
+
+    using iterator       = basic_iterator<leaf, value_type>;
+    using const_iterator = basic_iterator<const leaf, const value_type>;
+
+    bplus_tree( )
+    {
+        reset( );
+    }
+
+    bplus_tree( const bplus_tree & ) = delete;
+    bplus_tree &operator = ( const bplus_tree & ) = delete;
+
+    bplus_tree( bplus_tree &&other )
+        :leaves_(std::move(other.leaves_))
+        ,inners_(std::move(other.inners_))
+        ,root_(other.root_)
+        ,first_(other.first_)
+        ,last_(other.last_)
+        ,height_(other.height_)
+        ,size_(other.size_)
+    {
+        other.reset( );
+    }
+
+    bplus_tree &operator = ( bplus_tree &&other )
+    {
+        if( this != &other ) {
+            drop_all( );
+            leaves_ = std::move(other.leaves_);
+            inners_ = std::move(other.inners_);
+            root_   = other.root_;
+            first_  = other.first_;
+            last_   = other.last_;
+            height_ = other.height_;
+            size_   = other.size_;
+            other.reset( );
+        }
+        return *this;
+    }
+
+    ~bplus_tree( )
+    {
+        drop_all( );
+    }
+
+    std::size_t size( ) const
+    {
+        return size_;
+    }
+
+    bool empty( ) const
+    {
+        return size_ == 0;
+    }
+
+    /// number of inner levels above the leaves
+    std::size_t height( ) const
+    {
+        return height_;
+    }
+
+    iterator begin( )
+    {
+        return iterator( this, empty( ) ? nullptr : first_, 0 );
+    }
+
+    iterator end( )
+    {
+        return iterator( this, nullptr, 0 );
+    }
+
+    const_iterator begin( ) const
+    {
+        return const_iterator( this, empty( ) ? nullptr : first_, 0 );
+    }
+
+    const_iterator end( ) const
+    {
+        return const_iterator( this, nullptr, 0 );
+    }
+
+    const_iterator cbegin( ) const
+    {
+        return begin( );
+    }
+
+    const_iterator cend( ) const
+    {
+        return end( );
+    }
+
+    /// first element not less than 'key'
+    iterator lower_bound( const key_type &key )
+    {
+        return bound_of<iterator, false>( this, key );
+    }
+
+    const_iterator lower_bound( const key_type &key ) const
+    {
+        return bound_of<const_iterator, false>( this, key );
+    }
+
+    /// first element greater than 'key'
+    iterator upper_bound( const key_type &key )
+    {
+        return bound_of<iterator, true>( this, key );
+    }
+
+    const_iterator upper_bound( const key_type &key ) const
+    {
+        return bound_of<const_iterator, true>( this, key );
+    }
+
+    std::pair<iterator, iterator> equal_range( const key_type &key )
+    {
+        return std::make_pair( lower_bound( key ), upper_bound( key ) );
+    }
+
+    std::pair<const_iterator, const_iterator>
+    equal_range( const key_type &key ) const
+    {
+        return std::make_pair( lower_bound( key ), upper_bound( key ) );
+    }
+
+    iterator find( const key_type &key )
+    {
+        return find_of<iterator>( this, key );
+    }
+
+    const_iterator find( const key_type &key ) const
+    {
+        return find_of<const_iterator>( this, key );
+    }
+
+    /// in-order walk along the leaf list
+    template <typename Call>
+    void for_each( Call call ) const
+    {
+        for( auto node = first_; node; node = node->right_ ) {
+            for( auto &v: node->values_ ) {
+                call( v );
+            }
+        }
+    }
+
+    void insert( value_type val )
+    {
+        using KA = key_access;
+
+        path steps;
+        auto node = descend<true>( KA::get(val), steps );
+
+        auto pos = node->upper_of( KA::get(val) );
+        node->values_.insert( node->values_.begin( ) + pos, std::move(val) );
+        ++size_;
+
+        if( !node->full( ) ) {
+            return;
+        }
+
+        node_base *right = split_leaf( node );
+        key_type   sep   = separator_of( node, static_cast<leaf *>(right) );
+
+        while( !steps.empty( ) ) {
+
+            auto step = steps.pop( );
+            auto in   = step.first;
+            pos       = step.second;
+
+            in->keys_.insert( in->keys_.begin( ) + pos, std::move(sep) );
+            in->next_.insert( in->next_.begin( ) + pos + 1, right );
+
+            if( !in->full( ) ) {
+                return;
+            }
+
+            sep   = std::move( in->keys_[inner_middle] );
+            right = split_inner( in );
+        }
+
+        auto new_root = inners_.create( );
+        new_root->keys_.push_back( std::move(sep) );
+        new_root->next_.push_back( root_ );
+        new_root->next_.push_back( right );
+        root_ = new_root;
+        ++height_;
+    }
+
+    /// removes one element equal to 'key'
+    void erase( const key_type &key )
+    {
+        using KA = key_access;
+
+        path steps;
+        auto node = descend<false>( key, steps );
+        auto pos  = node->lower_of( key );
+
+        /// the first equal may open the next leaf
+        if( pos == node->size( ) ) {
+            if( !next_leaf( steps, node ) ) {
+                return;
+            }
+            pos = 0;
+        }
+
+        if( !cmp::equal( KA::get(node->values_[pos]), key ) ) {
+            return;
+        }
+
+        node->values_.erase_pos( pos );
+        --size_;
+
+        fix_leaf( steps, node );
+    }
+
+private:
+
+    static
+    leaf *as_leaf( node_base *node )
+    {
+        return static_cast<leaf *>( node );
+    }
+
+    static
+    const leaf *as_leaf( const node_base *node )
+    {
+        return static_cast<const leaf *>( node );
+    }
+
+    static
+    inner *as_inner( node_base *node )
+    {
+        return static_cast<inner *>( node );
+    }
+
+    static
+    const inner *as_inner( const node_base *node )
+    {
+        return static_cast<const inner *>( node );
+    }
+
+    void reset( )
+    {
+        auto node = leaves_.create( );
+        root_   = node;
+        first_  = node;
+        last_   = node;
+        height_ = 0;
+        size_   = 0;
+    }
+
+    /// goes down to a leaf; 'Upper' picks the last child a key can be in,
+    /// otherwise the first one
+    template <bool Upper>
+    leaf *descend( const key_type &key, path &steps )
+    {
+        auto node = root_;
+        for( std::size_t h = height_; h > 0; --h ) {
+            auto in  = as_inner( node );
+            auto pos = Upper ? in->upper_of( key ) : in->lower_of( key );
+            steps.push( in, pos );
+            node = in->next_[pos];
+        }
+        return as_leaf( node );
+    }
+
+    /// moves 'steps' and 'node' to the next leaf
+    bool next_leaf( path &steps, leaf *&node )
+    {
+        std::size_t depth = 0;
+        while( !steps.empty( ) ) {
+            auto step = steps.pop( );
+            ++depth;
+            if( step.second < step.first->size( ) ) {
+                steps.push( step.first, step.second + 1 );
+                auto next = step.first->next_[step.second + 1];
+                while( --depth ) {
+                    steps.push( as_inner( next ), 0 );
+                    next = as_inner( next )->next_[0];
+                }
+                node = as_leaf( next );
+                return true;
+            }
+        }
+        return false;
+    }
+
+    template <typename ItrT, bool Upper, typename TreeT>
+    static
+    ItrT bound_of( TreeT *tree, const key_type &key )
+    {
+        const node_base *node = tree->root_;
+        for( std::size_t h = tree->height_; h > 0; --h ) {
+            auto in  = as_inner( node );
+            auto pos = Upper ? in->upper_of( key ) : in->lower_of( key );
+            node = in->next_[pos];
+        }
+
+        auto lf  = as_leaf( node );
+        auto pos = Upper ? lf->upper_of( key ) : lf->lower_of( key );
+        if( pos == lf->size( ) ) {
+            return ItrT( tree, lf->right_, 0 );
+        }
+        return ItrT( tree, const_cast<leaf *>( lf ), pos );
+    }
+
+    template <typename ItrT, typename TreeT>
+    static
+    ItrT find_of( TreeT *tree, const key_type &key )
+    {
+        auto res = bound_of<ItrT, false>( tree, key );
+        if( res.node_ && cmp::equal( key_access::get(*res), key ) ) {
+            return res;
+        }
+        return ItrT( tree, nullptr, 0 );
+    }
+
+    /// the separator between two neighbour leaves;
+    /// the trait may shorten it (see etool::separator)
+    static
+    key_type separator_of( const leaf *l, const leaf *r )
+    {
+        using KA = key_access;
+        return separator<value_trait>( KA::get( l->values_[l->size( ) - 1] ),
+                                       KA::get( r->values_[0] ) );
+    }
+
+    leaf *split_leaf( leaf *node )
+    {
+        static const std::size_t keep = leaf_maximum - leaf_maximum / 2;
+
+        auto right = leaves_.create( );
+        right->values_.append_range( node->values_, keep, node->size( ) );
+
+        right->left_  = node;
+        right->right_ = node->right_;
+        if( node->right_ ) {
+            node->right_->left_ = right;
+        } else {
+            last_ = right;
+        }
+        node->right_ = right;
+
+        return right;
+    }
+
+    /// keys_[inner_middle] has to be taken by the caller
+    inner *split_inner( inner *node )
+    {
+        auto right = inners_.create( );
+
+        right->keys_.append_range( node->keys_, inner_middle + 1,
+                                   node->keys_.size( ) );
+        right->next_.append_range( node->next_, inner_middle + 1,
+                                   node->next_.size( ) );
+        node->keys_.reduce( 1 );
+
+        return right;
+    }
+
+    void fix_leaf( path &steps, leaf *node )
+    {
+        if( steps.empty( ) || node->size( ) >= leaf_minimum ) {
+            return;
+        }
+
+        auto step   = steps.pop( );
+        auto parent = step.first;
+        auto pos    = step.second;
+
+        auto left  = pos > 0 ? as_leaf( parent->next_[pos - 1] ) : nullptr;
+        auto right = pos < parent->size( ) ? as_leaf( parent->next_[pos + 1] )
+                                           : nullptr;
+
+        if( left && left->has_donor( ) ) {
+
+            node->values_.push_front( std::move( left->values_.back( ) ) );
+            left->values_.reduce( 1 );
+            parent->keys_[pos - 1] = separator_of( left, node );
+
+        } else if( right && right->has_donor( ) ) {
+
+            node->values_.push_back( std::move( right->values_[0] ) );
+            right->values_.erase_pos( 0 );
+            parent->keys_[pos] = separator_of( node, right );
+
+        } else {
+
+            merge_leaves( parent, left ? pos - 1 : pos );
+            fix_inner( steps, parent );
+        }
+    }
+
+    void merge_leaves( inner *parent, std::size_t pos )
+    {
+        auto l = as_leaf( parent->next_[pos] );
+        auto r = as_leaf( parent->next_[pos + 1] );
+
+        l->values_.append_range( r->values_, 0, r->size( ) );
+
+        l->right_ = r->right_;
+        if( r->right_ ) {
+            r->right_->left_ = l;
+        } else {
+            last_ = l;
+        }
+
+        parent->keys_.erase_pos( pos );
+        parent->next_.erase_pos( pos + 1 );
+
+        leaves_.destroy( r );
+    }
+
+    void fix_inner( path &steps, inner *node )
+    {
+        while( true ) {
+
+            if( steps.empty( ) ) { /// the root
+                if( node->keys_.empty( ) ) {
+                    root_ = node->next_[0];
+                    --height_;
+                    inners_.destroy( node );
+                }
+                return;
+            }
+
+            if( node->size( ) >= inner_minimum ) {
+                return;
+            }
+
+            auto step   = steps.pop( );
+            auto parent = step.first;
+            auto pos    = step.second;
+
+            auto left  = pos > 0 ? as_inner( parent->next_[pos - 1] )
+                                 : nullptr;
+            auto right = pos < parent->size( )
+                       ? as_inner( parent->next_[pos + 1] )
+                       : nullptr;
+
+            if( left && left->has_donor( ) ) {
+
+                node->keys_.push_front( std::move( parent->keys_[pos - 1] ) );
+                node->next_.push_front( left->next_.back( ) );
+                parent->keys_[pos - 1] = std::move( left->keys_.back( ) );
+                left->keys_.reduce( 1 );
+                left->next_.reduce( 1 );
+                return;
+
+            } else if( right && right->has_donor( ) ) {
+
+                node->keys_.push_back( std::move( parent->keys_[pos] ) );
+                node->next_.push_back( right->next_[0] );
+                parent->keys_[pos] = std::move( right->keys_[0] );
+                right->keys_.erase_pos( 0 );
+                right->next_.erase_pos( 0 );
+                return;
+            }
+
+            auto mpos = left ? pos - 1 : pos;
+            auto l    = as_inner( parent->next_[mpos] );
+            auto r    = as_inner( parent->next_[mpos + 1] );
+
+            l->keys_.push_back( std::move( parent->keys_[mpos] ) );
+            l->keys_.append_range( r->keys_, 0, r->keys_.size( ) );
+            l->next_.append_range( r->next_, 0, r->next_.size( ) );
+
+            parent->keys_.erase_pos( mpos );
+            parent->next_.erase_pos( mpos + 1 );
+            inners_.destroy( r );
+
+            node = parent;
+        }
+    }
+
+    void drop( node_base *node, std::size_t height )
+    {
+        if( height == 0 ) {
+            leaves_.destroy( as_leaf( node ) );
+        } else {
+            auto in = as_inner( node );
+            for( auto n: in->next_ ) {
+                drop( n, height - 1 );
+            }
+            inners_.destroy( in );
+        }
+    }
+
+    void drop_all( )
+    {
+        if( leaf_pool::release_all && inner_pool::release_all
+            && std::is_trivially_destructible<leaf>::value
+            && std::is_trivially_destructible<inner>::value )
+        {
+            leaves_.clear( );
+            inners_.clear( );
+        } else {
+            drop( root_, height_ );
+        }
+        root_ = first_ = last_ = nullptr;
+    }
+
+public:
+
+    leaf_pool    leaves_;
+    inner_pool   inners_;
+    node_base   *root_   = nullptr;
+    leaf        *first_  = nullptr;
+    leaf        *last_   = nullptr;
+    std::size_t  height_ = 0;
+    std::size_t  size_   = 0;
+};
+
+}
+
+#endif // BPLUS_TREE_H
@@ -0,0 +1,2813 @@
+#ifndef BTREE_H
+#define BTREE_H
+
+#include <cstdint>
+#include <atomic>
+#include <bitset>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <iterator>
+#include <type_traits>
+
+#include "etool/details/operators.h"
+
+#include "dyn_array.h"
+#include "node_allocator.h"
+#include "node_search.h"
+#include "btree_traits.h"
+#include "node_sizing.h"
+#include "task_pool.h"
+#include "btree_stats.h"
+#include "btree_summary.h"
+#include "btree_deletion.h"
+
+namespace etool {
+
+namespace btree_detail {
+
+    template <std::size_t V>
+    struct log2_floor {
+        static const std::size_t value = 1 + log2_floor<V / 2>::value;
+    };
+
+    template <>
+    struct log2_floor<1> {
+        static const std::size_t value = 0;
+    };
+
+    /// operator -> for iterators whose reference is a proxy
+    template <typename RefT>
+    struct arrow {
+
+        using pointer = arrow;
+
+        static
+        arrow make( RefT ref )
+        {
+            return arrow{ ref };
+        }
+
+        const RefT *operator -> ( ) const
+        {
+            return &ref_;
+        }
+
+        RefT ref_;
+    };
+
+    template <typename T>
+    struct arrow<T &> {
+
+        using pointer = T *;
+
+        static
+        pointer make( T &ref )
+        {
+            return &ref;
+        }
+    };
+
+    /// owners of a node; a node of a plain tree has just its tree
+    template <bool Shared>
+    struct node_refs {
+
+        void retain( )
+        { }
+
+        bool release( )
+        {
+            return true;
+        }
+
+        bool exclusive( ) const
+        {
+            return true;
+        }
+    };
+
+    /// the trees and parent nodes holding a node shared with snapshots
+    template <>
+    struct node_refs<true> {
+
+        void retain( )
+        {
+            refs_.fetch_add( 1, std::memory_order_relaxed );
+        }
+
+        /// true for the last owner
+        bool release( )
+        {
+            return refs_.fetch_sub( 1, std::memory_order_acq_rel ) == 1;
+        }
+
+        bool exclusive( ) const
+        {
+            return refs_.load( std::memory_order_acquire ) == 1;
+        }
+
+        std::atomic<std::uint32_t> refs_ { 1 };
+    };
+
+    /// dead values of a leaf; none for deletion::eager
+    template <bool Tombstones, std::size_t Max>
+    struct node_tombs {
+
+        bool dead( std::size_t ) const
+        {
+            return false;
+        }
+
+        std::size_t dead_count( ) const
+        {
+            return 0;
+        }
+    };
+
+    template <std::size_t Max>
+    struct node_tombs<true, Max> {
+
+        bool dead( std::size_t pos ) const
+        {
+            return dead_count_ && dead_.test( pos );
+        }
+
+        std::size_t dead_count( ) const
+        {
+            return dead_count_;
+        }
+
+        void kill( std::size_t pos )
+        {
+            dead_.set( pos );
+            ++dead_count_;
+        }
+
+        void revive_all( )
+        {
+            dead_.reset( );
+            dead_count_ = 0;
+        }
+
+        std::bitset<Max> dead_;
+        std::size_t      dead_count_ = 0;
+    };
+
+    /// what a node knows about its subtree and, in place,
+    /// about each of its 'Children'; nothing for summary::none
+    template <typename Summary, std::size_t Children,
+              bool Enabled = Summary::enabled>
+    struct node_summary { };
+
+    template <typename Summary, std::size_t Children>
+    struct node_summary<Summary, Children, true> {
+        using monoid = typename Summary::monoid;
+        std::size_t           count_ = 0;
+        typename monoid::type agg_   = monoid::identity( );
+        std::size_t           counts_[Children];
+        typename monoid::type aggs_[Children];
+    };
+
+    /// the std algorithms behind the set operations of btree
+    struct merge_op {
+        template <typename ItrT, typename OutT, typename Less>
+        OutT operator ( ) ( ItrT b1, ItrT e1, ItrT b2, ItrT e2,
+                            OutT out, Less less ) const
+        {
+            return std::merge( b1, e1, b2, e2, out, less );
+        }
+    };
+
+    struct union_op {
+        template <typename ItrT, typename OutT, typename Less>
+        OutT operator ( ) ( ItrT b1, ItrT e1, ItrT b2, ItrT e2,
+                            OutT out, Less less ) const
+        {
+            return std::set_union( b1, e1, b2, e2, out, less );
+        }
+    };
+
+    struct intersection_op {
+        template <typename ItrT, typename OutT, typename Less>
+        OutT operator ( ) ( ItrT b1, ItrT e1, ItrT b2, ItrT e2,
+                            OutT out, Less less ) const
+        {
+            return std::set_intersection( b1, e1, b2, e2, out, less );
+        }
+    };
+
+    struct difference_op {
+        template <typename ItrT, typename OutT, typename Less>
+        OutT operator ( ) ( ItrT b1, ItrT e1, ItrT b2, ItrT e2,
+                            OutT out, Less less ) const
+        {
+            return std::set_difference( b1, e1, b2, e2, out, less );
+        }
+    };
+
+}
+
+/// Stats picks the operation counters (see btree_stats.h);
+/// stats::disabled keeps none.
+/// Summary picks the subtree summaries (see btree_summary.h);
+/// summary::none keeps none.
+/// Deletion picks eager erase or tombstones (see btree_deletion.h)
+template <typename ValueTrait, std::size_t NodeMax,
+          typename NodeAllocator = slab_allocator< >,
+          typename Stats = stats::disabled,
+          typename Summary = summary::none,
+          typename Deletion = deletion::eager >
+struct btree {
+
+    static_assert( NodeMax > 2, "Maximum must be at least 3" );
+
+    static const std::size_t maximum = NodeMax;
+    static const std::size_t middle  = maximum / 2;
+    static const std::size_t odd     = maximum % 2;
+    static const std::size_t minimum = middle  + odd - 1;
+
+    /// every inner node but the root has at least 'minimum + 1' children
+    static const std::size_t max_height =
+            64 / btree_detail::log2_floor<minimum + 1>::value + 2;
+
+    using value_trait = ValueTrait;
+    using value_type  = typename value_trait::value_type;
+    using key_type    = typename value_trait::key_type;
+    using less_cmp    = typename value_trait::less;
+    using key_access  = typename value_trait::key_access;
+    using node_layout = typename value_trait::layout;
+
+    using search_value  = typename node_layout::template
+                                   search_value<value_trait>;
+    using search_access = typename node_layout::template
+                                   search_access<value_trait>;
+
+    using search_policy = typename search::select<
+                                        typename value_trait::search,
+                                        search_value, key_type, less_cmp,
+                                        maximum>::type;
+
+    struct bnode;
+
+    /// nodes are owned by the tree through its pool
+    using node_pool = typename NodeAllocator::template pool<bnode>;
+
+    static const bool shared_nodes = NodeAllocator::shared_nodes;
+
+    btree( )
+        :root_(pool_.create( ))
+    { }
+
+    btree( const btree & ) = delete;
+    btree &operator = ( const btree & ) = delete;
+
+    btree( btree &&other )
+        :pool_(std::move(other.pool_))
+        ,root_(other.root_)
+        ,stats_(other.stats_)
+        ,pack_(std::move(other.pack_))
+    {
+        other.root_ = other.pool_.create( );
+    }
+
+    btree &operator = ( btree &&other )
+    {
+        if( this != &other ) {
+            drop_all( );
+            pool_       = std::move(other.pool_);
+            root_       = other.root_;
+            stats_      = other.stats_;
+            pack_       = std::move(other.pack_);
+            other.root_ = other.pool_.create( );
+        }
+        return *this;
+    }
+
+    ~btree( )
+    {
+        drop_all( );
+    }
+
+    /// builds the tree bottom-up from [b, e)
+    /// see 'assign'
+    template <typename ItrT>
+    btree( ItrT b, ItrT e, double fill_factor = 1.0 )
+        :root_(pool_.create( ))
+    {
+        assign( b, e, fill_factor );
+    }
+
+    /// a tree with the same values that shares every node; O(1)
+    /// Both trees copy a shared node before they change it
+    /// (the path from the root down, plus a sibling on rebalancing),
+    /// so the snapshot keeps what it was taken with. Readers may use
+    /// a snapshot without locks while this tree is written;
+    /// take it on the writer's side. Values must not be changed
+    /// through iterators while the nodes are shared.
+    /// Needs an allocator with shared nodes (shared_allocator).
+    btree snapshot( ) const
+    {
+        static_assert( shared_nodes,
+                       "snapshots need an allocator with shared nodes" );
+        root_->retain( );
+        return btree( root_, adopt_root( ) );
+    }
+
+    struct cmp {
+
+        static
+        bool equal( const key_type &l, const key_type &r )
+        {
+            using op = details::operators::cmp<key_type, less_cmp>;
+            return op::equal(l, r);
+        }
+
+        static
+        bool less( const key_type &l, const key_type &r )
+        {
+            using op = details::operators::cmp<key_type, less_cmp>;
+            return op::less(l, r);
+        }
+
+        bool operator ( ) ( const key_type &l, const key_type &r ) const
+        {
+            using op = details::operators::cmp<key_type, less_cmp>;
+            return op::less(l, r);
+        }
+
+        /// a key against a probe of another type (transparent 'less')
+        template <typename L, typename R>
+        static
+        bool equal( const L &l, const R &r )
+        {
+            return !less_cmp( )( l, r ) && !less_cmp( )( r, l );
+        }
+    };
+
+    using summary_type = typename Summary::monoid::type;
+
+    /// a leaf loses its dead values when it has this many;
+    /// never more than half of 'minimum', so that a purged leaf
+    /// and a purged sibling always make a whole leaf
+    static const std::size_t purge_cap = ( minimum + 1 ) / 2 > 0
+                                       ? ( minimum + 1 ) / 2 : 1;
+    static const std::size_t purge_at =
+            maximum * Deletion::percent / 100 == 0 ? 1
+          : maximum * Deletion::percent / 100 > purge_cap ? purge_cap
+          : maximum * Deletion::percent / 100;
+
+    using node_tombs = btree_detail::node_tombs<Deletion::tombstones,
+                                                maximum>;
+
+    struct bnode: btree_detail::node_refs<shared_nodes>,
+                  btree_detail::node_summary<Summary, maximum + 1>,
+                  node_tombs {
+
+        using ptr_type      = bnode *;
+        using value_array   = typename node_layout::template
+                                       array<value_trait, maximum>;
+        using reference     = typename value_array::reference;
+        using key_result    = typename node_layout::template
+                                       key_result<value_trait>;
+        using pointer_array = dyn_array<ptr_type,   maximum + 1>;
+
+        bnode( )
+        {
+            //values_.fill(value_type( ));
+        }
+
+        bnode( const bnode& other ) = delete;
+        void operator = ( const bnode& ) = delete;
+
+        bnode( bnode &&other )
+            :values_(std::move(other.values_))
+            ,next_(std::move(other.next_))
+        { }
+
+        bnode &operator = ( bnode &&other )
+        {
+            values_ = std::move(other.values_);
+            next_   = std::move(other.next_);
+            return *this;
+        }
+
+        reference last( )
+        {
+            return values_.back( );
+        }
+
+        reference first( )
+        {
+            return values_.front( );
+        }
+
+        key_result key( std::size_t pos ) const
+        {
+            return node_layout::template key<value_trait>( values_, pos );
+        }
+
+        /// key( pos ) < val, without building the key
+        template <typename K>
+        bool key_less( std::size_t pos, const K &val ) const
+        {
+            return node_layout::template
+                   less_at<value_trait, less_cmp>( values_, pos, val );
+        }
+
+        /// val < key( pos )
+        template <typename K>
+        bool key_greater( std::size_t pos, const K &val ) const
+        {
+            return node_layout::template
+                   greater_at<value_trait, less_cmp>( values_, pos, val );
+        }
+
+        template <typename K>
+        bool key_equal( std::size_t pos, const K &val ) const
+        {
+            return node_layout::template
+                   equal_at<value_trait, less_cmp>( values_, pos, val );
+        }
+
+        std::size_t size( ) const
+        {
+            return values_.size( );
+        }
+
+        bool empty( ) const
+        {
+            return (size( ) < minimum);
+        }
+
+        bool has_donor( ) const
+        {
+            return (size( ) > minimum);
+        }
+
+        bool full( ) const
+        {
+            return values_.full( );
+        }
+
+        bool is_leaf( ) const
+        {
+            return next_.empty( );
+        }
+
+        template <typename K>
+        std::size_t lower_of( const K &val ) const
+        {
+            return node_layout::template
+                   lower_of<search_policy, search_access, less_cmp>(
+                            values_, val );
+        }
+
+        template <typename K>
+        std::size_t upper_of( const K &val ) const
+        {
+            return node_layout::template
+                   upper_of<search_policy, search_access, less_cmp>(
+                            values_, val );
+        }
+
+        static
+        void rotate_cw( bnode *node, std::size_t pos ) // clock wise
+        {
+            auto l = node->next_[pos];
+            auto r = node->next_[pos + 1];
+
+            r->values_.push_front( node->values_.take( pos ) );
+            node_layout::put( node->values_, pos,
+                              l->values_.take( l->size( ) - 1 ) );
+
+            if( !l->is_leaf( ) ) {
+                r->next_.push_front( std::move( l->next_[l->size( )] ) );
+                l->next_.reduce( 1 );
+            }
+            l->values_.reduce( 1 );
+        }
+
+        static
+        void rotate_ccw( bnode *node, std::size_t pos ) // contra clock wise
+        {
+            auto l = node->next_[pos];
+            auto r = node->next_[pos + 1];
+
+            l->values_.push_back( node->values_.take( pos ) );
+            node_layout::put( node->values_, pos, r->values_.take( 0 ) );
+
+            if( !l->is_leaf( ) ) {
+                l->next_.push_back( std::move( r->next_[0] ) );
+                r->next_.erase_pos( 0 );
+            }
+
+            r->values_.erase_pos( 0 );
+        }
+
+        static
+        void merge( bnode *node, std::size_t pos, node_pool &pool )
+        {
+            auto l = node->next_[pos];
+            auto r = node->next_[pos + 1];
+
+            l->values_.push_back( node->values_.take( pos ) );
+
+            node->values_.erase_pos(pos);
+
+            node->next_[pos + 1] = std::move( node->next_[pos] );
+            node->next_.erase_pos(pos);
+
+            l->values_.append_range( r->values_, 0, r->size( ) );
+            l->next_.append_range( r->next_, 0, r->next_.size( ) );
+
+            pool.destroy( r );
+        }
+
+        bnode *next_left( )
+        {
+            if( size( ) > 0 ) {
+                return next_.front( );
+            }
+            return nullptr;
+        }
+
+        bnode *next_right( )
+        {
+            if( size( ) > 0 ) {
+                return next_[size( )];
+            }
+            return nullptr;
+        }
+
+        /// the middle value has to be taken by the caller
+        static
+        std::pair<ptr_type, ptr_type> split( ptr_type src, node_pool &pool )
+        {
+            ptr_type right = pool.create( );
+
+            right->values_.append_range( src->values_,
+                                         middle + 1, src->size( ) );
+            src->values_.reduce( 1 );
+
+            if( !src->next_.empty( ) ) {
+                right->next_.append_range( src->next_,
+                                           middle + 1, src->next_.size( ) );
+            }
+
+            return std::make_pair(src, right);
+        }
+
+        std::pair<bnode *, std::size_t> node_with( const key_type &val )
+        {
+            auto next = this ;
+            while( next ) {
+
+                auto pos = next->lower_of( val );
+
+                if( pos != next->values_.size( ) &&
+                    next->key_equal( pos, val ) )
+                {
+                    return std::make_pair(next, pos);
+                }
+
+                next = next->is_leaf( ) ? nullptr : next->next_[pos];
+            }
+            return std::make_pair(nullptr, 0);
+        }
+
+        template <typename NodeT>
+        static
+        NodeT *most_left( NodeT *node )
+        {
+            while( node && !node->is_leaf( ) ) {
+                node = node->next_[0];
+            }
+            return node;
+        }
+
+        template <typename NodeT>
+        static
+        NodeT *most_right( NodeT *node )
+        {
+            while( node && !node->is_leaf( ) ) {
+                node = node->next_[node->size( )];
+            }
+            return node;
+        }
+
+        template <typename Call>
+        void for_each_impl( bnode *node, Call &call )
+        {
+            std::size_t i = 0;
+            if( node->is_leaf( ) ) {
+                for( ; i<node->values_.size( ); i++ ) {
+                    if( !node->dead( i ) ) {
+                        call( node->values_[i] );
+                    }
+                }
+            } else {
+                for( ; i<node->values_.size( ); i++ ) {
+                    for_each_impl(node->next_[i], call);
+                    call( node->values_[i] );
+                }
+                for_each_impl(node->next_[i], call);
+            }
+        }
+
+        template <typename Call>
+        void for_each( Call call )
+        {
+            for_each_impl(this, call);
+        }
+
+        value_array   values_;
+        pointer_array next_;
+    };
+
+    /// nodes from the root down to some node
+    /// with the index of the child taken at every one
+    template <typename NodeT>
+    struct basic_path {
+
+        void push( NodeT *node, std::size_t pos )
+        {
+            steps_[size_++] = std::make_pair( node, pos );
+        }
+
+        std::pair<NodeT *, std::size_t> pop( )
+        {
+            return steps_[--size_];
+        }
+
+        bool empty( ) const
+        {
+            return size_ == 0;
+        }
+
+        std::pair<NodeT *, std::size_t> steps_[max_height];
+        std::size_t                     size_ = 0;
+    };
+
+    using path = basic_path<bnode>;
+
+    /// the indexes of the children taken from the root down to a node,
+    /// 'index_bits' each, packed into a few words; the nodes themselves
+    /// are found again from the root
+    struct trail {
+
+        static const std::size_t index_bits =
+                btree_detail::log2_floor<maximum>::value + 1;
+        static const std::size_t per_word = 64 / index_bits;
+        static const std::size_t words =
+                ( max_height + per_word - 1 ) / per_word;
+
+        void push( std::size_t pos )
+        {
+            set( size_++, pos );
+        }
+
+        std::size_t pop( )
+        {
+            return at( --size_ );
+        }
+
+        bool empty( ) const
+        {
+            return size_ == 0;
+        }
+
+        std::size_t at( std::size_t depth ) const
+        {
+            static const std::uint64_t mask =
+                    ( std::uint64_t( 1 ) << index_bits ) - 1;
+            return static_cast<std::size_t>(
+                ( bits_[depth / per_word]
+                  >> ( depth % per_word * index_bits ) ) & mask );
+        }
+
+        void set( std::size_t depth, std::size_t pos )
+        {
+            static const std::uint64_t mask =
+                    ( std::uint64_t( 1 ) << index_bits ) - 1;
+            auto  shift = depth % per_word * index_bits;
+            auto &word  = bits_[depth / per_word];
+            word = ( word & ~( mask << shift ) )
+                 | ( std::uint64_t( pos ) << shift );
+        }
+
+        std::uint64_t bits_[words] = { };
+        std::size_t   size_        = 0;
+    };
+
+    /// in-order bidirectional iterator
+    /// (node, pos) points to node->values_[pos]; end( ) has no node.
+    /// Nodes have no parent pointers, so the iterator carries the
+    /// indexes of the children down to its node (see trail) and walks
+    /// from the root to a parent when it goes up.
+    /// Any insert or erase invalidates all iterators.
+    template <typename NodeT, typename RefT>
+    struct basic_iterator {
+
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type        = typename btree::value_type;
+        using difference_type   = std::ptrdiff_t;
+        using reference         = RefT;
+        using pointer   = typename btree_detail::arrow<reference>::pointer;
+
+        basic_iterator( ) = default;
+
+        explicit
+        basic_iterator( NodeT *root )
+            :root_(root)
+        { }
+
+        template <typename N, typename V>
+        basic_iterator( const basic_iterator<N, V> &other )
+            :root_(other.root_)
+            ,node_(other.node_)
+            ,pos_(other.pos_)
+            ,path_(other.path_)
+        { }
+
+        reference operator * ( ) const
+        {
+            return node_->values_[pos_];
+        }
+
+        pointer operator -> ( ) const
+        {
+            return btree_detail::arrow<reference>::make( **this );
+        }
+
+        basic_iterator &operator ++ ( )
+        {
+            step_forward( );
+            skip_dead( );
+            return *this;
+        }
+
+        basic_iterator &operator -- ( )
+        {
+            do {
+                step_back( );
+            } while( node_ && node_->dead( pos_ ) );
+            return *this;
+        }
+
+        /// from a dead value to the next live one
+        void skip_dead( )
+        {
+            while( node_ && node_->dead( pos_ ) ) {
+                step_forward( );
+            }
+        }
+
+        void step_forward( )
+        {
+            if( !node_->is_leaf( ) ) {
+                path_.push( pos_ + 1 );
+                node_ = node_->next_[pos_ + 1];
+                down_left( );
+                return;
+            }
+
+            if( ++pos_ < node_->size( ) ) {
+                return;
+            }
+
+            while( !path_.empty( ) ) {
+                auto pos    = path_.pop( );
+                auto parent = node_at( path_.size_ );
+                if( pos < parent->size( ) ) {
+                    node_ = parent;
+                    pos_  = pos;
+                    return;
+                }
+            }
+
+            node_ = nullptr;
+            pos_  = 0;
+        }
+
+        void step_back( )
+        {
+            if( !node_ ) {
+                node_ = root_;
+                down_right( );
+                return;
+            }
+
+            if( !node_->is_leaf( ) ) {
+                path_.push( pos_ );
+                node_ = node_->next_[pos_];
+                down_right( );
+                return;
+            }
+
+            if( pos_ > 0 ) {
+                --pos_;
+                return;
+            }
+
+            while( !path_.empty( ) ) {
+                auto pos = path_.pop( );
+                if( pos > 0 ) {
+                    node_ = node_at( path_.size_ );
+                    pos_  = pos - 1;
+                    return;
+                }
+            }
+
+            node_ = nullptr;
+            pos_  = 0;
+        }
+
+        basic_iterator operator ++ ( int )
+        {
+            basic_iterator tmp(*this);
+            ++(*this);
+            return tmp;
+        }
+
+        basic_iterator operator -- ( int )
+        {
+            basic_iterator tmp(*this);
+            --(*this);
+            return tmp;
+        }
+
+        template <typename N, typename V>
+        bool operator == ( const basic_iterator<N, V> &other ) const
+        {
+            return (node_ == other.node_) && (pos_ == other.pos_);
+        }
+
+        template <typename N, typename V>
+        bool operator != ( const basic_iterator<N, V> &other ) const
+        {
+            return !(*this == other);
+        }
+
+        /// from node_ to its first value
+        void down_left( )
+        {
+            while( !node_->is_leaf( ) ) {
+                path_.push( 0 );
+                node_ = node_->next_[0];
+            }
+            pos_ = 0;
+        }
+
+        /// from node_ to its last value
+        void down_right( )
+        {
+            while( !node_->is_leaf( ) ) {
+                path_.push( node_->size( ) );
+                node_ = node_->next_[node_->size( )];
+            }
+            pos_ = node_->size( ) - 1;
+        }
+
+        /// the node 'depth' levels down the trail
+        NodeT *node_at( std::size_t depth ) const
+        {
+            auto node = root_;
+            for( std::size_t i = 0; i < depth; ++i ) {
+                node = node->next_[path_.at( i )];
+            }
+            return node;
+        }
+
+        NodeT       *root_ = nullptr;
+        NodeT       *node_ = nullptr;
+        std::size_t  pos_  = 0;
+        trail        path_;
+    };
+
+    using value_array    = typename bnode::value_array;
+    using iterator       = basic_iterator<bnode,
+                                          typename value_array::reference>;
+    using const_iterator = basic_iterator<const bnode,
+                                    typename value_array::const_reference>;
+
+    iterator begin( )
+    {
+        return first_of<iterator>( root_ );
+    }
+
+    iterator end( )
+    {
+        return iterator( root_ );
+    }
+
+    const_iterator begin( ) const
+    {
+        return first_of<const_iterator>( root_ );
+    }
+
+    const_iterator end( ) const
+    {
+        return const_iterator( root_ );
+    }
+
+    const_iterator cbegin( ) const
+    {
+        return begin( );
+    }
+
+    const_iterator cend( ) const
+    {
+        return end( );
+    }
+
+    /// with tombstones a tree of dead values only is empty too
+    bool empty( ) const
+    {
+        return root_->values_.empty( ) ||
+               ( Deletion::tombstones && begin( ) == end( ) );
+    }
+
+    /// number of values; O(1) with summaries, a walk over the nodes
+    /// without
+    std::size_t size( ) const
+    {
+        return count_of( root_ );
+    }
+
+    /// The queries below need summaries (Summary = summary::counted).
+    /// They run in O(log n) node visits, each of O(NodeMax).
+
+    /// number of values with keys less than 'key'
+    std::size_t rank( const key_type &key ) const
+    {
+        static_assert( Summary::enabled, "rank needs summaries" );
+        std::size_t res = 0;
+        auto node = root_;
+        while( true ) {
+            auto pos = node->lower_of( key );
+            res += pos;
+            if( node->is_leaf( ) ) {
+                for( std::size_t i = 0; i < pos && node->dead_count( ); ++i ) {
+                    res -= node->dead( i ) ? 1 : 0;
+                }
+                return res;
+            }
+            for( std::size_t i = 0; i < pos; ++i ) {
+                res += node->counts_[i];
+            }
+            node = node->next_[pos];
+        }
+    }
+
+    /// the value at index 'idx' in key order; end( ) past the last
+    iterator select( std::size_t idx )
+    {
+        return select_of<iterator>( root_, idx );
+    }
+
+    const_iterator select( std::size_t idx ) const
+    {
+        return select_of<const_iterator>( root_, idx );
+    }
+
+    /// number of values with keys in [lo, hi)
+    std::size_t count_range( const key_type &lo, const key_type &hi ) const
+    {
+        auto l = rank( lo );
+        auto h = rank( hi );
+        return h > l ? h - l : 0;
+    }
+
+    /// the monoid folded over all the values; O(1)
+    summary_type aggregate( ) const
+    {
+        static_assert( Summary::enabled, "aggregate needs summaries" );
+        return root_->agg_;
+    }
+
+    /// the monoid folded over the values with keys in [lo, hi)
+    summary_type aggregate( const key_type &lo, const key_type &hi ) const
+    {
+        static_assert( Summary::enabled, "aggregate needs summaries" );
+        if( !cmp::less( lo, hi ) ) {
+            return monoid::identity( );
+        }
+        return fold_range( root_, &lo, &hi );
+    }
+
+    /// the node shape of this instantiation, for diagnostics
+    struct geometry_info {
+        std::size_t node_max;
+        std::size_t minimum;
+        std::size_t max_height;
+        std::size_t value_bytes;
+        std::size_t node_bytes;
+    };
+
+    static
+    geometry_info geometry( )
+    {
+        return geometry_info { maximum, minimum, max_height,
+                               sizeof(value_type), sizeof(bnode) };
+    }
+
+    /// first element not less than 'key'
+    iterator lower_bound( const key_type &key )
+    {
+        return bound_of<iterator, false>( root_, key );
+    }
+
+    const_iterator lower_bound( const key_type &key ) const
+    {
+        return bound_of<const_iterator, false>( root_, key );
+    }
+
+    /// first element greater than 'key'
+    iterator upper_bound( const key_type &key )
+    {
+        return bound_of<iterator, true>( root_, key );
+    }
+
+    const_iterator upper_bound( const key_type &key ) const
+    {
+        return bound_of<const_iterator, true>( root_, key );
+    }
+
+    std::pair<iterator, iterator> equal_range( const key_type &key )
+    {
+        return std::make_pair( lower_bound( key ), upper_bound( key ) );
+    }
+
+    std::pair<const_iterator, const_iterator>
+    equal_range( const key_type &key ) const
+    {
+        return std::make_pair( lower_bound( key ), upper_bound( key ) );
+    }
+
+    iterator find( const key_type &key )
+    {
+        return find_of<iterator>( root_, key );
+    }
+
+    const_iterator find( const key_type &key ) const
+    {
+        return find_of<const_iterator>( root_, key );
+    }
+
+    /// Lookups with any 'K' comparable to the key; only for traits
+    /// with a transparent comparator (see etool::transparent_less)
+
+    template <typename K, typename L = less_cmp,
+              typename = if_transparent<L> >
+    iterator lower_bound( const K &key )
+    {
+        return bound_of<iterator, false>( root_, key );
+    }
+
+    template <typename K, typename L = less_cmp,
+              typename = if_transparent<L> >
+    const_iterator lower_bound( const K &key ) const
+    {
+        return bound_of<const_iterator, false>( root_, key );
+    }
+
+    template <typename K, typename L = less_cmp,
+              typename = if_transparent<L> >
+    iterator upper_bound( const K &key )
+    {
+        return bound_of<iterator, true>( root_, key );
+    }
+
+    template <typename K, typename L = less_cmp,
+              typename = if_transparent<L> >
+    const_iterator upper_bound( const K &key ) const
+    {
+        return bound_of<const_iterator, true>( root_, key );
+    }
+
+    template <typename K, typename L = less_cmp,
+              typename = if_transparent<L> >
+    std::pair<iterator, iterator> equal_range( const K &key )
+    {
+        return std::make_pair( lower_bound( key ), upper_bound( key ) );
+    }
+
+    template <typename K, typename L = less_cmp,
+              typename = if_transparent<L> >
+    std::pair<const_iterator, const_iterator>
+    equal_range( const K &key ) const
+    {
+        return std::make_pair( lower_bound( key ), upper_bound( key ) );
+    }
+
+    template <typename K, typename L = less_cmp,
+              typename = if_transparent<L> >
+    iterator find( const K &key )
+    {
+        return find_of<iterator>( root_, key );
+    }
+
+    template <typename K, typename L = less_cmp,
+              typename = if_transparent<L> >
+    const_iterator find( const K &key ) const
+    {
+        return find_of<const_iterator>( root_, key );
+    }
+
+    /// removes one element equal to 'val'
+    void erase( const key_type &val )
+    {
+        erase_one( val );
+    }
+
+    template <typename K, typename L = less_cmp,
+              typename = if_transparent<L> >
+    void erase( const K &val )
+    {
+        erase_one( val );
+    }
+
+    /// One pass down collects the path,
+    /// full nodes are split on the way back up
+    void insert( value_type val )
+    {
+        using KA = key_access;
+
+        unshare_root( );
+
+        path steps;
+        auto node = root_;
+        auto pos  = node->lower_of( KA::get(val) );
+
+        while( !node->is_leaf( ) ) {
+            steps.push( node, pos );
+            node = unshare( node, pos );
+            pos  = node->lower_of( KA::get(val) );
+        }
+
+        if( purge( node ) ) {
+            pos = node->lower_of( KA::get(val) );
+        }
+
+        node->values_.insert( node->values_.begin( ) + pos, std::move(val) );
+
+        settle_leaf( steps, node );
+    }
+
+    /// inserts the sorted run [b, e)
+    /// Every descent merges all the values bound for the leaf it reaches
+    /// (as many as the leaf has room for) in one pass
+    /// and splits the leaf once.
+    /// Unsorted input is sorted into a copy first.
+    template <typename ItrT>
+    void insert_batch( ItrT b, ItrT e )
+    {
+        using KA = key_access;
+
+        if( !std::is_sorted( b, e, value_less( ) ) ) {
+            std::vector<value_type> sorted( b, e );
+            std::stable_sort( sorted.begin( ), sorted.end( ), value_less( ) );
+            insert_batch( std::make_move_iterator( sorted.begin( ) ),
+                          std::make_move_iterator( sorted.end( ) ) );
+            return;
+        }
+
+        if( empty( ) ) {
+            drop_all( );
+            build( b, static_cast<std::size_t>(std::distance( b, e )),
+                   keys_for_fill( 1.0 ) );
+            return;
+        }
+
+        while( b != e ) {
+
+            unshare_root( );
+
+            path steps;
+            const bnode *upper = nullptr;
+            std::size_t upper_pos = 0;
+            auto node = root_;
+            auto pos  = node->lower_of( KA::get(*b) );
+
+            while( !node->is_leaf( ) ) {
+                if( pos < node->size( ) ) {
+                    upper     = node;
+                    upper_pos = pos;
+                }
+                steps.push( node, pos );
+                node = unshare( node, pos );
+                pos  = node->lower_of( KA::get(*b) );
+            }
+
+            purge( node );
+
+            /// the run ends at the separator to the right of the leaf
+            auto room  = maximum - node->size( );
+            auto last  = std::next( b );
+            std::size_t count = 1;
+            while( last != e && count < room &&
+                   ( !upper ||
+                     !upper->key_less( upper_pos, KA::get(*last) ) ) )
+            {
+                ++last;
+                ++count;
+            }
+
+            node->values_.merge( b, count, value_before( ) );
+            b = last;
+
+            settle_leaf( steps, node );
+        }
+    }
+
+    /// removes one element for every key of the sorted run [b, e)
+    /// returns the number of removed elements
+    /// Keys bound for the same leaf are removed in one pass,
+    /// the leaf is rebalanced once.
+    /// Unsorted input is sorted into a copy first.
+    template <typename ItrT>
+    std::size_t erase_batch( ItrT b, ItrT e )
+    {
+        if( !std::is_sorted( b, e, cmp( ) ) ) {
+            std::vector<key_type> sorted( b, e );
+            std::sort( sorted.begin( ), sorted.end( ), cmp( ) );
+            return erase_batch( sorted.begin( ), sorted.end( ) );
+        }
+
+        std::size_t res = 0;
+
+        while( b != e && !empty( ) ) {
+
+            unshare_root( );
+
+            path steps;
+            const bnode *upper = nullptr;
+            std::size_t upper_pos = 0;
+            auto node  = root_;
+            auto pos   = node->lower_of( *b );
+            bool inner = false;
+
+            while( !node->is_leaf( ) ) {
+                if( pos < node->size( ) ) {
+                    if( node->key_equal( pos, *b ) ) {
+                        inner = true;
+                        break;
+                    }
+                    upper     = node;
+                    upper_pos = pos;
+                }
+                steps.push( node, pos );
+                node = unshare( node, pos );
+                pos  = node->lower_of( *b );
+            }
+
+            /// separators are rare; they go one by one
+            if( inner ) {
+                erase( *b );
+                ++b;
+                ++res;
+                continue;
+            }
+
+            /// a leaf short of values after losing its dead ones
+            /// is rebalanced before the run
+            if( purge( node ) ) {
+                if( node->empty( ) && !steps.empty( ) ) {
+                    fix_up( steps, node );
+                    continue;
+                }
+                pos = node->lower_of( *b );
+            }
+
+            /// a leaf may lose values down to 'minimum - 1',
+            /// which is what fix_up can repair
+            auto limit = steps.empty( ) ? node->size( )
+                                        : node->size( ) - minimum + 1;
+
+            res += erase_run( node, pos, b, e, upper, upper_pos, limit );
+            fix_up( steps, node );
+        }
+
+        return res;
+    }
+
+    /// replaces the content of the tree with [b, e)
+    /// Nodes are packed level by level from the leaves up;
+    /// 'fill_factor' (0, 1] sets the target occupancy of every node.
+    /// Sorted input is used as is, otherwise it is sorted into a copy first.
+    template <typename ItrT>
+    void assign( ItrT b, ItrT e, double fill_factor = 1.0 )
+    {
+        drop_all( );
+
+        if( std::is_sorted( b, e, value_less( ) ) ) {
+            build( b, static_cast<std::size_t>(std::distance( b, e )),
+                   keys_for_fill( fill_factor ) );
+        } else {
+            std::vector<value_type> sorted( b, e );
+            std::stable_sort( sorted.begin( ), sorted.end( ), value_less( ) );
+            build( std::make_move_iterator( sorted.begin( ) ), sorted.size( ),
+                   keys_for_fill( fill_factor ) );
+        }
+    }
+
+    /// what compact and compact_step did
+    struct compaction {
+        std::size_t nodes_freed = 0; ///< nodes the tree has fewer
+        /// memory given back to the system: with heap and shared pools
+        /// the nodes deleted for good, less the copies made of nodes
+        /// shared with snapshots (a node a snapshot holds stays);
+        /// with a slab pool the chunks left without a live node,
+        /// released by the call that finishes a pass
+        std::size_t bytes_freed = 0;
+        std::size_t height      = 0; ///< of the tree afterwards
+        bool        done        = false;
+    };
+
+    /// repacks the whole tree in place: compact_step passes from the
+    /// leaves up until one frees no node; with tombstones every dead
+    /// value goes. Takes no copy of the values, a leaf at the end of
+    /// its parent may stay short of full.
+    compaction compact( )
+    {
+        pack_ = pack_cursor( );
+
+        compaction res;
+        auto balance = pool_.balance( );
+        std::size_t freed = 0;
+        do {
+            std::size_t visited = 0;
+            bool done = false;
+            freed = 0;
+            while( !done ) {
+                freed += pack_next( visited, done );
+            }
+            res.nodes_freed += freed;
+        } while( freed );
+
+        if( root_->is_leaf( ) ) {
+            unshare_root( );
+            purge( root_ );
+        }
+
+        res.bytes_freed = released( balance );
+        res.height      = height_of( root_ ) + 1;
+        res.done        = true;
+        return res;
+    }
+
+    /// repacks the tree in place, a few nodes per call, so that it can
+    /// run between other updates. Every call takes the next parent
+    /// nodes from where the last one stopped, fills their children to
+    /// 'maximum - 1' values from the left and merges away those left
+    /// empty, until it has visited about 'nodes' nodes.
+    /// One pass goes over the parents of the leaves, the next one a
+    /// level higher, up to the root; the tree loses a level whenever
+    /// the root is left with one child. 'done' is set by the call that
+    /// finishes the root; the next call starts over.
+    /// Updates between calls are fine; the place is kept as a key.
+    compaction compact_step( std::size_t nodes )
+    {
+        compaction res;
+        auto balance = pool_.balance( );
+        std::size_t visited = 0;
+        while( !res.done && visited < std::max<std::size_t>( nodes, 1 ) ) {
+            res.nodes_freed += pack_next( visited, res.done );
+        }
+        res.bytes_freed = released( balance, res.done );
+        res.height      = height_of( root_ ) + 1;
+        return res;
+    }
+
+    /// the counters of the 'Stats' policy (all zero for stats::disabled)
+    /// and the shape of the tree, which takes a walk over every node;
+    /// an empty tree is one empty leaf
+    stats::report statistics( ) const
+    {
+        stats::report res;
+        res.counting = Stats::enabled;
+        stats_.read( res.ops );
+        shape_of( root_, 1, res.shape );
+        return res;
+    }
+
+    void reset_statistics( )
+    {
+        stats_.reset( );
+    }
+
+    /// calls call( value ) for every value on the threads of 'pool'
+    /// The tree is cut along the child links of its upper levels
+    /// into a few subtrees per thread. The calls run concurrently and
+    /// in no particular order; 'call' is shared by all the threads.
+    /// The tree must not change meanwhile.
+    template <typename Call>
+    void parallel_for_each( Call call, task_pool &pool ) const
+    {
+        parallel_scan( nullptr, nullptr, call, pool );
+    }
+
+    /// the same for the values with keys in [lo, hi)
+    template <typename Call>
+    void parallel_for_each( const key_type &lo, const key_type &hi,
+                            Call call, task_pool &pool ) const
+    {
+        parallel_scan( &lo, &hi, call, pool );
+    }
+
+    /// folds every value into one result on the threads of 'pool'
+    /// Every piece of the tree is folded in key order from 'init' with
+    /// acc = reduce( acc, value ); the results of the pieces are then
+    /// combined in key order with combine( left, right ).
+    /// 'init' must be neutral to 'combine', 'combine' associative;
+    /// order dependent results (lists, first/last) come out ordered.
+    template <typename T, typename Reduce, typename Combine>
+    T parallel_reduce( T init, Reduce reduce, Combine combine,
+                       task_pool &pool ) const
+    {
+        return parallel_fold( nullptr, nullptr, std::move(init),
+                              reduce, combine, pool );
+    }
+
+    /// the same for the values with keys in [lo, hi)
+    template <typename T, typename Reduce, typename Combine>
+    T parallel_reduce( const key_type &lo, const key_type &hi, T init,
+                       Reduce reduce, Combine combine,
+                       task_pool &pool ) const
+    {
+        return parallel_fold( &lo, &hi, std::move(init),
+                              reduce, combine, pool );
+    }
+
+    /// Set operations; the result is a new tree, 'a' and 'b' stay.
+    /// Equal values count as in the std algorithms of the same name:
+    /// 'merge' keeps all of both (those of 'a' first), 'set_union' the
+    /// larger count, 'set_intersection' the smaller one (from 'a'),
+    /// 'set_difference' what 'a' has more of than 'b'.
+    /// Both trees are streamed in key order and the result is built
+    /// packed in O(n + m). When the key ranges don't overlap the trees
+    /// are not streamed: the result takes the nodes of both and joins
+    /// them along the spine of the taller one in O(log n) steps.
+    /// The nodes are shared if the allocator has shared nodes,
+    /// copied otherwise.
+
+    static
+    btree merge( const btree &a, const btree &b )
+    {
+        return combine( a, b, btree_detail::merge_op( ), true );
+    }
+
+    static
+    btree set_union( const btree &a, const btree &b )
+    {
+        return combine( a, b, btree_detail::union_op( ), false );
+    }
+
+    static
+    btree set_intersection( const btree &a, const btree &b )
+    {
+        if( a.empty( ) || b.empty( ) || apart( a, b ) || apart( b, a ) ) {
+            return btree( );
+        }
+        return stream( a, b, btree_detail::intersection_op( ) );
+    }
+
+    static
+    btree set_difference( const btree &a, const btree &b )
+    {
+        if( a.empty( ) || b.empty( ) || apart( a, b ) || apart( b, a ) ) {
+            btree res;
+            res.adopt( a );
+            return res;
+        }
+        return stream( a, b, btree_detail::difference_op( ) );
+    }
+
+private:
+
+    /// removes one element equal to 'val';
+    /// one pass down collects the path, the way back up
+    /// rebalances underflown nodes.
+    template <typename K>
+    void erase_one( const K &val )
+    {
+        unshare_root( );
+
+        path steps;
+        auto node = root_;
+        std::size_t pos = 0;
+
+        while( true ) {
+            pos = node->lower_of( val );
+            if( pos != node->size( ) && node->key_equal( pos, val ) )
+            {
+                break;
+            }
+            if( node->is_leaf( ) ) {
+                return;
+            }
+            steps.push( node, pos );
+            node = unshare( node, pos );
+        }
+
+        if( node->is_leaf( ) && Deletion::tombstones ) {
+            bury( steps, node, pos, val );
+            return;
+        } else if( node->is_leaf( ) ) {
+            node->values_.erase_pos( pos );
+        } else {
+            /// the greatest value on the left takes the place
+            steps.push( node, pos );
+            auto ml = unshare( node, pos );
+            while( !ml->is_leaf( ) ) {
+                steps.push( ml, ml->size( ) );
+                ml = unshare( ml, ml->size( ) );
+            }
+            /// short of values without the dead ones: the tree is
+            /// rebalanced and the search starts over
+            if( purge( ml ) && ml->empty( ) ) {
+                fix_up( steps, ml );
+                erase_one( val );
+                return;
+            }
+            node_layout::put( node->values_, pos,
+                              ml->values_.take( ml->size( ) - 1 ) );
+            ml->values_.reduce( 1 );
+            node = ml;
+        }
+
+        fix_up( steps, node );
+    }
+
+    using key_result = typename bnode::key_result;
+
+    static
+    key_result first_key( const bnode *node )
+    {
+        while( !node->is_leaf( ) ) {
+            node = node->next_[0];
+        }
+        return node->key( 0 );
+    }
+
+    static
+    key_result last_key( const bnode *node )
+    {
+        while( !node->is_leaf( ) ) {
+            node = node->next_[node->size( )];
+        }
+        return node->key( node->size( ) - 1 );
+    }
+
+    /// every key of 'a' is less than every key of 'b'
+    static
+    bool apart( const btree &a, const btree &b )
+    {
+        return cmp::less( last_key( a.root_ ), first_key( b.root_ ) );
+    }
+
+    /// 'merge' and 'set_union' of trees that don't overlap
+    /// is the one after the other (not with tombstones: a dead value
+    /// must not become the separator). For 'merge' ('touching') the last key
+    /// of the first tree may equal the first of the second.
+    template <typename Op>
+    static
+    btree combine( const btree &a, const btree &b, Op op, bool touching )
+    {
+        btree res;
+        if( b.empty( ) ) {
+            res.adopt( a );
+        } else if( a.empty( ) ) {
+            res.adopt( b );
+        } else if( Deletion::tombstones ) {
+            res = stream( a, b, op );
+        } else if( apart( a, b ) ||
+                   ( touching &&
+                     !cmp::less( first_key( b.root_ ), last_key( a.root_ ) ) ) )
+        {
+            res.drop_all( );
+            auto left = res.graft( a.root_ );
+            res.join( left, res.graft( b.root_ ) );
+        } else if( apart( b, a ) ) {
+            res.drop_all( );
+            auto left = res.graft( b.root_ );
+            res.join( left, res.graft( a.root_ ) );
+        } else {
+            res = stream( a, b, op );
+        }
+        return res;
+    }
+
+    template <typename Op>
+    static
+    btree stream( const btree &a, const btree &b, Op op )
+    {
+        std::vector<value_type> values;
+        op( a.begin( ), a.end( ), b.begin( ), b.end( ),
+            std::back_inserter( values ), value_less( ) );
+
+        btree res;
+        res.drop_all( );
+        res.build( std::make_move_iterator( values.begin( ) ),
+                   values.size( ), keys_for_fill( 1.0 ) );
+        return res;
+    }
+
+    /// the nodes of 'other' become the content of this tree
+    void adopt( const btree &other )
+    {
+        drop_all( );
+        root_ = graft( other.root_ );
+    }
+
+    /// the subtree of 'node' of another tree, owned by this one
+    bnode *graft( bnode *node )
+    {
+        return graft( node, shared_tag( ) );
+    }
+
+    bnode *graft( bnode *node, std::true_type )
+    {
+        node->retain( );
+        return node;
+    }
+
+    bnode *graft( bnode *node, std::false_type )
+    {
+        auto res = pool_.create( );
+        res->values_ = node->values_;
+        static_cast<node_tombs &>( *res ) = *node;
+        for( auto n: node->next_ ) {
+            res->next_.push_back( graft( n, std::false_type( ) ) );
+        }
+        refresh( res );
+        return res;
+    }
+
+    static
+    std::size_t height_of( const bnode *node )
+    {
+        std::size_t res = 0;
+        for( ; !node->is_leaf( ); node = node->next_[0] ) {
+            ++res;
+        }
+        return res;
+    }
+
+    /// removes the first value; the tree must not be empty
+    value_type take_first( )
+    {
+        unshare_root( );
+
+        path steps;
+        auto node = root_;
+        while( !node->is_leaf( ) ) {
+            steps.push( node, 0 );
+            node = unshare( node, 0 );
+        }
+
+        value_type res = node->values_.take( 0 );
+        node->values_.erase_pos( 0 );
+        fix_up( steps, node );
+        return res;
+    }
+
+    /// adds 'val' behind all the values
+    void push_last( value_type val )
+    {
+        unshare_root( );
+
+        path steps;
+        auto node = root_;
+        while( !node->is_leaf( ) ) {
+            steps.push( node, node->size( ) );
+            node = unshare( node, node->size( ) );
+        }
+
+        node->values_.push_back( std::move(val) );
+        split_up( steps, node );
+    }
+
+    /// the tree of 'left', followed by the tree of 'right';
+    /// both are owned by this tree, which has no root of its own,
+    /// and non empty.
+    /// The first value of 'right' becomes the separator; the shorter
+    /// tree hangs off the spine of the taller one next to a node of
+    /// its height, and the two are merged or balanced if needed.
+    void join( bnode *left, bnode *right )
+    {
+        root_ = right;
+        auto sep = take_first( );
+        right = root_;
+
+        if( right->values_.empty( ) ) {
+            drop( right );
+            root_ = left;
+            push_last( std::move(sep) );
+            return;
+        }
+
+        auto hl = height_of( left );
+        auto hr = height_of( right );
+
+        path steps;
+        bnode *node = nullptr;
+        std::size_t pos = 0;
+
+        if( hl == hr ) {
+            node = pool_.create( );
+            node->values_.push_back( std::move(sep) );
+            node->next_.push_back( left );
+            node->next_.push_back( right );
+            root_ = node;
+        } else if( hl > hr ) {
+            root_ = left;
+            unshare_root( );
+            node = root_;
+            for( auto h = hl; h > hr + 1; --h ) {
+                steps.push( node, node->size( ) );
+                node = unshare( node, node->size( ) );
+            }
+            pos = node->size( );
+            node->values_.push_back( std::move(sep) );
+            node->next_.push_back( right );
+        } else {
+            root_ = right;
+            unshare_root( );
+            node = root_;
+            for( auto h = hr; h > hl + 1; --h ) {
+                steps.push( node, 0 );
+                node = unshare( node, 0 );
+            }
+            node->values_.push_front( std::move(sep) );
+            node->next_.push_front( left );
+        }
+
+        settle( steps, node, pos );
+    }
+
+    /// the children 'pos' and 'pos + 1' of 'node' are new neighbours;
+    /// either may be short of 'minimum'
+    void settle( path &steps, bnode *node, std::size_t pos )
+    {
+        auto l = unshare( node, pos );
+        auto r = unshare( node, pos + 1 );
+
+        if( l->size( ) + r->size( ) + 1 < maximum ) {
+            bnode::merge( node, pos, pool_ );
+            refresh( l );
+            stats_.on_merge( );
+            if( node == root_ && node->values_.empty( ) ) {
+                root_ = l;
+                pool_.destroy( node );
+                stats_.on_root_collapse( );
+                return;
+            }
+        } else {
+            while( l->empty( ) ) {
+                bnode::rotate_ccw( node, pos );
+                stats_.on_borrow_right( );
+            }
+            while( r->empty( ) ) {
+                bnode::rotate_cw( node, pos );
+                stats_.on_borrow_left( );
+            }
+            refresh( l );
+            refresh( r );
+        }
+        split_up( steps, node );
+    }
+
+    using monoid       = typename Summary::monoid;
+    using summary_tag  = std::integral_constant<bool, Summary::enabled>;
+
+    std::size_t count_of( const bnode *node ) const
+    {
+        return count_of( node, summary_tag( ) );
+    }
+
+    std::size_t count_of( const bnode *node, std::true_type ) const
+    {
+        return node->count_;
+    }
+
+    std::size_t count_of( const bnode *node, std::false_type ) const
+    {
+        std::size_t res = node->size( ) - node->dead_count( );
+        if( !node->is_leaf( ) ) {
+            for( auto n: node->next_ ) {
+                res += count_of( n, std::false_type( ) );
+            }
+        }
+        return res;
+    }
+
+    template <typename ItrT, typename NodeT>
+    ItrT select_of( NodeT *root, std::size_t idx ) const
+    {
+        static_assert( Summary::enabled, "select needs summaries" );
+        ItrT res( root );
+        if( idx >= root->count_ ) {
+            return res;
+        }
+        auto node = root;
+        while( !node->is_leaf( ) ) {
+            std::size_t pos = 0;
+            for( ; idx >= node->counts_[pos]; ++pos ) {
+                idx -= node->counts_[pos];
+                if( idx == 0 ) {
+                    res.node_ = node;
+                    res.pos_  = pos;
+                    return res;
+                }
+                --idx;
+            }
+            res.path_.push( pos );
+            node = node->next_[pos];
+        }
+        std::size_t pos = 0;
+        for( ; idx > 0 || node->dead( pos ); ++pos ) {
+            idx -= node->dead( pos ) ? 0 : 1;
+        }
+        res.node_ = node;
+        res.pos_  = pos;
+        return res;
+    }
+
+    /// the fold of the values of the subtree with keys in [*lo, *hi);
+    /// a null bound is open. Below the node where the bounds part
+    /// every node has one open side, so two paths are walked.
+    summary_type fold_range( const bnode *node, const key_type *lo,
+                             const key_type *hi ) const
+    {
+        if( !lo && !hi ) {
+            return node->agg_;
+        }
+
+        auto first = lo ? node->lower_of( *lo ) : 0;
+        auto last  = hi ? node->lower_of( *hi ) : node->size( );
+        auto res   = monoid::identity( );
+
+        if( node->is_leaf( ) ) {
+            for( auto i = first; i < last; ++i ) {
+                if( !node->dead( i ) ) {
+                    res = monoid::combine( res,
+                                           monoid::of( node->values_[i] ) );
+                }
+            }
+            return res;
+        }
+
+        res = fold_range( node->next_[first], lo,
+                          first == last ? hi : nullptr );
+        for( auto i = first; i < last; ++i ) {
+            res = monoid::combine( res, monoid::of( node->values_[i] ) );
+            res = monoid::combine( res,
+                                   i + 1 == last
+                                   ? fold_range( node->next_[i + 1],
+                                                 nullptr, hi )
+                                   : node->aggs_[i + 1] );
+        }
+        return res;
+    }
+
+    /// recounts the summary of 'node' from its values and children;
+    /// for nodes whose children moved
+    void refresh( bnode *node )
+    {
+        refresh( node, summary_tag( ) );
+    }
+
+    void refresh( bnode *, std::false_type )
+    { }
+
+    void refresh( bnode *node, std::true_type )
+    {
+        if( !node->is_leaf( ) ) {
+            for( std::size_t i = 0; i < node->next_.size( ); ++i ) {
+                node->counts_[i] = node->next_[i]->count_;
+                node->aggs_[i]   = node->next_[i]->agg_;
+            }
+        }
+        total( node );
+    }
+
+    /// the summary of 'node' from its values and what it knows
+    /// about its children; reads no other node
+    static
+    void total( bnode *node )
+    {
+        auto count = node->size( ) - node->dead_count( );
+        auto agg   = monoid::identity( );
+        bool inner = !node->is_leaf( );
+        for( std::size_t i = 0; i < node->size( ); ++i ) {
+            if( inner ) {
+                count += node->counts_[i];
+                agg = monoid::combine( agg, node->aggs_[i] );
+            }
+            if( !node->dead( i ) ) {
+                agg = monoid::combine( agg, monoid::of( node->values_[i] ) );
+            }
+        }
+        if( inner ) {
+            count += node->counts_[node->size( )];
+            agg = monoid::combine( agg, node->aggs_[node->size( )] );
+        }
+        node->count_ = count;
+        node->agg_   = agg;
+    }
+
+    /// refreshes the rest of the path, from the bottom up;
+    /// only the child on the path changed in every node
+    void refresh_up( path &steps )
+    {
+        refresh_up( steps, summary_tag( ) );
+    }
+
+    void refresh_up( path &, std::false_type )
+    { }
+
+    void refresh_up( path &steps, std::true_type )
+    {
+        while( !steps.empty( ) ) {
+            auto step  = steps.pop( );
+            auto node  = step.first;
+            auto child = node->next_[step.second];
+            node->counts_[step.second] = child->count_;
+            node->aggs_[step.second]   = child->agg_;
+            total( node );
+        }
+    }
+
+    struct adopt_root { };
+
+    /// takes over a node whose reference is already counted
+    btree( bnode *root, adopt_root )
+        :root_(root)
+    { }
+
+    using shared_tag = std::integral_constant<bool, shared_nodes>;
+
+    /// a copy of 'src' sharing its children
+    bnode *clone( const bnode *src )
+    {
+        auto res = pool_.create( );
+        stats_.on_copy( );
+        res->values_ = src->values_;
+        res->next_   = src->next_;
+        static_cast<node_tombs &>( *res ) = *src;
+        for( auto n: res->next_ ) {
+            n->retain( );
+        }
+        refresh( res );
+        return res;
+    }
+
+    /// the child 'pos' of 'node' made private to this tree;
+    /// a child shared with a snapshot is replaced by a copy
+    bnode *unshare( bnode *node, std::size_t pos )
+    {
+        return unshare( node, pos, shared_tag( ) );
+    }
+
+    bnode *unshare( bnode *node, std::size_t pos, std::false_type )
+    {
+        return node->next_[pos];
+    }
+
+    bnode *unshare( bnode *node, std::size_t pos, std::true_type )
+    {
+        auto child = node->next_[pos];
+        if( !child->exclusive( ) ) {
+            node->next_[pos] = clone( child );
+            drop( child );
+        }
+        return node->next_[pos];
+    }
+
+    void unshare_root( )
+    {
+        unshare_root( shared_tag( ) );
+    }
+
+    void unshare_root( std::false_type )
+    { }
+
+    void unshare_root( std::true_type )
+    {
+        if( !root_->exclusive( ) ) {
+            auto old = root_;
+            root_ = clone( old );
+            drop( old );
+        }
+    }
+
+    struct value_less {
+        bool operator ( ) ( const value_type &l, const value_type &r ) const
+        {
+            return cmp::less( key_access::get(l), key_access::get(r) );
+        }
+    };
+
+    /// a new value goes in front of the equal ones, as with 'insert'
+    struct value_before {
+        template <typename V, typename E>
+        bool operator ( ) ( const V &val, const E &elem ) const
+        {
+            return !cmp::less( key_access::get(elem), key_access::get(val) );
+        }
+    };
+
+    static
+    void shape_of( const bnode *node, std::size_t depth,
+                   stats::structure &res )
+    {
+        using shape = stats::structure;
+        static const std::size_t capacity = maximum - 1;
+
+        auto bucket = node->size( ) * shape::fill_buckets / capacity;
+
+        res.height      = std::max( res.height, depth );
+        res.nodes      += 1;
+        res.values     += node->size( );
+        res.capacity   += capacity;
+        res.node_bytes += sizeof(bnode);
+        res.fill[std::min( bucket, shape::fill_buckets - 1 )] += 1;
+
+        if( node->is_leaf( ) ) {
+            res.leaves += 1;
+        } else {
+            for( auto n: node->next_ ) {
+                shape_of( n, depth + 1, res );
+            }
+        }
+    }
+
+    /// pieces of a parallel scan per thread of the pool;
+    /// spare pieces let fast threads steal from slow ones
+    static const std::size_t pieces_per_thread = 8;
+
+    /// a part of a parallel scan: the whole subtree of 'node'
+    /// or only the values [first, last) of 'node'
+    struct scan_piece {
+        const bnode *node;
+        std::size_t  first;
+        std::size_t  last;
+        bool         whole;
+    };
+
+    template <typename T, typename Reduce>
+    struct fold_into {
+        template <typename V>
+        void operator ( ) ( const V &val )
+        {
+            acc = reduce( std::move(acc), val );
+        }
+        T      &acc;
+        Reduce &reduce;
+    };
+
+    /// the pieces holding the values in [*lo, *hi), in key order;
+    /// a null bound is open. Subtrees are taken whole from the first
+    /// level with at least 'count' nodes; subtrees the bounds cut
+    /// are split further down to the leaves.
+    std::vector<scan_piece> scan_pieces( const key_type *lo,
+                                         const key_type *hi,
+                                         std::size_t count ) const
+    {
+        std::size_t depth = 0;
+        std::vector<const bnode *> level( 1, root_ );
+        while( level.size( ) < count && !level.front( )->is_leaf( ) ) {
+            std::vector<const bnode *> next;
+            for( auto n: level ) {
+                next.insert( next.end( ), n->next_.begin( ),
+                                          n->next_.end( ) );
+            }
+            level.swap( next );
+            ++depth;
+        }
+
+        std::vector<scan_piece> res;
+        if( !empty( ) ) {
+            collect_pieces( root_, depth, lo, hi, !lo, !hi, res );
+        }
+        return res;
+    }
+
+    /// 'lo_in' and 'hi_in' tell that the bound can't cut the subtree
+    static
+    void collect_pieces( const bnode *node, std::size_t depth,
+                         const key_type *lo, const key_type *hi,
+                         bool lo_in, bool hi_in,
+                         std::vector<scan_piece> &res )
+    {
+        if( lo_in && hi_in && depth == 0 ) {
+            res.push_back( scan_piece { node, 0, node->size( ), true } );
+            return;
+        }
+
+        auto first = lo_in ? 0 : node->lower_of( *lo );
+        auto last  = hi_in ? node->size( ) : node->lower_of( *hi );
+
+        if( node->is_leaf( ) ) {
+            if( first < last ) {
+                res.push_back( scan_piece { node, first, last, false } );
+            }
+            return;
+        }
+
+        /// children left of 'first' are below 'lo',
+        /// right of 'last' not below 'hi'
+        for( auto i = first; i <= last; ++i ) {
+            collect_pieces( node->next_[i], depth ? depth - 1 : 0, lo, hi,
+                            lo_in || i > first, hi_in || i < last, res );
+            if( i < last ) {
+                res.push_back( scan_piece { node, i, i + 1, false } );
+            }
+        }
+    }
+
+    template <typename Call>
+    static
+    void visit( const bnode *node, Call &call )
+    {
+        std::size_t i = 0;
+        if( node->is_leaf( ) ) {
+            for( ; i < node->size( ); ++i ) {
+                if( !node->dead( i ) ) {
+                    call( node->values_[i] );
+                }
+            }
+        } else {
+            for( ; i < node->size( ); ++i ) {
+                visit( node->next_[i], call );
+                call( node->values_[i] );
+            }
+            visit( node->next_[i], call );
+        }
+    }
+
+    template <typename Call>
+    static
+    void scan( const scan_piece &piece, Call &call )
+    {
+        if( piece.whole ) {
+            visit( piece.node, call );
+        } else {
+            for( auto i = piece.first; i < piece.last; ++i ) {
+                if( !piece.node->dead( i ) ) {
+                    call( piece.node->values_[i] );
+                }
+            }
+        }
+    }
+
+    template <typename Call>
+    void parallel_scan( const key_type *lo, const key_type *hi,
+                        Call &call, task_pool &pool ) const
+    {
+        auto pieces = scan_pieces( lo, hi, pool.size( ) * pieces_per_thread );
+        pool.run( pieces.size( ), [&]( std::size_t i ) {
+            scan( pieces[i], call );
+        } );
+    }
+
+    template <typename T, typename Reduce, typename Combine>
+    T parallel_fold( const key_type *lo, const key_type *hi, T init,
+                     Reduce &reduce, Combine &combine,
+                     task_pool &pool ) const
+    {
+        auto pieces = scan_pieces( lo, hi, pool.size( ) * pieces_per_thread );
+        std::vector<T> parts( pieces.size( ), init );
+
+        pool.run( pieces.size( ), [&]( std::size_t i ) {
+            fold_into<T, Reduce> fold { parts[i], reduce };
+            scan( pieces[i], fold );
+        } );
+
+        for( auto &part: parts ) {
+            init = combine( std::move(init), std::move(part) );
+        }
+        return init;
+    }
+
+    /// removes values of the leaf matching keys from 'b' on;
+    /// stops at 'limit' removed values or at a key not less than
+    /// the key at 'upper_pos' of 'upper'
+    /// 'pos' is the lower bound of *b in the leaf
+    template <typename ItrT>
+    static
+    std::size_t erase_run( bnode *leaf, std::size_t pos, ItrT &b, ItrT e,
+                           const bnode *upper, std::size_t upper_pos,
+                           std::size_t limit )
+    {
+        auto size = leaf->size( );
+        auto read  = pos;
+        auto write = pos;
+
+        while( b != e && read - write != limit &&
+               ( !upper || upper->key_greater( upper_pos, *b ) ) )
+        {
+            while( read != size && leaf->key_less( read, *b ) ) {
+                if( write != read ) {
+                    node_layout::put( leaf->values_, write,
+                                      leaf->values_.take( read ) );
+                }
+                ++read;
+                ++write;
+            }
+            if( read != size && leaf->key_equal( read, *b ) ) {
+                ++read;
+            }
+            ++b;
+        }
+
+        for( ; read != size; ++read, ++write ) {
+            if( write != read ) {
+                node_layout::put( leaf->values_, write,
+                                  leaf->values_.take( read ) );
+            }
+        }
+
+        leaf->values_.reduce( size - write );
+        return size - write;
+    }
+
+    /// marks the first live value equal to 'val' from 'pos' on dead;
+    /// the search stopped in a leaf, so all the equal values are here.
+    /// A leaf with 'purge_at' dead values loses them and is rebalanced
+    template <typename K>
+    void bury( path &steps, bnode *leaf, std::size_t pos, const K &val )
+    {
+        for( ; pos < leaf->size( ) && leaf->key_equal( pos, val ); ++pos )
+        {
+            if( leaf->dead( pos ) ) {
+                continue;
+            }
+            kill( leaf, pos );
+            if( leaf->dead_count( ) >= purge_at ) {
+                purge( leaf );
+                fix_up( steps, leaf );
+            } else {
+                refresh( leaf );
+                refresh_up( steps );
+            }
+            return;
+        }
+    }
+
+    void kill( bnode *leaf, std::size_t pos )
+    {
+        kill( leaf, pos, std::integral_constant<bool,
+                                                Deletion::tombstones>( ) );
+    }
+
+    void kill( bnode *, std::size_t, std::false_type )
+    { }
+
+    void kill( bnode *leaf, std::size_t pos, std::true_type )
+    {
+        leaf->kill( pos );
+    }
+
+    /// drops the dead values of a private leaf for good;
+    /// false if it had none. The caller rebalances
+    bool purge( bnode *leaf )
+    {
+        return purge( leaf, std::integral_constant<bool,
+                                                   Deletion::tombstones>( ) );
+    }
+
+    bool purge( bnode *, std::false_type )
+    {
+        return false;
+    }
+
+    bool purge( bnode *leaf, std::true_type )
+    {
+        if( leaf->dead_count( ) == 0 ) {
+            return false;
+        }
+        std::size_t write = 0;
+        auto size = leaf->size( );
+        for( std::size_t read = 0; read < size; ++read ) {
+            if( leaf->dead( read ) ) {
+                continue;
+            }
+            if( write != read ) {
+                node_layout::put( leaf->values_, write,
+                                  leaf->values_.take( read ) );
+            }
+            ++write;
+        }
+        leaf->values_.reduce( size - write );
+        leaf->revive_all( );
+        refresh( leaf );
+        return true;
+    }
+
+    /// a leaf that got values, and may have lost dead ones first
+    void settle_leaf( path &steps, bnode *leaf )
+    {
+        if( Deletion::tombstones && leaf->empty( ) ) {
+            fix_up( steps, leaf );
+        } else {
+            split_up( steps, leaf );
+        }
+    }
+
+    /// 'node' has just got a value; 'steps' leads to it
+    /// Every update ends here or in fix_up, which recount
+    /// the summaries of the nodes they touch and of the path up
+    void split_up( path &steps, bnode *node )
+    {
+        std::size_t levels = 0;
+        while( node->full( ) ) {
+
+            auto val  = node->values_.take( middle );
+            auto pair = bnode::split( node, pool_ );
+            refresh( pair.first );
+            refresh( pair.second );
+            stats_.on_split( );
+            ++levels;
+
+            if( steps.empty( ) ) {
+                auto new_root = pool_.create( );
+                new_root->values_.push_back( std::move(val) );
+                new_root->next_.push_back( pair.first );
+                new_root->next_.push_back( pair.second );
+                root_ = new_root;
+                node  = new_root;
+                stats_.on_root_split( );
+                break;
+            }
+
+            auto step = steps.pop( );
+            auto pos  = step.second;
+            node      = step.first;
+
+            node->values_.emplace( node->values_.begin( ) + pos,
+                                   std::move(val) );
+            node->next_.emplace( node->next_.begin( ) + pos + 1,
+                                 pair.second );
+        }
+        stats_.on_split_chain( levels );
+
+        refresh( node );
+        refresh_up( steps );
+    }
+
+    /// 'node' has just lost a value; 'steps' leads to it
+    /// returns the number of nodes merged away
+    std::size_t fix_up( path &steps, bnode *node )
+    {
+        std::size_t levels = 0;
+        while( !steps.empty( ) && node->empty( ) ) {
+
+            auto step   = steps.pop( );
+            auto parent = step.first;
+            auto pos    = step.second;
+
+            auto left  = pos > 0 ? parent->next_[pos - 1] : nullptr;
+            auto right = pos < parent->size( ) ? parent->next_[pos + 1]
+                                               : nullptr;
+
+            /// values move between leaves only without dead ones;
+            /// the right sibling is purged only if it is the one to use
+            if( left && left->dead_count( ) ) {
+                left = unshare( parent, pos - 1 );
+                purge( left );
+            }
+            if( right && right->dead_count( ) &&
+                ( !left || !left->has_donor( ) ) )
+            {
+                right = unshare( parent, pos + 1 );
+                purge( right );
+            }
+
+            /// a purged leaf may be short of more than one value;
+            /// what a donor can't give is made up by the merge
+            if( left && left->has_donor( ) ) {
+                left = unshare( parent, pos - 1 );
+                do {
+                    bnode::rotate_cw( parent, pos - 1 );
+                    stats_.on_borrow_left( );
+                } while( node->empty( ) && left->has_donor( ) );
+                refresh( left );
+                refresh( node );
+                if( !node->empty( ) ) {
+                    node = parent;
+                    break;
+                }
+            } else if( right && right->has_donor( ) ) {
+                right = unshare( parent, pos + 1 );
+                do {
+                    bnode::rotate_ccw( parent, pos );
+                    stats_.on_borrow_right( );
+                } while( node->empty( ) && right->has_donor( ) );
+                refresh( node );
+                refresh( right );
+                if( !node->empty( ) ) {
+                    node = parent;
+                    break;
+                }
+            }
+
+            unshare( parent, left ? pos - 1 : pos + 1 );
+            bnode::merge( parent, left ? pos - 1 : pos, pool_ );
+            refresh( parent->next_[left ? pos - 1 : pos] );
+            stats_.on_merge( );
+            ++levels;
+            node = parent;
+        }
+        stats_.on_merge_chain( levels );
+
+        /// 'node' is the lowest one left to recount
+        refresh( node );
+        refresh_up( steps );
+
+        if( root_->values_.empty( ) && !root_->is_leaf( ) ) {
+            auto tmp = root_->next_[0];
+            pool_.destroy( root_ );
+            root_ = tmp;
+            stats_.on_root_collapse( );
+            ++levels;
+        }
+        return levels;
+    }
+
+    /// a node a snapshot still uses stays
+    void drop( bnode *node )
+    {
+        if( !node->release( ) ) {
+            return;
+        }
+        if( !node->is_leaf( ) ) {
+            for( auto n: node->next_ ) {
+                drop( n );
+            }
+        }
+        pool_.destroy( node );
+    }
+
+    /// frees every node; the root is left dangling
+    /// nodes which don't need destructors just go away with the pool
+    void drop_all( )
+    {
+        if( node_pool::release_all
+            && std::is_trivially_destructible<bnode>::value )
+        {
+            pool_.clear( );
+        } else {
+            drop( root_ );
+        }
+        root_ = nullptr;
+    }
+
+    template <typename ItrT, typename NodeT>
+    static
+    ItrT first_of( NodeT *root )
+    {
+        ItrT res( root );
+        if( !root->values_.empty( ) ) {
+            res.node_ = root;
+            res.down_left( );
+            res.skip_dead( );
+        }
+        return res;
+    }
+
+    /// the deepest node where the bound falls inside the node
+    /// holds the smallest candidate
+    template <typename ItrT, bool Upper, typename NodeT, typename K>
+    ItrT bound_of( NodeT *root, const K &key ) const
+    {
+        ItrT res( root );
+        std::size_t depth = 0;
+        auto node = root;
+        stats_.on_lookup( );
+        while( true ) {
+            stats_.on_search( node->size( ) );
+            auto pos = Upper ? node->upper_of( key ) : node->lower_of( key );
+            if( pos < node->size( ) ) {
+                res.node_ = node;
+                res.pos_  = pos;
+                depth     = res.path_.size_;
+            }
+            if( node->is_leaf( ) ) {
+                break;
+            }
+            res.path_.push( pos );
+            node = node->next_[pos];
+        }
+        if( res.node_ ) {
+            res.path_.size_ = depth;
+            res.skip_dead( );
+        } else {
+            res.path_.size_ = 0;
+        }
+        return res;
+    }
+
+    template <typename ItrT, typename NodeT, typename K>
+    ItrT find_of( NodeT *root, const K &key ) const
+    {
+        auto res = bound_of<ItrT, false>( root, key );
+        if( res.node_ && res.node_->key_equal( res.pos_, key ) ) {
+            return res;
+        }
+        return ItrT( root );
+    }
+
+    /// number of values per node for the fill factor
+    /// stays inside [minimum, maximum - 1]; 'maximum' means overflow
+    static
+    std::size_t keys_for_fill( double fill_factor )
+    {
+        const std::size_t top = maximum - 1;
+
+        if( !(fill_factor > 0.0) ) {
+            return minimum;
+        } else if( fill_factor >= 1.0 ) {
+            return top;
+        }
+
+        const std::size_t bottom = minimum;
+
+        auto res = static_cast<std::size_t>( fill_factor * top + 0.5 );
+        return std::max( bottom, std::min( res, top ) );
+    }
+
+    /// number of nodes for 'slots' slots (values + 1 for leaves,
+    /// children for internal nodes).
+    /// Every node gets [minimum + 1, keys + 1] slots,
+    /// the last slot of a node goes up as a separator.
+    static
+    std::size_t nodes_for( std::size_t slots, std::size_t keys )
+    {
+        auto by_fill = ( slots + keys ) / ( keys + 1 );
+        auto by_min  = slots / ( minimum + 1 );
+        return std::max<std::size_t>( 1, std::min( by_fill, by_min ) );
+    }
+
+    template <typename ItrT>
+    void build( ItrT b, std::size_t count, std::size_t keys )
+    {
+        using node_ptr = bnode *;
+
+        std::vector<node_ptr>   level;
+        std::vector<value_type> separators;
+
+        /// leaves
+        auto nodes = nodes_for( count + 1, keys );
+        auto base  = ( count + 1 ) / nodes;
+        auto extra = ( count + 1 ) % nodes;
+
+        level.reserve( nodes );
+        separators.reserve( nodes );
+
+        for( std::size_t i = 0; i < nodes; ++i ) {
+            node_ptr leaf = pool_.create( );
+            auto take = base + ( i < extra ? 1 : 0 ) - 1;
+            while( take-- ) {
+                leaf->values_.push_back( *b );
+                ++b;
+            }
+            if( i + 1 < nodes ) {
+                separators.push_back( *b );
+                ++b;
+            }
+            refresh( leaf );
+            level.push_back( leaf );
+        }
+
+        /// internal levels
+        while( level.size( ) > 1 ) {
+
+            std::vector<node_ptr>   up;
+            std::vector<value_type> up_separators;
+
+            nodes = nodes_for( level.size( ), keys );
+            base  = level.size( ) / nodes;
+            extra = level.size( ) % nodes;
+
+            up.reserve( nodes );
+            up_separators.reserve( nodes );
+
+            std::size_t child = 0;
+            for( std::size_t i = 0; i < nodes; ++i ) {
+                node_ptr node = pool_.create( );
+                auto take = base + ( i < extra ? 1 : 0 );
+                for( std::size_t j = 0; j < take; ++j, ++child ) {
+                    if( j ) {
+                        node->values_.push_back(
+                                    std::move( separators[child - 1] ) );
+                    }
+                    node->next_.push_back( level[child] );
+                }
+                if( i + 1 < nodes ) {
+                    up_separators.push_back(
+                                std::move( separators[child - 1] ) );
+                }
+                refresh( node );
+                up.push_back( node );
+            }
+
+            level.swap( up );
+            separators.swap( up_separators );
+        }
+
+        root_ = level[0];
+    }
+
+    /// bytes given back to the system since the pool had 'balance'
+    /// nodes out; 'chunks' lets the pool release what it holds.
+    /// A node counts when its last owner lets go of it, so copies of
+    /// nodes a snapshot keeps can outweigh the merges
+    std::size_t released( std::ptrdiff_t balance, bool chunks = true )
+    {
+        auto nodes = balance - pool_.balance( );
+        return ( node_pool::release_all || nodes <= 0
+                    ? 0 : static_cast<std::size_t>( nodes ) * sizeof(bnode) )
+             + ( chunks ? pool_.release_empty( ) : 0 );
+    }
+
+    /// where compact_step goes on: the level of the parents it packs
+    /// (1 for the parents of the leaves) and the separator on the right
+    /// of the last one; no key for the first parent of the level
+    struct pack_cursor {
+        std::size_t                level = 1;
+        std::unique_ptr<key_type>  from;
+    };
+
+    /// packs the children of the next parent of the cursor's level
+    /// and moves the cursor on; returns the number of freed nodes
+    std::size_t pack_next( std::size_t &visited, bool &done )
+    {
+        auto height = height_of( root_ );
+        if( height < pack_.level ) {
+            pack_ = pack_cursor( );
+            done  = true;
+            return 0;
+        }
+
+        unshare_root( );
+        path steps;
+        auto node = root_;
+        for( auto h = height; h > pack_.level; --h ) {
+            auto pos = pack_.from ? node->upper_of( *pack_.from ) : 0;
+            steps.push( node, pos );
+            node = unshare( node, pos );
+        }
+
+        std::unique_ptr<key_type> next;
+        for( auto i = steps.size_; i > 0; --i ) {
+            auto &step = steps.steps_[i - 1];
+            if( step.second < step.first->size( ) ) {
+                next.reset( new key_type( step.first->key( step.second ) ) );
+                break;
+            }
+        }
+
+        bool top = steps.empty( );
+        visited += node->next_.size( ) + 1;
+        auto res = pack_children( node );
+        res += fix_up( steps, node );
+
+        if( next ) {
+            pack_.from = std::move(next);
+        } else if( top ) {
+            pack_ = pack_cursor( );
+            done  = true;
+        } else {
+            pack_.level += 1;
+            pack_.from.reset( );
+        }
+        return res;
+    }
+
+    /// fills the children of 'node' to 'maximum - 1' values from the
+    /// left; those left empty are merged away and the last one takes
+    /// what it is short of from its left neighbour
+    std::size_t pack_children( bnode *node )
+    {
+        static const std::size_t capacity = maximum - 1;
+
+        for( std::size_t i = 0; i < node->next_.size( ); ++i ) {
+            purge( unshare( node, i ) );
+        }
+
+        std::size_t res = 0;
+        std::size_t pos = 0;
+        while( pos + 1 < node->next_.size( ) ) {
+            auto l = node->next_[pos];
+            auto r = node->next_[pos + 1];
+            if( l->size( ) + r->size( ) < capacity ) {
+                bnode::merge( node, pos, pool_ );
+                stats_.on_merge( );
+                ++res;
+                continue;
+            }
+            if( l->size( ) < capacity ) {
+                shift_left( node, pos, capacity - l->size( ) );
+            }
+            refresh( l );
+            ++pos;
+        }
+
+        if( node->next_.size( ) > 1 ) {
+            auto l = node->next_[pos - 1];
+            auto r = node->next_[pos];
+            if( r->empty( ) ) {
+                shift_right( node, pos - 1, minimum - r->size( ) );
+            }
+            refresh( l );
+        }
+        refresh( node->next_[pos] );
+        refresh( node );
+        return res;
+    }
+
+    /// moves 'count' values from the child 'pos + 1' of 'node'
+    /// to the child 'pos' through their separator (rotate_ccw 'count'
+    /// times over)
+    static
+    void shift_left( bnode *node, std::size_t pos, std::size_t count )
+    {
+        auto l = node->next_[pos];
+        auto r = node->next_[pos + 1];
+
+        l->values_.push_back( node->values_.take( pos ) );
+        l->values_.append_range( r->values_, 0, count - 1 );
+        node_layout::put( node->values_, pos, r->values_.take( 0 ) );
+        r->values_.erase_pos( 0 );
+
+        if( !l->is_leaf( ) ) {
+            l->next_.append_range( r->next_, 0, count );
+        }
+    }
+
+    /// moves 'count' values from the child 'pos' of 'node'
+    /// to the child 'pos + 1' (rotate_cw 'count' times over)
+    static
+    void shift_right( bnode *node, std::size_t pos, std::size_t count )
+    {
+        auto l = node->next_[pos];
+        auto r = node->next_[pos + 1];
+
+        auto size = l->size( );
+        r->values_.push_front( node->values_.take( pos ) );
+        r->values_.splice( 0, l->values_, size - count + 1, size );
+        node_layout::put( node->values_, pos,
+                          l->values_.take( size - count ) );
+        l->values_.reduce( 1 );
+
+        if( !l->is_leaf( ) ) {
+            auto children = l->next_.size( );
+            r->next_.splice( 0, l->next_, children - count, children );
+        }
+    }
+
+    node_pool    pool_;
+    bnode       *root_ = nullptr;
+    Stats        stats_;
+    pack_cursor  pack_;
+};
+
+namespace btree_detail {
+
+    /// sizeof(btree::bnode) for every NodeMax with the same policies;
+    /// the refcount of shared nodes, summaries and tombstones count
+    template <typename ValueTrait, typename NodeAllocator, typename Stats,
+              typename Summary, typename Deletion>
+    struct real_node {
+        template <std::size_t NodeMax>
+        struct bytes {
+            static const std::size_t value =
+                    sizeof(typename btree<ValueTrait, NodeMax,
+                                          NodeAllocator, Stats,
+                                          Summary, Deletion>::bnode);
+        };
+    };
+}
+
+/// btree whose NodeMax is derived from the node size,
+/// so that one node fills 'TargetBytes' (4 cache lines by default);
+/// see sizing::btree_geometry for the chosen shape
+template <typename ValueTrait,
+          std::size_t TargetBytes = sizing::cache_line * 4,
+          typename NodeAllocator = slab_allocator< >,
+          typename Stats = stats::disabled,
+          typename Summary = summary::none,
+          typename Deletion = deletion::eager >
+using sized_btree = btree<ValueTrait,
+                          sizing::btree_geometry<ValueTrait, TargetBytes,
+                              btree_detail::real_node<ValueTrait,
+                                                      NodeAllocator, Stats,
+                                                      Summary, Deletion>
+                          >::node_max,
+                          NodeAllocator, Stats, Summary, Deletion>;
+
+}
+
+#endif // BTREE_H
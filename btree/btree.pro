@@ -1,11 +1,32 @@
 TEMPLATE = app
-CONFIG += console c++11
+CONFIG += console c++11 thread
 CONFIG -= app_bundle
 CONFIG -= qt
 
 SOURCES += main.cpp
 
 INCLUDEPATH += /home/data/github/etool/include
+INCLUDEPATH += ../filealloc
 
 HEADERS += \
-    dyn_array.h
+    dyn_array.h \
+    soa_array.h \
+    prefix_array.h \
+    node_layout.h \
+    node_sizing.h \
+    node_allocator.h \
+    node_search.h \
+    btree_traits.h \
+    btree_stats.h \
+    btree_summary.h \
+    btree_deletion.h \
+    task_pool.h \
+    btree.h \
+    bplus_tree.h \
+    buffered_btree.h \
+    frozen_btree.h \
+    epoch_manager.h \
+    concurrent_btree.h \
+    disk_btree.h \
+    bench_util.h \
+    ../filealloc/data_source.h
@@ -0,0 +1,660 @@
+#include <iostream>
+#include <cstdint>
+#include <cstdlib>
+#include <set>
+#include <map>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <thread>
+
+#include "btree.h"
+#include "buffered_btree.h"
+#include "frozen_btree.h"
+#include "bench_util.h"
+
+using namespace etool;
+
+/// Throughput and latency of btree against std::set and std::map
+/// usage: btree_bench [count]
+/// Prints CSV, see bench::report.
+
+namespace {
+
+    using key_type = std::uint64_t;
+
+    /// one value per key; the same calls for every container
+
+    template <std::size_t NodeMax>
+    struct btree_set {
+
+        static const char *name( ) { return "btree_set"; }
+        static const std::size_t node_max = NodeMax;
+
+        void insert( key_type k )
+        {
+            tree_.insert( k );
+        }
+
+        void erase( key_type k )
+        {
+            tree_.erase( k );
+        }
+
+        void insert_batch( const std::vector<key_type> &keys )
+        {
+            tree_.insert_batch( keys.begin( ), keys.end( ) );
+        }
+
+        void erase_batch( const std::vector<key_type> &keys )
+        {
+            tree_.erase_batch( keys.begin( ), keys.end( ) );
+        }
+
+        bool find( key_type k ) const
+        {
+            return tree_.find( k ) != tree_.end( );
+        }
+
+        key_type scan( key_type k, std::size_t count ) const
+        {
+            key_type sum = 0;
+            auto b = tree_.lower_bound( k );
+            for( ; count && b != tree_.end( ); --count, ++b ) {
+                sum += *b;
+            }
+            return sum;
+        }
+
+        btree<value_trait<key_type>, NodeMax> tree_;
+    };
+
+    template <std::size_t NodeMax>
+    struct btree_map {
+
+        static const char *name( ) { return "btree_map"; }
+        static const std::size_t node_max = NodeMax;
+
+        using value_type = std::pair<key_type, key_type>;
+
+        void insert( key_type k )
+        {
+            tree_.insert( std::make_pair( k, k ) );
+        }
+
+        void erase( key_type k )
+        {
+            tree_.erase( k );
+        }
+
+        void insert_batch( const std::vector<key_type> &keys )
+        {
+            std::vector<value_type> vals;
+            vals.reserve( keys.size( ) );
+            for( auto k: keys ) {
+                vals.push_back( std::make_pair( k, k ) );
+            }
+            tree_.insert_batch( vals.begin( ), vals.end( ) );
+        }
+
+        void erase_batch( const std::vector<key_type> &keys )
+        {
+            tree_.erase_batch( keys.begin( ), keys.end( ) );
+        }
+
+        bool find( key_type k ) const
+        {
+            return tree_.find( k ) != tree_.end( );
+        }
+
+        key_type scan( key_type k, std::size_t count ) const
+        {
+            key_type sum = 0;
+            auto b = tree_.lower_bound( k );
+            for( ; count && b != tree_.end( ); --count, ++b ) {
+                sum += b->second;
+            }
+            return sum;
+        }
+
+        btree<map_trait<key_type, key_type>, NodeMax> tree_;
+    };
+
+    /// NodeMax derived from a node footprint, see sized_btree
+    template <std::size_t TargetBytes>
+    struct sized_set: btree_set<sizing::btree_geometry<
+                                    value_trait<key_type>,
+                                    TargetBytes>::node_max> {
+
+        static const char *name( ) { return "sized_btree_set"; }
+    };
+
+    template <std::size_t TargetBytes>
+    struct sized_map: btree_map<sizing::btree_geometry<
+                                    map_trait<key_type, key_type>,
+                                    TargetBytes>::node_max> {
+
+        static const char *name( ) { return "sized_btree_map"; }
+    };
+
+    struct std_set {
+
+        static const char *name( ) { return "std_set"; }
+        static const std::size_t node_max = 0;
+
+        void insert( key_type k )
+        {
+            tree_.insert( k );
+        }
+
+        void erase( key_type k )
+        {
+            auto f = tree_.find( k );
+            if( f != tree_.end( ) ) {
+                tree_.erase( f );
+            }
+        }
+
+        void insert_batch( const std::vector<key_type> &keys )
+        {
+            for( auto k: keys ) {
+                insert( k );
+            }
+        }
+
+        void erase_batch( const std::vector<key_type> &keys )
+        {
+            for( auto k: keys ) {
+                erase( k );
+            }
+        }
+
+        bool find( key_type k ) const
+        {
+            return tree_.find( k ) != tree_.end( );
+        }
+
+        key_type scan( key_type k, std::size_t count ) const
+        {
+            key_type sum = 0;
+            auto b = tree_.lower_bound( k );
+            for( ; count && b != tree_.end( ); --count, ++b ) {
+                sum += *b;
+            }
+            return sum;
+        }
+
+        std::multiset<key_type> tree_;
+    };
+
+    struct std_map {
+
+        static const char *name( ) { return "std_map"; }
+        static const std::size_t node_max = 0;
+
+        void insert( key_type k )
+        {
+            tree_.insert( std::make_pair( k, k ) );
+        }
+
+        void erase( key_type k )
+        {
+            auto f = tree_.find( k );
+            if( f != tree_.end( ) ) {
+                tree_.erase( f );
+            }
+        }
+
+        void insert_batch( const std::vector<key_type> &keys )
+        {
+            for( auto k: keys ) {
+                insert( k );
+            }
+        }
+
+        void erase_batch( const std::vector<key_type> &keys )
+        {
+            for( auto k: keys ) {
+                erase( k );
+            }
+        }
+
+        bool find( key_type k ) const
+        {
+            return tree_.find( k ) != tree_.end( );
+        }
+
+        key_type scan( key_type k, std::size_t count ) const
+        {
+            key_type sum = 0;
+            auto b = tree_.lower_bound( k );
+            for( ; count && b != tree_.end( ); --count, ++b ) {
+                sum += b->second;
+            }
+            return sum;
+        }
+
+        std::multimap<key_type, key_type> tree_;
+    };
+
+    static const std::size_t scan_length = 100;
+
+    /// keys to insert, look up (and scan from) and erase
+    struct workload {
+        std::string                name;
+        std::vector<std::uint64_t> inserts;
+        std::vector<std::uint64_t> lookups;
+        std::vector<std::uint64_t> erases;
+    };
+
+    std::vector<workload> workloads( std::size_t count )
+    {
+        std::vector<workload> res;
+
+        res.push_back( workload { "sequential",
+                                  bench::sequence( count ),
+                                  bench::sequence( count ),
+                                  bench::sequence( count ) } );
+
+        res.push_back( workload { "random",
+                                  bench::permutation( count, 1 ),
+                                  bench::uniform( count, count, 2 ),
+                                  bench::permutation( count, 3 ) } );
+
+        res.push_back( workload { "zipfian",
+                                  bench::permutation( count, 4 ),
+                                  bench::zipf( count, count, 5 ),
+                                  bench::permutation( count, 6 ) } );
+        return res;
+    }
+
+    template <typename Cont>
+    void run_lookups( Cont &cont, const workload &wl,
+                      const std::vector<std::uint64_t> &keys )
+    {
+        auto find = bench::timed( keys.size( ), [&]( std::size_t i ) {
+            bench::keep( cont.find( keys[i] ) );
+        } );
+        bench::report::row( "btree", Cont::name( ), Cont::node_max,
+                            wl.name, "find", find );
+
+        auto scans = keys.size( ) / scan_length;
+        auto scan = bench::timed( scans, [&]( std::size_t i ) {
+            bench::keep( cont.scan( keys[i], scan_length ) );
+        } );
+        bench::report::row( "btree", Cont::name( ), Cont::node_max,
+                            wl.name, "scan100", scan );
+    }
+
+    /// sorted batches of random keys, as an ingest delivers them
+    template <typename Cont>
+    void run_batches( std::size_t count )
+    {
+        static const std::size_t batch_size = 10000;
+
+        auto batches = [count]( std::uint64_t seed ) {
+            auto keys = bench::permutation( count, seed );
+            std::vector<std::vector<key_type> > res;
+            for( std::size_t b = 0; b < count; b += batch_size ) {
+                auto e = std::min( count, b + batch_size );
+                res.emplace_back( keys.begin( ) + b, keys.begin( ) + e );
+                std::sort( res.back( ).begin( ), res.back( ).end( ) );
+            }
+            return res;
+        };
+
+        Cont cont;
+        auto ins_keys = batches( 8 );
+        auto ers_keys = batches( 9 );
+
+        auto ins = bench::timed( ins_keys.size( ), [&]( std::size_t i ) {
+            cont.insert_batch( ins_keys[i] );
+        } );
+        ins.ops = count;
+        bench::report::row( "btree", Cont::name( ), Cont::node_max,
+                            "batch", "insert_batch", ins );
+
+        auto ers = bench::timed( ers_keys.size( ), [&]( std::size_t i ) {
+            cont.erase_batch( ers_keys[i] );
+        } );
+        ers.ops = count;
+        bench::report::row( "btree", Cont::name( ), Cont::node_max,
+                            "batch", "erase_batch", ers );
+    }
+
+    template <typename Cont>
+    void run( std::size_t count )
+    {
+        for( auto &wl: workloads( count ) ) {
+            Cont cont;
+
+            auto ins = bench::timed( wl.inserts.size( ), [&]( std::size_t i ) {
+                cont.insert( wl.inserts[i] );
+            } );
+            bench::report::row( "btree", Cont::name( ), Cont::node_max,
+                                wl.name, "insert", ins );
+
+            run_lookups( cont, wl, wl.lookups );
+
+            auto ers = bench::timed( wl.erases.size( ), [&]( std::size_t i ) {
+                cont.erase( wl.erases[i] );
+            } );
+            bench::report::row( "btree", Cont::name( ), Cont::node_max,
+                                wl.name, "erase", ers );
+        }
+
+        /// a window of the newest keys: every step adds one and
+        /// drops the oldest
+        Cont cont;
+        auto window = count / 10 + 1;
+        workload wl { "sliding", { }, { }, { } };
+
+        auto slide = bench::timed( count, [&]( std::size_t i ) {
+            cont.insert( i );
+            if( i >= window ) {
+                cont.erase( i - window );
+            }
+        } );
+        bench::report::row( "btree", Cont::name( ), Cont::node_max,
+                            wl.name, "insert_erase", slide );
+
+        auto recent = bench::uniform( count, window, 7 );
+        for( auto &r: recent ) {
+            r += count - window;
+        }
+        run_lookups( cont, wl, recent );
+
+        run_batches<Cont>( count );
+    }
+
+    template <template <std::size_t> class Cont>
+    void run_sizes( std::size_t count )
+    {
+        run<Cont<8> >( count );
+        run<Cont<16> >( count );
+        run<Cont<32> >( count );
+        run<Cont<64> >( count );
+        run<Cont<128> >( count );
+    }
+
+
+    /// nodes of 4 cache lines up to a page
+    template <template <std::size_t> class Cont>
+    void run_targets( std::size_t count )
+    {
+        run<Cont<sizing::cache_line * 4> >( count );
+        run<Cont<sizing::cache_line * 8> >( count );
+        run<Cont<sizing::cache_line * 16> >( count );
+        run<Cont<sizing::page> >( count );
+    }
+
+    /// full scans summing every value, on 1, 2, 4 ... threads
+    /// up to the hardware threads; the workload names the thread count
+    void run_scans( std::size_t count )
+    {
+        static const std::size_t rounds = 20;
+
+        btree<value_trait<key_type>, 64> tree;
+        auto keys = bench::permutation( count, 10 );
+        tree.assign( keys.begin( ), keys.end( ) );
+
+        std::size_t hw = std::max( 1u, std::thread::hardware_concurrency( ) );
+        std::vector<std::size_t> counts;
+        for( std::size_t t = 1; t < hw; t *= 2 ) {
+            counts.push_back( t );
+        }
+        counts.push_back( hw );
+
+        for( auto threads: counts ) {
+            task_pool pool( threads - 1 );
+            auto res = bench::timed( rounds, [&]( std::size_t ) {
+                bench::keep( tree.parallel_reduce( key_type( 0 ),
+                    []( key_type acc, key_type v ) { return acc + v; },
+                    []( key_type l, key_type r ) { return l + r; },
+                    pool ) );
+            } );
+            res.ops = rounds * count;
+            bench::report::row( "btree", "btree_set", 64,
+                                "threads_" + std::to_string( threads ),
+                                "parallel_scan", res );
+        }
+    }
+
+    /// merging a delta of 'count' / 10 keys into a tree of 'count',
+    /// value by value into a copy and streamed into a new tree;
+    /// ops counts the values of the result
+    void run_set_ops( std::size_t count )
+    {
+        using tree_type = btree<value_trait<key_type>, 64>;
+
+        auto keys  = bench::permutation( count, 13 );
+        auto delta = bench::permutation( count / 10, 14 );
+        for( auto &d: delta ) {
+            d = d * 10 + 5;
+        }
+        tree_type main_tree( keys.begin( ), keys.end( ) );
+        tree_type delta_tree( delta.begin( ), delta.end( ) );
+
+        tree_type copy( keys.begin( ), keys.end( ) );
+        auto inserts = bench::timed( 1, [&]( std::size_t ) {
+            for( auto d: delta ) {
+                copy.insert( d );
+            }
+        } );
+        inserts.ops = count + delta.size( );
+        bench::report::row( "btree", "btree_set", 64,
+                            "delta", "merge_by_insert", inserts );
+
+        auto streamed = bench::timed( 1, [&]( std::size_t ) {
+            bench::keep( tree_type::merge( main_tree, delta_tree ).empty( ) );
+        } );
+        streamed.ops = count + delta.size( );
+        bench::report::row( "btree", "btree_set", 64,
+                            "delta", "merge", streamed );
+
+        auto common = bench::timed( 1, [&]( std::size_t ) {
+            bench::keep( tree_type::set_intersection( main_tree,
+                                                      delta_tree ).empty( ) );
+        } );
+        common.ops = count + delta.size( );
+        bench::report::row( "btree", "btree_set", 64,
+                            "delta", "intersection", common );
+    }
+
+    /// rank, select and range sums on a tree with summaries,
+    /// the pagination and percentile queries
+    void run_ranks( std::size_t count )
+    {
+        using tree_type = btree<value_trait<key_type>, 64,
+                                slab_allocator< >, stats::disabled,
+                                summary::counted<summary::sum<key_type> > >;
+
+        auto keys  = bench::permutation( count, 15 );
+        auto probe = bench::permutation( count, 16 );
+
+        tree_type tree;
+        auto ins = bench::timed( count, [&]( std::size_t i ) {
+            tree.insert( keys[i] );
+        } );
+        bench::report::row( "btree", "counted_set", 64,
+                            "random", "insert", ins );
+
+        auto rank = bench::timed( count, [&]( std::size_t i ) {
+            bench::keep( tree.rank( probe[i] ) );
+        } );
+        bench::report::row( "btree", "counted_set", 64,
+                            "random", "rank", rank );
+
+        auto select = bench::timed( count, [&]( std::size_t i ) {
+            bench::keep( *tree.select( probe[i] ) );
+        } );
+        bench::report::row( "btree", "counted_set", 64,
+                            "random", "select", select );
+
+        auto sums = bench::timed( count, [&]( std::size_t i ) {
+            bench::keep( tree.aggregate( probe[i] / 2, probe[i] ) );
+        } );
+        bench::report::row( "btree", "counted_set", 64,
+                            "random", "range_sum", sums );
+    }
+
+    /// a burst of random erases with eager and lazy deletion,
+    /// then the compact that pays for the lazy ones
+    void run_lazy_erase( std::size_t count )
+    {
+        using eager_type = btree<value_trait<key_type>, 64>;
+        using lazy_type  = btree<value_trait<key_type>, 64,
+                                 slab_allocator< >, stats::disabled,
+                                 summary::none, deletion::lazy< > >;
+
+        auto keys = bench::permutation( count, 17 );
+        auto ers  = bench::permutation( count / 2, 18 );
+
+        eager_type eager( keys.begin( ), keys.end( ) );
+        auto e = bench::timed( ers.size( ), [&]( std::size_t i ) {
+            eager.erase( ers[i] );
+        } );
+        bench::report::row( "btree", "btree_set", 64,
+                            "random", "erase", e );
+
+        lazy_type lazy( keys.begin( ), keys.end( ) );
+        auto l = bench::timed( ers.size( ), [&]( std::size_t i ) {
+            lazy.erase( ers[i] );
+        } );
+        bench::report::row( "btree", "lazy_set", 64,
+                            "random", "erase", l );
+
+        auto c = bench::timed( 1, [&]( std::size_t ) {
+            lazy.compact( );
+        } );
+        c.ops = count - ers.size( );
+        bench::report::row( "btree", "lazy_set", 64,
+                            "random", "compact", c );
+    }
+
+    /// a tree left half full by random erases, packed again
+    /// in steps of 64 nodes; ops counts the values
+    void run_compaction( std::size_t count )
+    {
+        using tree_type = btree<value_trait<key_type>, 64>;
+
+        auto keys = bench::permutation( count, 19 );
+        auto ers  = bench::permutation( count, 20 );
+
+        tree_type tree;
+        for( auto k: keys ) {
+            tree.insert( k );
+        }
+        for( std::size_t i = 0; i < ers.size( ); i += 2 ) {
+            tree.erase( ers[i] );
+        }
+
+        std::size_t freed = 0;
+        auto steps = bench::timed( 1, [&]( std::size_t ) {
+            bool done = false;
+            while( !done ) {
+                auto res = tree.compact_step( 64 );
+                freed += res.bytes_freed;
+                done   = res.done;
+            }
+        } );
+        steps.ops = count - ers.size( ) / 2;
+        bench::keep( freed );
+        bench::report::row( "btree", "btree_set", 64,
+                            "churned", "compact_step", steps );
+    }
+
+    /// random lookups in a tree and in its frozen image,
+    /// one by one and in batches
+    void run_frozen( std::size_t count )
+    {
+        using tree_type = btree<value_trait<key_type>, 64>;
+
+        auto keys  = bench::permutation( count, 21 );
+        auto probe = bench::uniform( count, count, 22 );
+
+        tree_type tree( keys.begin( ), keys.end( ) );
+        auto image = freeze( tree );
+
+        auto find = bench::timed( count, [&]( std::size_t i ) {
+            bench::keep( tree.find( probe[i] ) != tree.end( ) );
+        } );
+        bench::report::row( "btree", "btree_set", 64,
+                            "uniform", "find", find );
+
+        auto frozen = bench::timed( count, [&]( std::size_t i ) {
+            bench::keep( image.find( probe[i] ) != image.end( ) );
+        } );
+        bench::report::row( "btree", "frozen_set", image.block,
+                            "uniform", "find", frozen );
+
+        static const std::size_t batch = 64;
+        std::vector<decltype( image.end( ) )> found( batch );
+        auto batched = bench::timed( count / batch, [&]( std::size_t i ) {
+            image.lower_bound_batch( probe.begin( ) + i * batch,
+                                     probe.begin( ) + ( i + 1 ) * batch,
+                                     found.begin( ) );
+            bench::keep( found.back( ).index( ) );
+        } );
+        batched.ops = count / batch * batch;
+        bench::report::row( "btree", "frozen_set", image.block,
+                            "uniform", "lower_bound_batch", batched );
+    }
+
+    /// random updates into btree and buffered_btree of the same fanout;
+    /// buffered_btree applies them to the leaves in batches
+    void run_buffered( std::size_t count )
+    {
+        auto keys  = bench::permutation( count, 11 );
+        auto finds = bench::permutation( count, 12 );
+
+        btree<value_trait<key_type>, 64> tree;
+        auto ins = bench::timed( count, [&]( std::size_t i ) {
+            tree.insert( keys[i] );
+        } );
+        bench::report::row( "btree", "btree_set", 64,
+                            "random", "insert", ins );
+
+        buffered_btree<value_trait<key_type>, 64> buffered;
+        auto upsert = bench::timed( count, [&]( std::size_t i ) {
+            buffered.insert( keys[i] );
+        } );
+        bench::report::row( "btree", "buffered_btree", 64,
+                            "random", "insert", upsert );
+
+        auto find = bench::timed( count, [&]( std::size_t i ) {
+            bench::keep( buffered.find( finds[i] ) != nullptr );
+        } );
+        bench::report::row( "btree", "buffered_btree", 64,
+                            "random", "find", find );
+    }
+
+}
+
+int main( int argc, char *argv[] )
+{
+    std::size_t count = 200000;
+    if( argc > 1 ) {
+        count = std::strtoull( argv[1], nullptr, 10 );
+    }
+
+    bench::report::header( );
+
+    run<std_set>( count );
+    run_sizes<btree_set>( count );
+    run_targets<sized_set>( count );
+
+    run<std_map>( count );
+    run_sizes<btree_map>( count );
+    run_targets<sized_map>( count );
+
+    run_scans( count );
+    run_buffered( count );
+    run_set_ops( count );
+    run_ranks( count );
+    run_lazy_erase( count );
+    run_compaction( count );
+    run_frozen( count );
+
+    return 0;
+}
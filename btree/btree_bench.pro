@@ -0,0 +1,26 @@
+TEMPLATE = app
+CONFIG += console c++11 thread
+CONFIG -= app_bundle
+CONFIG -= qt
+
+SOURCES += btree_bench.cpp
+
+INCLUDEPATH += /home/data/github/etool/include
+
+HEADERS += \
+    dyn_array.h \
+    soa_array.h \
+    prefix_array.h \
+    node_layout.h \
+    node_sizing.h \
+    node_allocator.h \
+    node_search.h \
+    btree_traits.h \
+    btree_stats.h \
+    btree_summary.h \
+    btree_deletion.h \
+    task_pool.h \
+    btree.h \
+    buffered_btree.h \
+    frozen_btree.h \
+    bench_util.h
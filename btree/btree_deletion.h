@@ -0,0 +1,32 @@
+#ifndef BTREE_DELETION_H
+#define BTREE_DELETION_H
+
+#include <cstddef>
+
+namespace etool { namespace deletion {
+
+    /// How a btree erases, chosen by its 'Deletion' parameter.
+
+    /// the value goes at once; the leaf is rebalanced on the spot
+    struct eager {
+        static const bool        tombstones = false;
+        static const std::size_t percent    = 100;
+    };
+
+    /// Erase marks a value of a leaf dead (a tombstone) and touches
+    /// nothing else; lookups, iteration and summaries skip the dead.
+    /// A leaf loses its dead values for good, and is rebalanced once,
+    /// when they reach 'Percent' of its capacity, when it is written
+    /// to, or on btree::compact. Separator values (about one in
+    /// NodeMax) are erased at once, as with 'eager'.
+    template <std::size_t Percent = 25>
+    struct lazy {
+        static_assert( Percent > 0 && Percent <= 100,
+                       "Percent must be in (0, 100]" );
+        static const bool        tombstones = true;
+        static const std::size_t percent    = Percent;
+    };
+
+}}
+
+#endif // BTREE_DELETION_H
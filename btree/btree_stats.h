@@ -0,0 +1,249 @@
+#ifndef BTREE_STATS_H
+#define BTREE_STATS_H
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+
+namespace etool { namespace stats {
+
+    /// Operation counters of a btree, chosen by its 'Stats' parameter.
+    /// The tree calls the hooks of the policy where things happen;
+    /// 'read' fills the counters in. See btree::statistics.
+
+    struct operations {
+
+        std::uint64_t splits              = 0;
+        std::uint64_t root_splits         = 0;
+        std::uint64_t merges              = 0;
+        std::uint64_t root_collapses      = 0;
+        std::uint64_t borrows_left        = 0; ///< rotate_cw
+        std::uint64_t borrows_right       = 0; ///< rotate_ccw
+
+        /// updates whose splits (merges) went up more than one level
+        std::uint64_t split_cascades      = 0;
+        std::uint64_t merge_cascades      = 0;
+        std::uint64_t longest_split_chain = 0;
+        std::uint64_t longest_merge_chain = 0;
+
+        /// nodes copied away from snapshots
+        std::uint64_t node_copies         = 0;
+
+        /// find, lower_bound and upper_bound
+        std::uint64_t lookups             = 0;
+        std::uint64_t lookup_nodes        = 0;
+
+        /// comparisons a binary search needs in the visited nodes;
+        /// the real number depends on the search policy
+        std::uint64_t lookup_comparisons  = 0;
+
+        double nodes_per_lookup( ) const
+        {
+            return lookups ? double(lookup_nodes) / lookups : 0.0;
+        }
+
+        double comparisons_per_lookup( ) const
+        {
+            return lookups ? double(lookup_comparisons) / lookups : 0.0;
+        }
+    };
+
+    /// shape of the tree at the time it is read
+    struct structure {
+
+        /// fill[i] counts the nodes filled to [i/10, (i+1)/10)
+        /// of their capacity; full ones count in the last bucket
+        static const std::size_t fill_buckets = 10;
+
+        std::size_t height      = 0;
+        std::size_t nodes       = 0;
+        std::size_t leaves      = 0;
+        std::size_t values      = 0;
+        std::size_t capacity    = 0; ///< values the nodes hold when full
+        std::size_t node_bytes  = 0; ///< nodes only, no heap of the values
+        std::size_t fill[fill_buckets] = { };
+
+        double fill_factor( ) const
+        {
+            return capacity ? double(values) / capacity : 0.0;
+        }
+    };
+
+    struct report {
+        bool        counting = false; ///< 'ops' is all zero otherwise
+        operations  ops;
+        structure   shape;
+    };
+
+    /// no counters; every hook is empty and compiles away
+    struct disabled {
+
+        static const bool enabled = false;
+
+        void on_split( ) { }
+        void on_root_split( ) { }
+        void on_merge( ) { }
+        void on_root_collapse( ) { }
+        void on_borrow_left( ) { }
+        void on_borrow_right( ) { }
+        void on_split_chain( std::size_t ) { }
+        void on_merge_chain( std::size_t ) { }
+        void on_copy( ) { }
+        void on_lookup( ) const { }
+        void on_search( std::size_t ) const { }
+
+        void read( operations & ) const { }
+        void reset( ) { }
+    };
+
+    /// Counters with relaxed atomics. Updates come from the one writer;
+    /// lookups may come from concurrent readers, which only add.
+    struct counting {
+
+        static const bool enabled = true;
+
+        counting( ) = default;
+
+        counting( const counting &other )
+        {
+            copy( other );
+        }
+
+        counting &operator = ( const counting &other )
+        {
+            if( this != &other ) {
+                copy( other );
+            }
+            return *this;
+        }
+
+        void on_split( )            { add( splits_ ); }
+        void on_root_split( )       { add( root_splits_ ); }
+        void on_merge( )            { add( merges_ ); }
+        void on_root_collapse( )    { add( root_collapses_ ); }
+        void on_borrow_left( )      { add( borrows_left_ ); }
+        void on_borrow_right( )     { add( borrows_right_ ); }
+        void on_copy( )             { add( node_copies_ ); }
+
+        void on_split_chain( std::size_t levels )
+        {
+            chain( levels, split_cascades_, longest_split_ );
+        }
+
+        void on_merge_chain( std::size_t levels )
+        {
+            chain( levels, merge_cascades_, longest_merge_ );
+        }
+
+        void on_lookup( ) const
+        {
+            add( lookups_ );
+        }
+
+        /// a node of 'length' values searched by a lookup
+        void on_search( std::size_t length ) const
+        {
+            std::uint64_t steps = 1;
+            while( length >>= 1 ) {
+                ++steps;
+            }
+            add( lookup_nodes_ );
+            lookup_comparisons_.fetch_add( steps, std::memory_order_relaxed );
+        }
+
+        void read( operations &res ) const
+        {
+            res.splits              = get( splits_ );
+            res.root_splits         = get( root_splits_ );
+            res.merges              = get( merges_ );
+            res.root_collapses      = get( root_collapses_ );
+            res.borrows_left        = get( borrows_left_ );
+            res.borrows_right       = get( borrows_right_ );
+            res.split_cascades      = get( split_cascades_ );
+            res.merge_cascades      = get( merge_cascades_ );
+            res.longest_split_chain = get( longest_split_ );
+            res.longest_merge_chain = get( longest_merge_ );
+            res.node_copies         = get( node_copies_ );
+            res.lookups             = get( lookups_ );
+            res.lookup_nodes        = get( lookup_nodes_ );
+            res.lookup_comparisons  = get( lookup_comparisons_ );
+        }
+
+        void reset( )
+        {
+            copy( counting( ) );
+        }
+
+    private:
+
+        void copy( const counting &other )
+        {
+            operations ops;
+            other.read( ops );
+            set( splits_,             ops.splits );
+            set( root_splits_,        ops.root_splits );
+            set( merges_,             ops.merges );
+            set( root_collapses_,     ops.root_collapses );
+            set( borrows_left_,       ops.borrows_left );
+            set( borrows_right_,      ops.borrows_right );
+            set( split_cascades_,     ops.split_cascades );
+            set( merge_cascades_,     ops.merge_cascades );
+            set( longest_split_,      ops.longest_split_chain );
+            set( longest_merge_,      ops.longest_merge_chain );
+            set( node_copies_,        ops.node_copies );
+            set( lookups_,            ops.lookups );
+            set( lookup_nodes_,       ops.lookup_nodes );
+            set( lookup_comparisons_, ops.lookup_comparisons );
+        }
+
+        using counter = std::atomic<std::uint64_t>;
+
+        static
+        void add( counter &c )
+        {
+            c.fetch_add( 1, std::memory_order_relaxed );
+        }
+
+        static
+        void set( counter &c, std::uint64_t val )
+        {
+            c.store( val, std::memory_order_relaxed );
+        }
+
+        static
+        std::uint64_t get( const counter &c )
+        {
+            return c.load( std::memory_order_relaxed );
+        }
+
+        /// only the writer gets here
+        static
+        void chain( std::size_t levels, counter &cascades, counter &longest )
+        {
+            if( levels > 1 ) {
+                add( cascades );
+            }
+            if( levels > get( longest ) ) {
+                set( longest, levels );
+            }
+        }
+
+        counter         splits_             { 0 };
+        counter         root_splits_        { 0 };
+        counter         merges_             { 0 };
+        counter         root_collapses_     { 0 };
+        counter         borrows_left_       { 0 };
+        counter         borrows_right_      { 0 };
+        counter         split_cascades_     { 0 };
+        counter         merge_cascades_     { 0 };
+        counter         longest_split_      { 0 };
+        counter         longest_merge_      { 0 };
+        counter         node_copies_        { 0 };
+        mutable counter lookups_            { 0 };
+        mutable counter lookup_nodes_       { 0 };
+        mutable counter lookup_comparisons_ { 0 };
+    };
+
+}}
+
+#endif // BTREE_STATS_H
@@ -0,0 +1,159 @@
+#ifndef BTREE_SUMMARY_H
+#define BTREE_SUMMARY_H
+
+#include <cstddef>
+#include <limits>
+#include <algorithm>
+
+namespace etool { namespace summary {
+
+    /// Subtree summaries of a btree, chosen by its 'Summary' parameter.
+    /// Every node keeps the number of values below it and the fold of
+    /// a monoid over them; the tree keeps them up to date on every
+    /// insert, erase, split, merge and rotation. They give size( ) in
+    /// O(1), rank, select and range counts and folds in O(log n).
+    ///
+    /// A monoid names its 'type' and provides
+    ///     static type identity( );
+    ///     static type of( const value_type & );
+    ///     static type combine( const type &, const type & );
+    /// 'combine' must be associative; it is called in key order.
+
+    /// the value itself
+    struct value_of {
+        template <typename V>
+        static
+        const V &get( const V &val )
+        {
+            return val;
+        }
+    };
+
+    /// the mapped value of a map_trait value
+    struct second_of {
+        template <typename V>
+        static
+        auto get( const V &val ) -> decltype(val.second)
+        {
+            return val.second;
+        }
+    };
+
+    /// counts only
+    struct no_monoid {
+
+        struct type { };
+
+        static
+        type identity( )
+        {
+            return type( );
+        }
+
+        template <typename V>
+        static
+        type of( const V & )
+        {
+            return type( );
+        }
+
+        static
+        type combine( const type &, const type & )
+        {
+            return type( );
+        }
+    };
+
+    template <typename T, typename Get = value_of>
+    struct sum {
+
+        using type = T;
+
+        static
+        type identity( )
+        {
+            return T( );
+        }
+
+        template <typename V>
+        static
+        type of( const V &val )
+        {
+            return static_cast<T>( Get::get( val ) );
+        }
+
+        static
+        type combine( const type &l, const type &r )
+        {
+            return l + r;
+        }
+    };
+
+    /// the identity is the greatest T; an empty range gives it back
+    template <typename T, typename Get = value_of>
+    struct min {
+
+        using type = T;
+
+        static
+        type identity( )
+        {
+            return std::numeric_limits<T>::max( );
+        }
+
+        template <typename V>
+        static
+        type of( const V &val )
+        {
+            return static_cast<T>( Get::get( val ) );
+        }
+
+        static
+        type combine( const type &l, const type &r )
+        {
+            return std::min( l, r );
+        }
+    };
+
+    /// the identity is the lowest T; an empty range gives it back
+    template <typename T, typename Get = value_of>
+    struct max {
+
+        using type = T;
+
+        static
+        type identity( )
+        {
+            return std::numeric_limits<T>::lowest( );
+        }
+
+        template <typename V>
+        static
+        type of( const V &val )
+        {
+            return static_cast<T>( Get::get( val ) );
+        }
+
+        static
+        type combine( const type &l, const type &r )
+        {
+            return std::max( l, r );
+        }
+    };
+
+    /// no summaries; nodes stay as they are, size( ) walks the tree
+    struct none {
+        static const bool enabled = false;
+        using monoid = no_monoid;
+    };
+
+    /// subtree sizes and the fold of 'Monoid'
+    template <typename Monoid = no_monoid>
+    struct counted {
+        static const bool enabled = true;
+        using monoid = Monoid;
+    };
+
+}}
+
+#endif // BTREE_SUMMARY_H
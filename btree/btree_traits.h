@@ -0,0 +1,214 @@
+#ifndef BTREE_TRAITS_H
+#define BTREE_TRAITS_H
+
+#include <cstdint>
+#include <string>
+#include <functional>
+#include <utility>
+#include <algorithm>
+#include <type_traits>
+
+#include "node_search.h"
+#include "node_layout.h"
+
+namespace etool {
+
+template <typename T, typename Less = std::less<T> >
+std::size_t lower_bound( const T *arr, std::size_t length,
+                         const T &val, Less )
+{
+    using policy = typename search::select<search::automatic,
+                                           T, T, Less, 0>::type;
+    return policy::template lower<search::identity, Less>( arr, length, val );
+}
+
+
+template <typename T, typename Less = std::less<T> >
+std::size_t upper_bound( const T *arr, std::size_t length,
+                         const T &val, Less )
+{
+    using policy = typename search::select<search::automatic,
+                                           T, T, Less, 0>::type;
+    return policy::template upper<search::identity, Less>( arr, length, val );
+}
+
+/// std::less<> for C++11: compares any two types with '<'
+/// A trait with a transparent comparator (one that has
+/// 'is_transparent', as std::less<> does) lets the tree look up
+/// with anything comparable to the key; no key_type is built.
+struct transparent_less {
+
+    using is_transparent = void;
+
+    template <typename L, typename R>
+    bool operator ( ) ( const L &l, const R &r ) const
+    {
+        return l < r;
+    }
+};
+
+namespace traits_detail {
+
+    template <typename T, typename = void>
+    struct transparent: std::false_type { };
+
+    template <typename T>
+    struct transparent<T, typename std::conditional<true, void,
+                                 typename T::is_transparent>::type>
+        :std::true_type
+    { };
+}
+
+template <typename Less>
+struct is_transparent: traits_detail::transparent<Less> { };
+
+/// SFINAE guard of the heterogeneous lookups
+template <typename Less>
+using if_transparent =
+        typename std::enable_if<is_transparent<Less>::value>::type;
+
+/// Search is the in-node search policy (see node_search.h);
+/// search::automatic lets the tree pick one for the key and node size
+template <typename T, typename Less = std::less<T>,
+          typename Search = search::automatic >
+struct value_trait {
+
+    using value_type = T;
+    using key_type   = T;
+    using less       = Less;
+    using search     = Search;
+    using layout     = etool::layout::interleaved;
+
+    struct key_access {
+        static
+        key_type &get( value_type &t )
+        {
+            return t;
+        }
+
+        static
+        const key_type &get( const value_type &t )
+        {
+            return t;
+        }
+    };
+
+};
+
+/// Layout is the node layout (see node_layout.h);
+/// layout::split keeps keys apart from the mapped values
+template <typename KeyT, typename ValueT, typename Less = std::less<KeyT>,
+          typename Search = search::automatic,
+          typename Layout = layout::interleaved >
+struct map_trait {
+
+    using value_type  = std::pair<KeyT, ValueT>;
+    using key_type    = KeyT;
+    using mapped_type = ValueT;
+    using less        = Less;
+    using search      = Search;
+    using layout      = Layout;
+
+    struct key_access {
+        static
+        const key_type &get( value_type &t )
+        {
+            return t.first;
+        }
+
+        static
+        const key_type &get( const value_type &t )
+        {
+            return t.first;
+        }
+
+        /// element proxies of layout::split
+        template <typename K, typename V>
+        static
+        const key_type &get( const std::pair<K &, V &> &t )
+        {
+            return t.first;
+        }
+    };
+
+};
+
+/// std::string values in prefix compressed nodes (layout::prefix);
+/// the order is std::less<std::string>, the plain byte order
+struct string_trait {
+
+    using value_type = std::string;
+    using key_type   = std::string;
+    using less       = std::less<std::string>;
+    using search     = etool::search::binary;
+    using layout     = etool::layout::prefix;
+
+    struct key_access {
+        static
+        const key_type &get( const value_type &t )
+        {
+            return t;
+        }
+    };
+
+    /// the shortest prefix of 'right' still greater than 'left'
+    /// 'left' must not be greater than 'right'; equal keys give 'right'
+    static
+    key_type separator( const key_type &left, const key_type &right )
+    {
+        std::size_t pos = 0;
+        auto top = std::min( left.size( ), right.size( ) );
+        while( pos < top && left[pos] == right[pos] ) {
+            ++pos;
+        }
+        if( pos == right.size( ) ) {
+            return right;
+        }
+        return right.substr( 0, pos + 1 );
+    }
+};
+
+namespace traits_detail {
+
+    template <typename Trait>
+    struct has_separator {
+
+        template <typename T>
+        static
+        std::true_type check( decltype( &T::separator ) );
+
+        template <typename T>
+        static
+        std::false_type check( ... );
+
+        static const bool value = decltype( check<Trait>( nullptr ) )::value;
+    };
+
+    template <typename Trait, typename Key>
+    Key separator( const Key &, const Key &right, std::false_type )
+    {
+        return right;
+    }
+
+    template <typename Trait, typename Key>
+    Key separator( const Key &left, const Key &right, std::true_type )
+    {
+        return Trait::separator( left, right );
+    }
+}
+
+/// a key that splits 'left' from 'right': left < key <= right,
+/// 'right' itself for equal keys
+/// Traits may shorten it with a static 'separator( left, right )',
+/// otherwise it is 'right'
+template <typename Trait, typename Key>
+Key separator( const Key &left, const Key &right )
+{
+    using has = std::integral_constant<bool,
+                    traits_detail::has_separator<Trait>::value>;
+    return traits_detail::separator<Trait>( left, right, has( ) );
+}
+
+}
+
+#endif // BTREE_TRAITS_H
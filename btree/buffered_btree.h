@@ -0,0 +1,670 @@
+#ifndef BUFFERED_BTREE_H
+#define BUFFERED_BTREE_H
+
+#include <cstdint>
+#include <vector>
+#include <utility>
+#include <iterator>
+#include <algorithm>
+#include <type_traits>
+
+#include "etool/details/operators.h"
+
+#include "dyn_array.h"
+#include "node_allocator.h"
+#include "node_search.h"
+#include "btree_traits.h"
+
+namespace etool {
+
+/// Write optimized B+tree (a B^epsilon tree)
+/// Inner nodes carry a buffer of pending messages (insert, erase)
+/// sorted by key. An update only goes into the root buffer; a full
+/// buffer hands the messages bound for its busiest child down in one
+/// batch, so a leaf is touched once per batch instead of once per
+/// update. A lookup checks the buffers on its way down; the newest
+/// message for the key wins.
+/// Keys are unique: inserting a key that is there replaces the value.
+/// Separators are strict: the keys of child 'i' are in
+///     [ keys_[i - 1], keys_[i] )
+/// Erase doesn't rebalance; a leaf that runs empty is unlinked
+/// from its parent.
+/// Erase messages carry a default constructed value.
+/// The default shape, narrow inner nodes with 8 messages per child,
+/// did best for random inserts in btree_bench; finds pay for the
+/// buffer searches on the way down.
+template <typename ValueTrait, std::size_t LeafMax,
+          std::size_t InnerMax  = ( LeafMax / 4 > 2 ? LeafMax / 4 : 3 ),
+          std::size_t BufferMax = InnerMax * 8,
+          typename NodeAllocator = slab_allocator< > >
+struct buffered_btree {
+
+    static_assert( LeafMax   > 2, "Leaf maximum must be at least 3" );
+    static_assert( InnerMax  > 2, "Inner maximum must be at least 3" );
+    static_assert( BufferMax > 0, "Buffer maximum must be at least 1" );
+
+    static const std::size_t leaf_maximum   = LeafMax;
+    static const std::size_t inner_maximum  = InnerMax;
+    static const std::size_t buffer_maximum = BufferMax;
+
+    /// nodes made by a split are filled to 3/4,
+    /// so the next few messages don't split them again
+    static const std::size_t leaf_fill  = LeafMax * 3 / 4;
+    static const std::size_t inner_fill = ( InnerMax + 1 ) * 3 / 4 > 2
+                                        ? ( InnerMax + 1 ) * 3 / 4 : 2;
+
+    using value_trait = ValueTrait;
+    using value_type  = typename value_trait::value_type;
+    using key_type    = typename value_trait::key_type;
+    using less_cmp    = typename value_trait::less;
+    using key_access  = typename value_trait::key_access;
+
+    using leaf_search  = typename search::select<
+                                        typename value_trait::search,
+                                        value_type, key_type, less_cmp,
+                                        leaf_maximum>::type;
+
+    using inner_search = typename search::select<
+                                        typename value_trait::search,
+                                        key_type, key_type, less_cmp,
+                                        inner_maximum>::type;
+
+    struct cmp {
+
+        static
+        bool equal( const key_type &l, const key_type &r )
+        {
+            using op = details::operators::cmp<key_type, less_cmp>;
+            return op::equal(l, r);
+        }
+
+        static
+        bool less( const key_type &l, const key_type &r )
+        {
+            using op = details::operators::cmp<key_type, less_cmp>;
+            return op::less(l, r);
+        }
+    };
+
+    struct message {
+        key_type   key;
+        value_type value;
+        bool       erase;
+    };
+
+    struct message_key {
+        static
+        const key_type &get( const message &m )
+        {
+            return m.key;
+        }
+    };
+
+    using message_list = std::vector<message>;
+
+    struct node_base { };
+
+    struct leaf: node_base {
+
+        using value_array = dyn_array<value_type, leaf_maximum>;
+
+        std::size_t size( ) const
+        {
+            return values_.size( );
+        }
+
+        std::size_t lower_of( const key_type &key ) const
+        {
+            using SP = leaf_search;
+            return SP::template lower<key_access, less_cmp>( values_.begin( ),
+                                                             values_.size( ),
+                                                             key );
+        }
+
+        value_array values_;
+    };
+
+    /// keys and children may overrun 'InnerMax' while a batch
+    /// is going down; the node is split before the batch returns
+    struct inner: node_base {
+
+        std::size_t size( ) const
+        {
+            return keys_.size( );
+        }
+
+        /// the child 'key' belongs to
+        std::size_t child_of( const key_type &key ) const
+        {
+            using SP = search::binary;
+            return SP::template upper<search::identity, less_cmp>(
+                                keys_.data( ), keys_.size( ), key );
+        }
+
+        std::size_t message_of( const key_type &key ) const
+        {
+            using SP = search::binary;
+            return SP::template lower<message_key, less_cmp>(
+                                buffer_.data( ), buffer_.size( ), key );
+        }
+
+        std::vector<key_type>    keys_;
+        std::vector<node_base *> next_;
+        message_list             buffer_;
+    };
+
+    using leaf_pool  = typename NodeAllocator::template pool<leaf>;
+    using inner_pool = typename NodeAllocator::template pool<inner>;
+
+    buffered_btree( )
+        :root_(leaves_.create( ))
+    { }
+
+    buffered_btree( const buffered_btree & ) = delete;
+    buffered_btree &operator = ( const buffered_btree & ) = delete;
+
+    buffered_btree( buffered_btree &&other )
+        :leaves_(std::move(other.leaves_))
+        ,inners_(std::move(other.inners_))
+        ,root_(other.root_)
+        ,height_(other.height_)
+    {
+        other.reset( );
+    }
+
+    buffered_btree &operator = ( buffered_btree &&other )
+    {
+        if( this != &other ) {
+            drop_all( );
+            leaves_ = std::move(other.leaves_);
+            inners_ = std::move(other.inners_);
+            root_   = other.root_;
+            height_ = other.height_;
+            other.reset( );
+        }
+        return *this;
+    }
+
+    ~buffered_btree( )
+    {
+        drop_all( );
+    }
+
+    /// number of inner levels above the leaves
+    std::size_t height( ) const
+    {
+        return height_;
+    }
+
+    /// adds 'val' or replaces the value with its key
+    void insert( value_type val )
+    {
+        message msg { key_access::get(val), std::move(val), false };
+        apply( std::move(msg) );
+    }
+
+    /// removes the value with 'key' if there is one
+    void erase( const key_type &key )
+    {
+        message msg { key, value_type( ), true };
+        apply( std::move(msg) );
+    }
+
+    /// the value with 'key' or nullptr;
+    /// the pointer is good until the next update
+    const value_type *find( const key_type &key ) const
+    {
+        auto node = root_;
+        for( auto h = height_; h > 0; --h ) {
+            auto in  = as_inner( node );
+            auto pos = in->message_of( key );
+            if( pos < in->buffer_.size( ) &&
+                cmp::equal( in->buffer_[pos].key, key ) )
+            {
+                auto &msg = in->buffer_[pos];
+                return msg.erase ? nullptr : &msg.value;
+            }
+            node = in->next_[in->child_of( key )];
+        }
+
+        auto lf  = as_leaf( node );
+        auto pos = lf->lower_of( key );
+        if( pos < lf->size( ) &&
+            cmp::equal( key_access::get( lf->values_[pos] ), key ) )
+        {
+            return &lf->values_[pos];
+        }
+        return nullptr;
+    }
+
+    bool contains( const key_type &key ) const
+    {
+        return find( key ) != nullptr;
+    }
+
+    /// applies every pending message to the leaves
+    void flush( )
+    {
+        grow( flush_all( root_, height_ ) );
+        shrink( );
+    }
+
+    /// in-order walk over all values; flushes first
+    template <typename Call>
+    void for_each( Call call )
+    {
+        flush( );
+        walk( root_, height_, call );
+    }
+
+    /// number of values; flushes first
+    std::size_t size( )
+    {
+        std::size_t res = 0;
+        for_each( [&res]( const value_type & ) { ++res; } );
+        return res;
+    }
+
+private:
+
+    /// what a batch did to a node:
+    /// the nodes split off it, each with the separator on its left,
+    /// or 'empty' for a subtree that has nothing left
+    struct outcome {
+        std::vector<std::pair<key_type, node_base *> > split;
+        bool empty = false;
+    };
+
+    static
+    leaf *as_leaf( node_base *node )
+    {
+        return static_cast<leaf *>( node );
+    }
+
+    static
+    const leaf *as_leaf( const node_base *node )
+    {
+        return static_cast<const leaf *>( node );
+    }
+
+    static
+    inner *as_inner( node_base *node )
+    {
+        return static_cast<inner *>( node );
+    }
+
+    static
+    const inner *as_inner( const node_base *node )
+    {
+        return static_cast<const inner *>( node );
+    }
+
+    void apply( message msg )
+    {
+        if( height_ == 0 ) {
+            message_list one;
+            one.push_back( std::move(msg) );
+            grow( apply_leaf( as_leaf( root_ ), one ) );
+            return;
+        }
+
+        auto in  = as_inner( root_ );
+        auto pos = in->message_of( msg.key );
+        if( pos < in->buffer_.size( ) &&
+            cmp::equal( in->buffer_[pos].key, msg.key ) )
+        {
+            in->buffer_[pos] = std::move(msg);
+            return;
+        }
+        in->buffer_.insert( in->buffer_.begin( ) + pos, std::move(msg) );
+
+        if( in->buffer_.size( ) > buffer_maximum ) {
+            drain( in, height_, buffer_maximum );
+            grow( split_inner( in ) );
+            shrink( );
+        }
+    }
+
+    /// the root split: a new root gets the old one and its pieces
+    void grow( outcome res )
+    {
+        while( !res.split.empty( ) ) {
+            auto new_root = inners_.create( );
+            new_root->next_.push_back( root_ );
+            for( auto &s: res.split ) {
+                new_root->keys_.push_back( std::move(s.first) );
+                new_root->next_.push_back( s.second );
+            }
+            root_ = new_root;
+            ++height_;
+            res = split_inner( new_root );
+        }
+    }
+
+    /// an inner root with one child and nothing pending goes
+    void shrink( )
+    {
+        while( height_ > 0 ) {
+            auto in = as_inner( root_ );
+            if( in->next_.size( ) != 1 || !in->buffer_.empty( ) ) {
+                break;
+            }
+            root_ = in->next_[0];
+            inners_.destroy( in );
+            --height_;
+        }
+    }
+
+    /// merges the sorted messages 'msgs' into the sorted 'buffer';
+    /// for the same key the one from 'msgs' is newer
+    void merge_into( message_list &buffer, message_list &msgs )
+    {
+        auto &res = merged_;
+        res.clear( );
+        res.reserve( buffer.size( ) + msgs.size( ) );
+
+        auto b = buffer.begin( );
+        auto m = msgs.begin( );
+        while( b != buffer.end( ) || m != msgs.end( ) ) {
+            if( m == msgs.end( ) ||
+                ( b != buffer.end( ) && cmp::less( b->key, m->key ) ) )
+            {
+                res.push_back( std::move(*b++) );
+            } else {
+                if( b != buffer.end( ) && !cmp::less( m->key, b->key ) ) {
+                    ++b;
+                }
+                res.push_back( std::move(*m++) );
+            }
+        }
+        buffer.swap( res );
+    }
+
+    /// takes the batch to the subtree of 'node' at height 'h'
+    outcome push( node_base *node, std::size_t h, message_list &msgs )
+    {
+        if( h == 0 ) {
+            return apply_leaf( as_leaf( node ), msgs );
+        }
+        auto in = as_inner( node );
+        merge_into( in->buffer_, msgs );
+        if( in->buffer_.size( ) > buffer_maximum ) {
+            if( drain( in, h, buffer_maximum ) && in->buffer_.empty( ) ) {
+                return empty_outcome( );
+            }
+        }
+        return split_inner( in );
+    }
+
+    /// hands batches down to the children until at most 'limit'
+    /// messages are left; every batch goes to the child with the most.
+    /// The node may overrun 'InnerMax' afterwards.
+    /// Returns true if all it has left is one empty child
+    bool drain( inner *node, std::size_t h, std::size_t limit )
+    {
+        bool lone = false;
+        auto &buf = node->buffer_;
+        while( buf.size( ) > limit ) {
+
+            std::size_t best = 0;
+            std::size_t best_first = 0;
+            std::size_t best_count = 0;
+            std::size_t first = 0;
+            for( std::size_t c = 0; c < node->next_.size( ); ++c ) {
+                auto last = first;
+                while( last < buf.size( ) &&
+                       ( c == node->size( ) ||
+                         cmp::less( buf[last].key, node->keys_[c] ) ) )
+                {
+                    ++last;
+                }
+                if( last - first > best_count ) {
+                    best       = c;
+                    best_first = first;
+                    best_count = last - first;
+                }
+                first = last;
+            }
+
+            auto &batch = batch_of( h );
+            batch.assign(
+                std::make_move_iterator( buf.begin( ) + best_first ),
+                std::make_move_iterator( buf.begin( ) + best_first
+                                                      + best_count ) );
+            buf.erase( buf.begin( ) + best_first,
+                       buf.begin( ) + best_first + best_count );
+
+            lone = take( node, h, best,
+                         push( node->next_[best], h - 1, batch ) );
+        }
+        return lone;
+    }
+
+    static
+    outcome empty_outcome( )
+    {
+        outcome res;
+        res.empty = true;
+        return res;
+    }
+
+    /// puts the outcome of the child 'pos' into 'node' at height 'h';
+    /// an empty child goes unless it is the only one.
+    /// Returns true if the only child is empty
+    bool take( inner *node, std::size_t h, std::size_t pos, outcome res )
+    {
+        if( res.empty ) {
+            if( node->next_.size( ) == 1 ) {
+                return true;
+            }
+            drop( node->next_[pos], h - 1 );
+            node->next_.erase( node->next_.begin( ) + pos );
+            node->keys_.erase( node->keys_.begin( ) + ( pos ? pos - 1
+                                                            : 0 ) );
+            return false;
+        }
+
+        std::vector<key_type>    keys;
+        std::vector<node_base *> next;
+        for( auto &s: res.split ) {
+            keys.push_back( std::move(s.first) );
+            next.push_back( s.second );
+        }
+        node->keys_.insert( node->keys_.begin( ) + pos,
+                            std::make_move_iterator( keys.begin( ) ),
+                            std::make_move_iterator( keys.end( ) ) );
+        node->next_.insert( node->next_.begin( ) + pos + 1,
+                            next.begin( ), next.end( ) );
+        return false;
+    }
+
+    /// applies the batch to the leaf in one pass;
+    /// splits it into as many leaves as it takes
+    outcome apply_leaf( leaf *node, message_list &msgs )
+    {
+        auto &vals = values_;
+        vals.clear( );
+        vals.reserve( node->size( ) + msgs.size( ) );
+
+        auto &old = node->values_;
+        std::size_t i = 0;
+        auto m = msgs.begin( );
+        while( i != old.size( ) || m != msgs.end( ) ) {
+            if( m == msgs.end( ) ||
+                ( i != old.size( ) &&
+                  cmp::less( key_access::get( old[i] ), m->key ) ) )
+            {
+                vals.push_back( std::move(old[i++]) );
+            } else {
+                if( i != old.size( ) &&
+                    !cmp::less( m->key, key_access::get( old[i] ) ) )
+                {
+                    ++i;
+                }
+                if( !m->erase ) {
+                    vals.push_back( std::move(m->value) );
+                }
+                ++m;
+            }
+        }
+
+        outcome res;
+        if( vals.empty( ) ) {
+            old.clear( );
+            return empty_outcome( );
+        }
+
+        auto pieces = vals.size( ) <= leaf_maximum
+                    ? 1 : ( vals.size( ) + leaf_fill - 1 ) / leaf_fill;
+
+        std::size_t from = 0;
+        for( std::size_t p = 0; p < pieces; ++p ) {
+            auto to = vals.size( ) * ( p + 1 ) / pieces;
+            auto target = node;
+            if( p > 0 ) {
+                target = leaves_.create( );
+                res.split.emplace_back( key_access::get( vals[from] ),
+                                        target );
+            }
+            target->values_.assign_move( vals.begin( ) + from,
+                                         vals.begin( ) + to );
+            from = to;
+        }
+        return res;
+    }
+
+    /// cuts an overrun inner node into pieces of 3/4 of 'InnerMax';
+    /// the key between two pieces moves up, the buffer is cut by keys
+    outcome split_inner( inner *node )
+    {
+        outcome res;
+        auto children = node->next_.size( );
+        if( children <= inner_maximum + 1 ) {
+            return res;
+        }
+
+        auto pieces = ( children + inner_fill - 1 ) / inner_fill;
+
+        std::vector<key_type>    keys;
+        std::vector<node_base *> next;
+        message_list             buffer;
+        keys.swap( node->keys_ );
+        next.swap( node->next_ );
+        buffer.swap( node->buffer_ );
+
+        std::size_t from = 0;
+        std::size_t msg  = 0;
+        for( std::size_t p = 0; p < pieces; ++p ) {
+            auto to = children * ( p + 1 ) / pieces;
+            auto target = node;
+            if( p > 0 ) {
+                target = inners_.create( );
+                res.split.emplace_back( std::move( keys[from - 1] ), target );
+            }
+            target->next_.assign( next.begin( ) + from, next.begin( ) + to );
+            target->keys_.assign( std::make_move_iterator( keys.begin( ) + from ),
+                                  std::make_move_iterator( keys.begin( ) + to - 1 ) );
+
+            auto end = msg;
+            while( end < buffer.size( ) &&
+                   ( p + 1 == pieces ||
+                     cmp::less( buffer[end].key, keys[to - 1] ) ) )
+            {
+                ++end;
+            }
+            target->buffer_.assign(
+                    std::make_move_iterator( buffer.begin( ) + msg ),
+                    std::make_move_iterator( buffer.begin( ) + end ) );
+            msg  = end;
+            from = to;
+        }
+        return res;
+    }
+
+    /// pushes every message of the subtree down to the leaves
+    outcome flush_all( node_base *node, std::size_t h )
+    {
+        if( h == 0 ) {
+            return as_leaf( node )->values_.empty( ) ? empty_outcome( )
+                                                     : outcome( );
+        }
+        auto in = as_inner( node );
+        bool lone = drain( in, h, 0 );
+
+        /// the pieces split off a flushed child are flushed too
+        for( std::size_t c = 0; c < in->next_.size( ); ) {
+            auto res  = flush_all( in->next_[c], h - 1 );
+            auto gone = res.empty && in->next_.size( ) > 1;
+            auto step = res.split.size( ) + 1;
+            lone = take( in, h, c, std::move(res) );
+            c += gone ? 0 : step;
+        }
+        return lone ? empty_outcome( ) : split_inner( in );
+    }
+
+    template <typename Call>
+    void walk( node_base *node, std::size_t h, Call &call )
+    {
+        if( h == 0 ) {
+            for( auto &v: as_leaf( node )->values_ ) {
+                call( v );
+            }
+            return;
+        }
+        for( auto n: as_inner( node )->next_ ) {
+            walk( n, h - 1, call );
+        }
+    }
+
+    void drop( node_base *node, std::size_t h )
+    {
+        if( h == 0 ) {
+            leaves_.destroy( as_leaf( node ) );
+        } else {
+            auto in = as_inner( node );
+            for( auto n: in->next_ ) {
+                drop( n, h - 1 );
+            }
+            inners_.destroy( in );
+        }
+    }
+
+    /// inner nodes own vectors, so every node is destroyed
+    void drop_all( )
+    {
+        if( root_ ) {
+            drop( root_, height_ );
+        }
+        root_ = nullptr;
+    }
+
+    /// the batch a node at height 'h' hands down; one per level,
+    /// a batch lives while it goes further down
+    message_list &batch_of( std::size_t h )
+    {
+        if( batches_.size( ) < h ) {
+            batches_.resize( h );
+        }
+        return batches_[h - 1];
+    }
+
+    void reset( )
+    {
+        root_   = leaves_.create( );
+        height_ = 0;
+    }
+
+    leaf_pool    leaves_;
+    inner_pool   inners_;
+    node_base   *root_   = nullptr;
+    std::size_t  height_ = 0;
+
+    /// scratch space for the flushes, reused to save allocations
+    std::vector<message_list> batches_;
+    message_list              merged_;
+    std::vector<value_type>   values_;
+};
+
+}
+
+#endif // BUFFERED_BTREE_H
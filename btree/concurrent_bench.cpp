@@ -0,0 +1,185 @@
+#include <iostream>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <random>
+
+#include "btree.h"
+#include "concurrent_btree.h"
+
+using namespace etool;
+
+/// Multi-threaded throughput of concurrent_btree
+/// against btree behind one global mutex.
+/// usage: concurrent_bench [max_threads] [ops_per_thread] [keys]
+/// Prints CSV: tree,threads,read_percent,ops,seconds,mops
+
+namespace {
+
+    using key_type = std::uint64_t;
+
+    struct locked_btree {
+
+        bool insert( key_type k )
+        {
+            std::lock_guard<std::mutex> lck(lock_);
+            if( tree_.find( k ) != tree_.end( ) ) {
+                return false;
+            }
+            tree_.insert( k );
+            return true;
+        }
+
+        bool erase( key_type k )
+        {
+            std::lock_guard<std::mutex> lck(lock_);
+            tree_.erase( k );
+            return true;
+        }
+
+        bool contains( key_type k )
+        {
+            std::lock_guard<std::mutex> lck(lock_);
+            return tree_.find( k ) != tree_.end( );
+        }
+
+        std::mutex                           lock_;
+        btree<value_trait<key_type>, 64>     tree_;
+    };
+
+    struct olc_btree {
+
+        bool insert( key_type k )
+        {
+            return tree_.insert( k );
+        }
+
+        bool erase( key_type k )
+        {
+            return tree_.erase( k );
+        }
+
+        bool contains( key_type k )
+        {
+            return tree_.contains( k );
+        }
+
+        using tree_type = concurrent_btree<value_trait<key_type>, 64>;
+        tree_type tree_;
+    };
+
+    /// the main thread fills the trees and keeps its epoch slot
+    const unsigned thread_limit = olc_btree::tree_type::epochs::max_threads
+                                - 1;
+
+    /// the keys are spread, so neighbours don't share leaves
+    key_type key_of( std::uint64_t i )
+    {
+        return i * 0x9E3779B97F4A7C15ull;
+    }
+
+    template <typename Tree>
+    double run( Tree &tree, unsigned threads, unsigned read_percent,
+                std::size_t ops, std::size_t keys )
+    {
+        std::atomic<unsigned> ready { 0 };
+        std::atomic<bool>     go { false };
+        std::vector<std::thread> pool;
+
+        for( unsigned t = 0; t < threads; ++t ) {
+            pool.emplace_back( [&, t]( ) {
+                std::mt19937_64 gen( t + 1 );
+                std::uniform_int_distribution<std::size_t> key( 0, keys - 1 );
+                std::uniform_int_distribution<unsigned>    op( 0, 99 );
+                std::size_t found = 0;
+
+                ++ready;
+                while( !go ) { }
+
+                for( std::size_t i = 0; i < ops; ++i ) {
+                    auto k = key_of( key( gen ) );
+                    auto o = op( gen );
+                    if( o < read_percent ) {
+                        found += tree.contains( k );
+                    } else if( (o - read_percent) % 2 ) {
+                        tree.insert( k );
+                    } else {
+                        tree.erase( k );
+                    }
+                }
+                volatile std::size_t sink = found;
+                (void)sink;
+            } );
+        }
+
+        while( ready != threads ) { }
+        auto start = std::chrono::steady_clock::now( );
+        go = true;
+        for( auto &p: pool ) {
+            p.join( );
+        }
+        std::chrono::duration<double> d =
+                std::chrono::steady_clock::now( ) - start;
+        return d.count( );
+    }
+
+    template <typename Tree>
+    void series( const char *name, unsigned max_threads,
+                 std::size_t ops, std::size_t keys )
+    {
+        std::vector<unsigned> counts;
+        for( unsigned t = 1; t < max_threads; t *= 2 ) {
+            counts.push_back( t );
+        }
+        counts.push_back( max_threads );
+
+        for( unsigned read_percent: { 100u, 95u, 50u } ) {
+            for( auto t: counts ) {
+                Tree tree;
+                for( std::size_t i = 0; i < keys; i += 2 ) {
+                    tree.insert( key_of( i ) );
+                }
+                auto secs = run( tree, t, read_percent, ops, keys );
+                auto total = ops * t;
+                std::cout << name << "," << t << "," << read_percent << ","
+                          << total << "," << secs << ","
+                          << total / secs / 1e6 << "\n";
+            }
+        }
+    }
+
+}
+
+int main( int argc, char *argv[] )
+{
+    unsigned    max_threads = std::thread::hardware_concurrency( );
+    std::size_t ops         = 1000000;
+    std::size_t keys        = 1000000;
+
+    if( argc > 1 ) {
+        max_threads = std::strtoul( argv[1], nullptr, 10 );
+    }
+    if( argc > 2 ) {
+        ops = std::strtoull( argv[2], nullptr, 10 );
+    }
+    if( argc > 3 ) {
+        keys = std::strtoull( argv[3], nullptr, 10 );
+    }
+    if( max_threads == 0 ) {
+        max_threads = 1;
+    }
+    if( max_threads > thread_limit ) {
+        std::cerr << "max_threads is limited to " << thread_limit << "\n";
+        max_threads = thread_limit;
+    }
+
+    std::cout << "tree,threads,read_percent,ops,seconds,mops\n";
+    series<locked_btree>( "mutex_btree", max_threads, ops, keys );
+    series<olc_btree>( "concurrent_btree", max_threads, ops, keys );
+
+    return 0;
+}
@@ -0,0 +1,587 @@
+#ifndef CONCURRENT_BTREE_H
+#define CONCURRENT_BTREE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <thread>
+#include <algorithm>
+#include <type_traits>
+
+#include "etool/details/operators.h"
+
+#include "node_search.h"
+#include "btree_traits.h"
+#include "epoch_manager.h"
+
+namespace etool {
+
+    /// Node latch for optimistic lock coupling.
+    /// A version counter with two low bits: 'locked' and 'obsolete'.
+    /// Readers remember the version, read the node without locking
+    /// and 'validate' the version afterwards; writers 'upgrade'
+    /// a version they have read into the lock.
+    struct version_latch {
+
+        static const std::uint64_t obsolete = 1;
+        static const std::uint64_t locked   = 2;
+
+        /// false if the node is obsolete; waits while it's locked
+        bool read( std::uint64_t &v ) const
+        {
+            v = version_.load( std::memory_order_acquire );
+            while( v & locked ) {
+                std::this_thread::yield( );
+                v = version_.load( std::memory_order_acquire );
+            }
+            return (v & obsolete) == 0;
+        }
+
+        /// nothing has changed since 'read' returned 'v'
+        bool validate( std::uint64_t v ) const
+        {
+            std::atomic_thread_fence( std::memory_order_acquire );
+            return version_.load( std::memory_order_relaxed ) == v;
+        }
+
+        bool upgrade( std::uint64_t v )
+        {
+            return version_.compare_exchange_strong( v, v + locked );
+        }
+
+        void unlock( )
+        {
+            version_.fetch_add( locked );
+        }
+
+        void unlock_obsolete( )
+        {
+            version_.fetch_add( locked + obsolete );
+        }
+
+    private:
+        std::atomic<std::uint64_t> version_ { 0 };
+    };
+
+/// Thread-safe B+tree with optimistic lock coupling
+/// Readers never lock: they descend checking node versions and restart
+/// when a writer got in the way. Writers latch only the nodes they
+/// change: a leaf for a plain insert or erase, a node and its parent
+/// for a split or an unlink. Full nodes are split on the way down,
+/// so a split never cascades.
+/// Keys are unique. Erase doesn't rebalance; a leaf that becomes empty
+/// is unlinked from its parent and freed through the epoch manager.
+/// Values are read while they may be being written and then thrown
+/// away, so they have to be trivially copyable.
+/// Operations throw std::length_error on threads beyond MaxThreads
+/// (see epoch_manager).
+template <typename ValueTrait, std::size_t LeafMax,
+          std::size_t InnerMax = LeafMax,
+          std::size_t MaxThreads = 256 >
+struct concurrent_btree {
+
+    static_assert( LeafMax  > 2, "Leaf maximum must be at least 3" );
+    static_assert( InnerMax > 2, "Inner maximum must be at least 3" );
+
+    static const std::size_t leaf_maximum  = LeafMax;
+    static const std::size_t inner_maximum = InnerMax;
+
+    using value_trait = ValueTrait;
+    using value_type  = typename value_trait::value_type;
+    using key_type    = typename value_trait::key_type;
+    using less_cmp    = typename value_trait::less;
+    using key_access  = typename value_trait::key_access;
+
+    static_assert( std::is_trivially_copy_constructible<value_type>::value &&
+                   std::is_trivially_destructible<value_type>::value,
+                   "value_type must be trivially copyable" );
+
+    using leaf_search  = typename search::select<
+                                        typename value_trait::search,
+                                        value_type, key_type, less_cmp,
+                                        leaf_maximum>::type;
+
+    using inner_search = typename search::select<
+                                        typename value_trait::search,
+                                        key_type, key_type, less_cmp,
+                                        inner_maximum>::type;
+
+    using epochs = epoch_manager<MaxThreads>;
+
+    struct cmp {
+
+        static
+        bool equal( const key_type &l, const key_type &r )
+        {
+            using op = details::operators::cmp<key_type, less_cmp>;
+            return op::equal(l, r);
+        }
+    };
+
+    struct node_base {
+
+        explicit
+        node_base( bool leaf )
+            :leaf_(leaf)
+        { }
+
+        /// may be read while a writer changes it
+        std::size_t size( ) const
+        {
+            return count_.load( std::memory_order_relaxed );
+        }
+
+        void set_size( std::size_t count )
+        {
+            count_.store( count, std::memory_order_relaxed );
+        }
+
+        version_latch            latch_;
+        std::atomic<std::size_t> count_ { 0 };
+        const bool               leaf_;
+    };
+
+    struct leaf: node_base {
+
+        leaf( )
+            :node_base(true)
+        { }
+
+        bool full( ) const
+        {
+            return this->size( ) >= leaf_maximum;
+        }
+
+        std::size_t lower_of( const key_type &key ) const
+        {
+            using SP = leaf_search;
+            auto n = this->size( );
+            n = n < leaf_maximum ? n : leaf_maximum;
+            return SP::template lower<key_access, less_cmp>( values_, n, key );
+        }
+
+        value_type values_[leaf_maximum];
+    };
+
+    struct inner: node_base {
+
+        inner( )
+            :node_base(false)
+        {
+            std::fill( next_, next_ + inner_maximum + 1, nullptr );
+        }
+
+        bool full( ) const
+        {
+            return this->size( ) >= inner_maximum;
+        }
+
+        std::size_t lower_of( const key_type &key ) const
+        {
+            using SP = inner_search;
+            using KA = search::identity;
+            auto n = this->size( );
+            n = n < inner_maximum ? n : inner_maximum;
+            return SP::template lower<KA, less_cmp>( keys_, n, key );
+        }
+
+        key_type   keys_[inner_maximum];
+        node_base *next_[inner_maximum + 1];
+    };
+
+    concurrent_btree( )
+        :root_(new leaf)
+    { }
+
+    concurrent_btree( const concurrent_btree & ) = delete;
+    concurrent_btree &operator = ( const concurrent_btree & ) = delete;
+
+    /// no other thread may use the tree
+    ~concurrent_btree( )
+    {
+        drop( root_.load( ) );
+    }
+
+    /// false if the key is already there
+    bool insert( const value_type &val )
+    {
+        typename epochs::guard grd(epochs_);
+        result res;
+        while( (res = try_insert( val )) == result::restart ) { }
+        return res == result::done;
+    }
+
+    /// false if there was no such key
+    bool erase( const key_type &key )
+    {
+        typename epochs::guard grd(epochs_);
+        result res;
+        while( (res = try_erase( key )) == result::restart ) { }
+        return res == result::done;
+    }
+
+    /// copies the value with 'key' to 'out'
+    bool find( const key_type &key, value_type &out ) const
+    {
+        typename epochs::guard grd(epochs_);
+        result res;
+        while( (res = try_find( key, &out )) == result::restart ) { }
+        return res == result::done;
+    }
+
+    bool contains( const key_type &key ) const
+    {
+        typename epochs::guard grd(epochs_);
+        result res;
+        while( (res = try_find( key, nullptr )) == result::restart ) { }
+        return res == result::done;
+    }
+
+    /// in-order walk; no writer may run at the same time
+    template <typename Call>
+    void for_each( Call call ) const
+    {
+        for_each_impl( root_.load( ), call );
+    }
+
+private:
+
+    enum class result { done, failed, restart };
+
+    struct descent {
+        leaf          *leaf_   = nullptr;
+        std::uint64_t  v_      = 0;
+        inner         *parent_ = nullptr;
+        std::uint64_t  pv_     = 0;
+        std::size_t    ppos_   = 0;
+    };
+
+    /// reads the root and its version;
+    /// the root pointer is checked again since the old root
+    /// stays a valid node after a root split
+    bool read_root( node_base *&node, std::uint64_t &v ) const
+    {
+        node = root_.load( std::memory_order_acquire );
+        return node->latch_.read( v )
+            && node == root_.load( std::memory_order_acquire );
+    }
+
+    /// one step of lock coupling: the child for 'key' and its version;
+    /// the parent is validated around reading the child
+    static
+    bool step_down( inner *in, std::uint64_t v, const key_type &key,
+                    std::size_t &pos, node_base *&child, std::uint64_t &cv )
+    {
+        pos   = in->lower_of( key );
+        child = in->next_[pos];
+        if( !child || !in->latch_.validate( v ) ) {
+            return false;
+        }
+        return child->latch_.read( cv ) && in->latch_.validate( v );
+    }
+
+    bool descend( const key_type &key, descent &d ) const
+    {
+        node_base    *node;
+        std::uint64_t v;
+        if( !read_root( node, v ) ) {
+            return false;
+        }
+
+        while( !node->leaf_ ) {
+            auto in = static_cast<inner *>(node);
+            std::size_t   pos;
+            std::uint64_t cv;
+            if( !step_down( in, v, key, pos, node, cv ) ) {
+                return false;
+            }
+            d.parent_ = in;
+            d.pv_     = v;
+            d.ppos_   = pos;
+            v         = cv;
+        }
+
+        d.leaf_ = static_cast<leaf *>(node);
+        d.v_    = v;
+        return true;
+    }
+
+    result try_find( const key_type &key, value_type *out ) const
+    {
+        descent d;
+        if( !descend( key, d ) ) {
+            return result::restart;
+        }
+
+        auto lf  = d.leaf_;
+        auto pos = lf->lower_of( key );
+        bool hit = pos < lf->size( ) &&
+                   cmp::equal( key_access::get(lf->values_[pos]), key );
+        value_type tmp;
+        if( hit && out ) {
+            tmp = lf->values_[pos];
+        }
+
+        if( !lf->latch_.validate( d.v_ ) ) {
+            return result::restart;
+        }
+        if( hit && out ) {
+            *out = tmp;
+        }
+        return hit ? result::done : result::failed;
+    }
+
+    result try_insert( const value_type &val )
+    {
+        const key_type &key = key_access::get(val);
+
+        node_base    *node;
+        std::uint64_t v;
+        if( !read_root( node, v ) ) {
+            return result::restart;
+        }
+
+        inner        *parent = nullptr;
+        std::uint64_t pv     = 0;
+
+        while( true ) {
+
+            bool full = node->leaf_ ? static_cast<leaf *>(node)->full( )
+                                    : static_cast<inner *>(node)->full( );
+            if( full ) {
+                split( node, v, parent, pv );
+                return result::restart;
+            }
+
+            if( node->leaf_ ) {
+                break;
+            }
+
+            auto in = static_cast<inner *>(node);
+            std::size_t   pos;
+            std::uint64_t cv;
+            if( !step_down( in, v, key, pos, node, cv ) ) {
+                return result::restart;
+            }
+            parent = in;
+            pv     = v;
+            v      = cv;
+        }
+
+        auto lf = static_cast<leaf *>(node);
+        if( !lf->latch_.upgrade( v ) ) {
+            return result::restart;
+        }
+
+        auto n   = lf->size( );
+        auto pos = lf->lower_of( key );
+        if( pos < n && cmp::equal( key_access::get(lf->values_[pos]), key ) ) {
+            lf->latch_.unlock( );
+            return result::failed;
+        }
+
+        std::copy_backward( lf->values_ + pos, lf->values_ + n,
+                            lf->values_ + n + 1 );
+        lf->values_[pos] = val;
+        lf->set_size( n + 1 );
+        lf->latch_.unlock( );
+
+        return result::done;
+    }
+
+    result try_erase( const key_type &key )
+    {
+        descent d;
+        if( !descend( key, d ) ) {
+            return result::restart;
+        }
+
+        auto lf  = d.leaf_;
+        auto n   = lf->size( );
+        auto pos = lf->lower_of( key );
+        if( pos >= n ||
+           !cmp::equal( key_access::get(lf->values_[pos]), key ) )
+        {
+            return lf->latch_.validate( d.v_ ) ? result::failed
+                                               : result::restart;
+        }
+
+        /// the last value of a leaf with siblings: unlink the leaf
+        if( n == 1 && d.parent_ && d.parent_->size( ) > 0 ) {
+
+            auto parent = d.parent_;
+            if( !parent->latch_.upgrade( d.pv_ ) ) {
+                return result::restart;
+            }
+            if( !lf->latch_.upgrade( d.v_ ) ) {
+                parent->latch_.unlock( );
+                return result::restart;
+            }
+
+            remove_child( parent, d.ppos_ );
+            lf->latch_.unlock_obsolete( );
+            parent->latch_.unlock( );
+
+            epochs_.retire( lf, &delete_leaf );
+            return result::done;
+        }
+
+        if( !lf->latch_.upgrade( d.v_ ) ) {
+            return result::restart;
+        }
+
+        std::copy( lf->values_ + pos + 1, lf->values_ + n,
+                   lf->values_ + pos );
+        lf->set_size( n - 1 );
+        lf->latch_.unlock( );
+
+        return result::done;
+    }
+
+    /// locks 'parent' and 'node' at the versions they were read with
+    /// and splits 'node'; does nothing if either has changed
+    void split( node_base *node, std::uint64_t v,
+                inner *parent, std::uint64_t pv )
+    {
+        if( parent && !parent->latch_.upgrade( pv ) ) {
+            return;
+        }
+        if( !node->latch_.upgrade( v ) ) {
+            if( parent ) {
+                parent->latch_.unlock( );
+            }
+            return;
+        }
+        if( !parent && node != root_.load( ) ) {
+            node->latch_.unlock( );
+            return;
+        }
+
+        key_type   sep;
+        node_base *right = node->leaf_
+                         ? split_leaf( static_cast<leaf *>(node), sep )
+                         : split_inner( static_cast<inner *>(node), sep );
+
+        if( parent ) {
+            insert_child( parent, sep, right );
+        } else {
+            auto top = new inner;
+            top->keys_[0] = sep;
+            top->next_[0] = node;
+            top->next_[1] = right;
+            top->set_size( 1 );
+            root_.store( top );
+        }
+
+        node->latch_.unlock( );
+        if( parent ) {
+            parent->latch_.unlock( );
+        }
+    }
+
+    /// left keeps keys up to 'sep', the right part is returned
+    static
+    node_base *split_leaf( leaf *src, key_type &sep )
+    {
+        auto n    = src->size( );
+        auto half = n / 2;
+        auto res  = new leaf;
+
+        std::copy( src->values_ + half, src->values_ + n, res->values_ );
+        res->set_size( n - half );
+        src->set_size( half );
+
+        sep = key_access::get(src->values_[half - 1]);
+        return res;
+    }
+
+    static
+    node_base *split_inner( inner *src, key_type &sep )
+    {
+        auto n    = src->size( );
+        auto half = n / 2;
+        auto res  = new inner;
+
+        sep = src->keys_[half];
+        std::copy( src->keys_ + half + 1, src->keys_ + n, res->keys_ );
+        std::copy( src->next_ + half + 1, src->next_ + n + 1, res->next_ );
+        res->set_size( n - half - 1 );
+        src->set_size( half );
+
+        return res;
+    }
+
+    static
+    void insert_child( inner *node, const key_type &sep, node_base *right )
+    {
+        auto n   = node->size( );
+        auto pos = node->lower_of( sep );
+
+        std::copy_backward( node->keys_ + pos, node->keys_ + n,
+                            node->keys_ + n + 1 );
+        std::copy_backward( node->next_ + pos + 1, node->next_ + n + 1,
+                            node->next_ + n + 2 );
+        node->keys_[pos]     = sep;
+        node->next_[pos + 1] = right;
+        node->set_size( n + 1 );
+    }
+
+    /// the neighbour takes over the key range of the removed child
+    static
+    void remove_child( inner *node, std::size_t pos )
+    {
+        auto n = node->size( );
+        if( pos < n ) {
+            std::copy( node->keys_ + pos + 1, node->keys_ + n,
+                       node->keys_ + pos );
+            std::copy( node->next_ + pos + 1, node->next_ + n + 1,
+                       node->next_ + pos );
+        }
+        node->next_[n] = nullptr;
+        node->set_size( n - 1 );
+    }
+
+    static
+    void delete_leaf( void *ptr )
+    {
+        delete static_cast<leaf *>(ptr);
+    }
+
+    template <typename Call>
+    static
+    void for_each_impl( const node_base *node, Call &call )
+    {
+        if( node->leaf_ ) {
+            auto lf = static_cast<const leaf *>(node);
+            for( std::size_t i = 0; i < lf->size( ); ++i ) {
+                call( lf->values_[i] );
+            }
+        } else {
+            auto in = static_cast<const inner *>(node);
+            for( std::size_t i = 0; i <= in->size( ); ++i ) {
+                for_each_impl( in->next_[i], call );
+            }
+        }
+    }
+
+    static
+    void drop( node_base *node )
+    {
+        if( node->leaf_ ) {
+            delete static_cast<leaf *>(node);
+        } else {
+            auto in = static_cast<inner *>(node);
+            for( std::size_t i = 0; i <= in->size( ); ++i ) {
+                drop( in->next_[i] );
+            }
+            delete in;
+        }
+    }
+
+    mutable epochs          epochs_;
+    std::atomic<node_base *> root_;
+};
+
+}
+
+#endif // CONCURRENT_BTREE_H
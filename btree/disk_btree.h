@@ -0,0 +1,692 @@
+#ifndef DISK_BTREE_H
+#define DISK_BTREE_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <algorithm>
+#include <type_traits>
+#include <utility>
+
+#include "etool/details/byte_order.h"
+#include "etool/details/operators.h"
+
+#include "data_source.h"
+#include "node_search.h"
+#include "btree_traits.h"
+
+namespace etool {
+
+    /// Fixed size big-endian encoding of values stored on disk.
+    /// A codec provides 'size', write( val, out ) and read( in ).
+    template <typename T, typename Enable = void>
+    struct disk_codec;
+
+    template <typename T>
+    struct disk_codec<T, typename std::enable_if<
+                                std::is_integral<T>::value>::type> {
+
+        static const std::size_t size = sizeof(T);
+
+        static
+        void write( const T &val, char *out )
+        {
+            details::byte_order_big<T>::write( val, out );
+        }
+
+        static
+        T read( const char *in )
+        {
+            return details::byte_order_big<T>::read( in );
+        }
+    };
+
+    /// floating point values go as their bit patterns
+    template <typename T>
+    struct disk_codec<T, typename std::enable_if<
+                                std::is_floating_point<T>::value>::type> {
+
+        using bits_type = typename std::conditional<sizeof(T) == 4,
+                                                    std::uint32_t,
+                                                    std::uint64_t>::type;
+
+        static_assert( sizeof(T) == sizeof(bits_type),
+                       "Unsupported floating point size" );
+
+        static const std::size_t size = sizeof(T);
+
+        static
+        void write( const T &val, char *out )
+        {
+            bits_type bits;
+            std::memcpy( &bits, &val, sizeof(bits) );
+            details::byte_order_big<bits_type>::write( bits, out );
+        }
+
+        static
+        T read( const char *in )
+        {
+            auto bits = details::byte_order_big<bits_type>::read( in );
+            T val;
+            std::memcpy( &val, &bits, sizeof(val) );
+            return val;
+        }
+    };
+
+    template <typename F, typename S>
+    struct disk_codec<std::pair<F, S>, void> {
+
+        using first_codec  = disk_codec<typename std::remove_const<F>::type>;
+        using second_codec = disk_codec<S>;
+
+        static const std::size_t size = first_codec::size
+                                      + second_codec::size;
+
+        static
+        void write( const std::pair<F, S> &val, char *out )
+        {
+            first_codec::write( val.first, out );
+            second_codec::write( val.second, out + first_codec::size );
+        }
+
+        static
+        std::pair<F, S> read( const char *in )
+        {
+            return std::pair<F, S>( first_codec::read( in ),
+                                    second_codec::read( in + first_codec::size ) );
+        }
+    };
+
+/// btree whose nodes live in blocks of a filealloc data_source
+/// Every node takes one block; children are referenced by block_id.
+/// The node capacity follows from the block size of the file
+/// (its block_factor) and the encoded value size.
+/// Recently used nodes are kept in a buffer pool of 'cache' nodes;
+/// changed nodes are written back when they are evicted or on 'flush'.
+/// The first block of the file holds the root id and the value count,
+/// so 'open' gets the index back without rebuilding it.
+template <typename ValueTrait,
+          typename Codec = disk_codec<typename ValueTrait::value_type> >
+struct disk_btree {
+
+    using value_trait = ValueTrait;
+    using value_type  = typename value_trait::value_type;
+    using key_type    = typename value_trait::key_type;
+    using less_cmp    = typename value_trait::less;
+    using key_access  = typename value_trait::key_access;
+    using codec       = Codec;
+
+    using data_source = filealloc::data_source;
+    using block_id    = filealloc::block_id;
+
+    using search_policy = typename search::select<
+                                        typename value_trait::search,
+                                        value_type, key_type, less_cmp,
+                                        0>::type;
+
+    /// nodes kept in memory by default
+    static const std::size_t default_cache = 1024;
+
+    /// count(2), leaf flag(1)
+    static const std::size_t node_header = 3;
+
+    struct cmp {
+
+        static
+        bool equal( const key_type &l, const key_type &r )
+        {
+            using op = details::operators::cmp<key_type, less_cmp>;
+            return op::equal(l, r);
+        }
+    };
+
+    struct dnode {
+
+        std::size_t size( ) const
+        {
+            return values_.size( );
+        }
+
+        bool is_leaf( ) const
+        {
+            return next_.empty( );
+        }
+
+        std::size_t lower_of( const key_type &key ) const
+        {
+            using SP = search_policy;
+            return SP::template lower<key_access, less_cmp>( values_.data( ),
+                                                             values_.size( ),
+                                                             key );
+        }
+
+        block_id                id_    = 0;
+        bool                    dirty_ = false;
+        std::vector<value_type> values_;
+        std::vector<block_id>   next_;
+    };
+
+    disk_btree( ) = default;
+
+    disk_btree( const disk_btree & ) = delete;
+    disk_btree &operator = ( const disk_btree & ) = delete;
+
+    disk_btree( disk_btree && ) = default;
+    disk_btree &operator = ( disk_btree && ) = delete;
+
+    ~disk_btree( )
+    {
+        if( is_open( ) ) {
+            flush( );
+        }
+    }
+
+    /// a new file with an empty tree;
+    /// blocks are 'block_factor' * 512 + 512 bytes (see data_source)
+    static
+    disk_btree create( const std::string &path,
+                       filealloc::scale_factor block_factor,
+                       std::size_t cache = default_cache )
+    {
+        data_source::create( path, block_factor, 0 );
+
+        disk_btree res;
+        res.ds_ = data_source::open( path );
+        if( !res.setup( cache ) ) {
+            return disk_btree( );
+        }
+
+        auto meta = res.ds_.allocate( meta_size );
+        res.meta_ = meta.id;
+        res.root_ = res.create_node( )->id_;
+        res.flush( );
+
+        return res;
+    }
+
+    /// an index made by 'create' before; not open if the file isn't one
+    static
+    disk_btree open( const std::string &path,
+                     std::size_t cache = default_cache )
+    {
+        disk_btree res;
+        res.ds_ = data_source::open( path );
+        if( !res.setup( cache ) || !res.read_meta( ) ) {
+            return disk_btree( );
+        }
+        return res;
+    }
+
+    bool is_open( ) const
+    {
+        return ds_.is_open( ) && root_ != 0;
+    }
+
+    /// values per node at most
+    std::size_t node_capacity( ) const
+    {
+        return maximum_ - 1;
+    }
+
+    std::size_t size( ) const
+    {
+        return size_;
+    }
+
+    bool empty( ) const
+    {
+        return size_ == 0;
+    }
+
+    void insert( value_type val )
+    {
+        const key_type key = key_access::get(val);
+
+        path_.clear( );
+        auto node = get( root_ );
+        auto pos  = node->lower_of( key );
+
+        while( !node->is_leaf( ) ) {
+            path_.push_back( std::make_pair( node, pos ) );
+            node = get( node->next_[pos] );
+            pos  = node->lower_of( key );
+        }
+
+        node->values_.insert( node->values_.begin( ) + pos, std::move(val) );
+        node->dirty_ = true;
+
+        while( node->size( ) == maximum_ ) {
+
+            auto right = create_node( );
+            auto up    = split( node, right );
+
+            if( path_.empty( ) ) {
+                auto top = create_node( );
+                top->values_.push_back( std::move(up) );
+                top->next_.push_back( node->id_ );
+                top->next_.push_back( right->id_ );
+                root_ = top->id_;
+                break;
+            }
+
+            auto step = path_.back( );
+            path_.pop_back( );
+            node = step.first;
+            pos  = step.second;
+
+            node->values_.insert( node->values_.begin( ) + pos,
+                                  std::move(up) );
+            node->next_.insert( node->next_.begin( ) + pos + 1, right->id_ );
+            node->dirty_ = true;
+        }
+
+        ++size_;
+        trim( );
+    }
+
+    /// removes one value equal to 'key'
+    bool erase( const key_type &key )
+    {
+        path_.clear( );
+        auto node = get( root_ );
+        std::size_t pos = 0;
+
+        while( true ) {
+            pos = node->lower_of( key );
+            if( pos != node->size( ) &&
+                cmp::equal( key_access::get(node->values_[pos]), key ) )
+            {
+                break;
+            }
+            if( node->is_leaf( ) ) {
+                trim( );
+                return false;
+            }
+            path_.push_back( std::make_pair( node, pos ) );
+            node = get( node->next_[pos] );
+        }
+
+        if( node->is_leaf( ) ) {
+            node->values_.erase( node->values_.begin( ) + pos );
+        } else {
+            /// the greatest value on the left takes the place
+            path_.push_back( std::make_pair( node, pos ) );
+            auto ml = get( node->next_[pos] );
+            while( !ml->is_leaf( ) ) {
+                path_.push_back( std::make_pair( ml, ml->size( ) ) );
+                ml = get( ml->next_[ml->size( )] );
+            }
+            node->values_[pos] = std::move(ml->values_.back( ));
+            node->dirty_ = true;
+            ml->values_.pop_back( );
+            node = ml;
+        }
+        node->dirty_ = true;
+
+        fix_up( node );
+
+        --size_;
+        trim( );
+        return true;
+    }
+
+    /// copies the first value equal to 'key' to 'out'
+    bool find( const key_type &key, value_type &out )
+    {
+        auto node = get( root_ );
+        while( true ) {
+            auto pos = node->lower_of( key );
+            if( pos != node->size( ) &&
+                cmp::equal( key_access::get(node->values_[pos]), key ) )
+            {
+                out = node->values_[pos];
+                trim( );
+                return true;
+            }
+            if( node->is_leaf( ) ) {
+                trim( );
+                return false;
+            }
+            node = get( node->next_[pos] );
+        }
+    }
+
+    bool contains( const key_type &key )
+    {
+        value_type tmp;
+        return find( key, tmp );
+    }
+
+    /// in-order walk; nodes are looked up by id on every step,
+    /// so the buffer pool stays within its size
+    template <typename Call>
+    void for_each( Call call )
+    {
+        std::vector<std::pair<block_id, std::size_t> > stack;
+        stack.push_back( std::make_pair( root_, 0 ) );
+
+        while( !stack.empty( ) ) {
+            auto node = get( stack.back( ).first );
+            auto idx  = stack.back( ).second;
+
+            if( node->is_leaf( ) ) {
+                for( auto &v: node->values_ ) {
+                    call( v );
+                }
+                stack.pop_back( );
+            } else if( idx <= node->size( ) ) {
+                if( idx > 0 ) {
+                    call( node->values_[idx - 1] );
+                }
+                ++stack.back( ).second;
+                stack.push_back( std::make_pair( node->next_[idx], 0 ) );
+            } else {
+                stack.pop_back( );
+            }
+            trim( );
+        }
+    }
+
+    /// writes changed nodes, the tree header and the free block list
+    void flush( )
+    {
+        for( auto &c: cache_ ) {
+            if( c.second.first.dirty_ ) {
+                write_node( c.second.first );
+            }
+        }
+        write_meta( );
+        ds_.save( );
+    }
+
+private:
+
+    using lru_list = std::list<block_id>;
+    using cache_entry = std::pair<dnode, typename lru_list::iterator>;
+
+    /// magic(4), root(4), size(8)
+    static const std::size_t meta_size = 16;
+
+    bool setup( std::size_t cache )
+    {
+        if( !ds_.is_open( ) ) {
+            return false;
+        }
+        cache_size_ = cache ? cache : 1;
+
+        auto payload = static_cast<std::size_t>( ds_.block_size_ )
+                     - filealloc::allocated_block::size( );
+
+        /// maximum - 1 values and maximum children have to fit
+        maximum_ = ( payload - node_header + codec::size )
+                 / ( codec::size + sizeof(block_id) );
+        middle_  = maximum_ / 2;
+        minimum_ = middle_ + maximum_ % 2 - 1;
+        node_bytes_ = payload;
+
+        return maximum_ >= 3;
+    }
+
+    bool read_meta( )
+    {
+        /// the first block after the header
+        meta_ = 1;
+        std::string data( meta_size, '\0' );
+        if( !ds_.read_payload( meta_, data ) ||
+            data.compare( 0, 4, std::string( "ebt", 4 ) ) != 0 )
+        {
+            return false;
+        }
+        root_ = details::byte_order_big<block_id>::read( &data[4] );
+        size_ = details::byte_order_big<std::uint64_t>::read( &data[8] );
+        return root_ != 0;
+    }
+
+    void write_meta( )
+    {
+        std::string data( "ebt", 4 );
+        filealloc::bytes::append( root_, data );
+        filealloc::bytes::append( static_cast<std::uint64_t>( size_ ), data );
+        ds_.write_payload( meta_, data );
+    }
+
+    /// the node from the pool or from the file
+    dnode *get( block_id id )
+    {
+        auto f = cache_.find( id );
+        if( f != cache_.end( ) ) {
+            lru_.splice( lru_.begin( ), lru_, f->second.second );
+            return &f->second.first;
+        }
+
+        lru_.push_front( id );
+        auto &entry = cache_[id];
+        entry.second = lru_.begin( );
+        read_node( id, entry.first );
+        return &entry.first;
+    }
+
+    dnode *create_node( )
+    {
+        auto inf = ds_.allocate( node_bytes_ );
+
+        lru_.push_front( inf.id );
+        auto &entry = cache_[inf.id];
+        entry.second = lru_.begin( );
+        entry.first.id_    = inf.id;
+        entry.first.dirty_ = true;
+        entry.first.values_.reserve( maximum_ );
+        return &entry.first;
+    }
+
+    void destroy_node( dnode *node )
+    {
+        filealloc::allocated_block_info inf;
+        inf.id          = node->id_;
+        inf.block.count = 1;
+
+        auto f = cache_.find( node->id_ );
+        lru_.erase( f->second.second );
+        cache_.erase( f );
+
+        ds_.free( inf );
+    }
+
+    /// only between operations: nodes of the current one
+    /// are referenced by pointer
+    void trim( )
+    {
+        while( cache_.size( ) > cache_size_ ) {
+            auto id = lru_.back( );
+            auto f  = cache_.find( id );
+            if( f->second.first.dirty_ ) {
+                write_node( f->second.first );
+            }
+            lru_.pop_back( );
+            cache_.erase( f );
+        }
+    }
+
+    void write_node( dnode &node )
+    {
+        std::string data( node_bytes_, '\0' );
+        auto out = &data[0];
+
+        filealloc::byte_order<std::uint16_t>::write(
+                    static_cast<std::uint16_t>( node.size( ) ), out );
+        out[2] = node.is_leaf( ) ? 1 : 0;
+        out += node_header;
+
+        for( auto &v: node.values_ ) {
+            codec::write( v, out );
+            out += codec::size;
+        }
+        for( auto n: node.next_ ) {
+            filealloc::byte_order<block_id>::write( n, out );
+            out += sizeof(block_id);
+        }
+
+        ds_.write_payload( node.id_, data );
+        node.dirty_ = false;
+    }
+
+    void read_node( block_id id, dnode &node )
+    {
+        std::string data( node_bytes_, '\0' );
+        ds_.read_payload( id, data );
+
+        const char *in = data.data( );
+        std::size_t count =
+                filealloc::byte_order<std::uint16_t>::read( in );
+        bool leaf = in[2] != 0;
+        in += node_header;
+
+        node.id_    = id;
+        node.dirty_ = false;
+        node.values_.clear( );
+        node.values_.reserve( maximum_ );
+        for( std::size_t i = 0; i < count; ++i ) {
+            node.values_.push_back( codec::read( in ) );
+            in += codec::size;
+        }
+        node.next_.clear( );
+        if( !leaf ) {
+            for( std::size_t i = 0; i <= count; ++i ) {
+                node.next_.push_back(
+                        filealloc::byte_order<block_id>::read( in ) );
+                in += sizeof(block_id);
+            }
+        }
+    }
+
+    /// moves the upper half of the full 'node' to 'right';
+    /// returns the middle value
+    value_type split( dnode *node, dnode *right )
+    {
+        auto &vals = node->values_;
+        value_type up = std::move(vals[middle_]);
+
+        right->values_.assign( std::make_move_iterator( vals.begin( ) + middle_ + 1 ),
+                               std::make_move_iterator( vals.end( ) ) );
+        vals.resize( middle_ );
+
+        if( !node->is_leaf( ) ) {
+            right->next_.assign( node->next_.begin( ) + middle_ + 1,
+                                 node->next_.end( ) );
+            node->next_.resize( middle_ + 1 );
+        }
+
+        node->dirty_  = true;
+        right->dirty_ = true;
+        return up;
+    }
+
+    /// 'node' has just lost a value; path_ leads to it
+    void fix_up( dnode *node )
+    {
+        while( !path_.empty( ) && node->size( ) < minimum_ ) {
+
+            auto step   = path_.back( );
+            path_.pop_back( );
+            auto parent = step.first;
+            auto pos    = step.second;
+
+            parent->dirty_ = true;
+
+            auto left  = pos > 0 ? get( parent->next_[pos - 1] ) : nullptr;
+            auto right = pos < parent->size( ) ? get( parent->next_[pos + 1] )
+                                               : nullptr;
+
+            if( left && left->size( ) > minimum_ ) {
+                rotate_cw( parent, left, node, pos - 1 );
+                return;
+            } else if( right && right->size( ) > minimum_ ) {
+                rotate_ccw( parent, node, right, pos );
+                return;
+            }
+
+            if( left ) {
+                merge( parent, left, node, pos - 1 );
+            } else {
+                merge( parent, node, right, pos );
+            }
+            node = parent;
+        }
+
+        auto root = get( root_ );
+        if( root->values_.empty( ) && !root->is_leaf( ) ) {
+            root_ = root->next_[0];
+            destroy_node( root );
+        }
+    }
+
+    static
+    void rotate_cw( dnode *parent, dnode *l, dnode *r, std::size_t pos )
+    {
+        r->values_.insert( r->values_.begin( ),
+                           std::move(parent->values_[pos]) );
+        parent->values_[pos] = std::move(l->values_.back( ));
+        l->values_.pop_back( );
+
+        if( !l->is_leaf( ) ) {
+            r->next_.insert( r->next_.begin( ), l->next_.back( ) );
+            l->next_.pop_back( );
+        }
+        l->dirty_ = true;
+        r->dirty_ = true;
+    }
+
+    static
+    void rotate_ccw( dnode *parent, dnode *l, dnode *r, std::size_t pos )
+    {
+        l->values_.push_back( std::move(parent->values_[pos]) );
+        parent->values_[pos] = std::move(r->values_.front( ));
+        r->values_.erase( r->values_.begin( ) );
+
+        if( !l->is_leaf( ) ) {
+            l->next_.push_back( r->next_.front( ) );
+            r->next_.erase( r->next_.begin( ) );
+        }
+        l->dirty_ = true;
+        r->dirty_ = true;
+    }
+
+    void merge( dnode *parent, dnode *l, dnode *r, std::size_t pos )
+    {
+        l->values_.push_back( std::move(parent->values_[pos]) );
+        parent->values_.erase( parent->values_.begin( ) + pos );
+        parent->next_.erase( parent->next_.begin( ) + pos + 1 );
+
+        for( auto &v: r->values_ ) {
+            l->values_.push_back( std::move(v) );
+        }
+        l->next_.insert( l->next_.end( ), r->next_.begin( ), r->next_.end( ) );
+        l->dirty_ = true;
+
+        destroy_node( r );
+    }
+
+    data_source ds_;
+
+    std::size_t maximum_    = 0;
+    std::size_t middle_     = 0;
+    std::size_t minimum_    = 0;
+    std::size_t node_bytes_ = 0;
+
+    block_id    meta_ = 0;
+    block_id    root_ = 0;
+    std::size_t size_ = 0;
+
+    std::size_t cache_size_ = default_cache;
+    lru_list    lru_;
+    std::unordered_map<block_id, cache_entry> cache_;
+
+    std::vector<std::pair<dnode *, std::size_t> > path_;
+};
+
+}
+
+#endif // DISK_BTREE_H
@@ -2,12 +2,134 @@
 #define DYN_ARRAY_H
 
 #include <cstdint>
+#include <cstring>
+#include <new>
+#include <utility>
 #include <algorithm>
+#include <type_traits>
 
 namespace etool {
 
+    /// values that can be moved to another address by copying their bytes,
+    /// leaving the source slot raw; shifts and bulk moves of such values
+    /// are a single memmove.
+    /// Specialize for types that are relocatable without being
+    /// trivially copyable.
+    template <typename T>
+    struct is_trivially_relocatable: std::is_trivially_copyable<T> { };
+
+    /// std::pair has its own assignment, so it is never trivially copyable
+    template <typename A, typename B>
+    struct is_trivially_relocatable<std::pair<A, B> >
+        :std::integral_constant<bool, is_trivially_relocatable<A>::value &&
+                                      is_trivially_relocatable<B>::value>
+    { };
+
+namespace dyn_array_detail {
+
+    template <typename T>
+    using relocatable = std::integral_constant<bool,
+                                    is_trivially_relocatable<T>::value>;
+
+    template <typename T>
+    void relocate( T *dst, T *src, std::size_t count, std::true_type )
+    {
+        std::memmove( static_cast<void *>(dst),
+                      static_cast<const void *>(src), count * sizeof(T) );
+    }
+
+    template <typename T>
+    void relocate( T *dst, T *src, std::size_t count, std::false_type )
+    {
+        if( dst < src ) {
+            for( std::size_t i = 0; i < count; ++i ) {
+                new (dst + i) T(std::move(src[i]));
+                src[i].~T( );
+            }
+        } else if( dst > src ) {
+            for( auto i = count; i-- > 0; ) {
+                new (dst + i) T(std::move(src[i]));
+                src[i].~T( );
+            }
+        }
+    }
+
+    /// moves 'count' live values from 'src' to the raw slots at 'dst';
+    /// the ranges may overlap, what is left of the source is raw
+    template <typename T>
+    void relocate( T *dst, T *src, std::size_t count )
+    {
+        relocate( dst, src, count, relocatable<T>( ) );
+    }
+
+    /// 'Max' raw slots for T; the owner tracks which ones are live
+    template <typename T, std::size_t Max>
+    struct slots {
+
+        using slot_type = typename std::aligned_storage<sizeof(T),
+                                                        alignof(T)>::type;
+
+        T *data( )
+        {
+            return reinterpret_cast<T *>( &slots_[0] );
+        }
+
+        const T *data( ) const
+        {
+            return reinterpret_cast<const T *>( &slots_[0] );
+        }
+
+        template <typename... Args>
+        void construct( std::size_t pos, Args&&... args )
+        {
+            new (data( ) + pos) T(std::forward<Args>(args)...);
+        }
+
+        void destroy( std::size_t from, std::size_t to )
+        {
+            if( !std::is_trivially_destructible<T>::value ) {
+                auto d = data( );
+                for( auto i = from; i < to; ++i ) {
+                    d[i].~T( );
+                }
+            }
+        }
+
+        slot_type slots_[Max];
+    };
+
+    /// only [0, fill_) hold constructed values
+    /// Trivially destructible values keep the storage (and so the node
+    /// holding it) trivially destructible.
+    template <typename T, std::size_t Max,
+              bool Trivial = std::is_trivially_destructible<T>::value>
+    struct storage {
+
+        void destroy( std::size_t from )
+        {
+            vals_.destroy( from, fill_ );
+            fill_ = from;
+        }
+
+        std::size_t     fill_ = 0;
+        slots<T, Max>   vals_;
+    };
+
+    template <typename T, std::size_t Max>
+    struct storage<T, Max, false>: storage<T, Max, true> {
+
+        ~storage( )
+        {
+            this->destroy( 0 );
+        }
+    };
+
+}
+
+    /// fixed capacity array; storage is raw,
+    /// so only the live elements are ever constructed
     template <typename T, std::size_t Max>
-    struct dyn_array {
+    struct dyn_array: private dyn_array_detail::storage<T, Max> {
 
         using value_type      = T;
 
@@ -21,6 +143,18 @@ namespace etool {
 
         dyn_array(  ) = default;
 
+        dyn_array( const dyn_array &other )
+            :storage_type( )
+        {
+            operator = (other);
+        }
+
+        dyn_array( dyn_array &&other )
+            :storage_type( )
+        {
+            operator = (std::move(other));
+        }
+
         template <std::size_t S>
         dyn_array( const dyn_array<value_type, S> &other )
         {
@@ -30,64 +164,73 @@ namespace etool {
         template <std::size_t S>
         dyn_array( dyn_array<value_type, S> &&other )
         {
-            operator = (other);
+            operator = (std::move(other));
+        }
+
+        dyn_array& operator = ( const dyn_array &other )
+        {
+            if( this != &other ) {
+                assign( other.begin( ), other.end( ) );
+            }
+            return *this;
+        }
+
+        dyn_array& operator = ( dyn_array &&other )
+        {
+            if( this != &other ) {
+                assign_move( other.begin( ), other.end( ) );
+            }
+            return *this;
         }
 
         template <std::size_t S>
         dyn_array& operator = ( const dyn_array<value_type, S> &other )
         {
-            auto m = std::min(Max, S);
-            std::copy( other.begin( ), other.begin( ) + m, begin( ) );
-            fill_ = m;
+            assign( other.begin( ), other.end( ) );
             return *this;
         }
 
         template <std::size_t S>
         dyn_array& operator = ( dyn_array<value_type, S> &&other )
         {
-            auto m = std::min(Max, S);
-            fill_ = m;
-            while ( m-- ) {
-                vals_[m] = std::move(other[m]);
-            }
+            assign_move( other.begin( ), other.end( ) );
             return *this;
         }
 
         iterator begin( )
         {
-            return &vals_[0];
+            return data( );
         }
 
         iterator end( )
         {
-            return &vals_[fill_];
+            return data( ) + fill_;
         }
 
         const_iterator begin( ) const
         {
-            return &vals_[0];
+            return data( );
         }
 
         const_iterator end( ) const
         {
-            return &vals_[fill_];
+            return data( ) + fill_;
         }
 
         reference operator [ ](size_t pos )
         {
-            return vals_[pos];
+            return data( )[pos];
         }
 
         const_reference operator [ ](size_t pos ) const
         {
-            return vals_[pos];
+            return data( )[pos];
         }
 
+        /// assigns 'val' to every live element
         void fill( const value_type &val )
         {
-            for(std::size_t i=0; i<max_size( ); ++i ) {
-                vals_[i] = val;
-            }
+            std::fill( begin( ), end( ), val );
         }
 
         std::size_t size ( ) const
@@ -113,24 +256,29 @@ namespace etool {
 
         bool clear( )
         {
-            return fill_ = 0;
+            destroy( 0 );
+            return false;
         }
 
+        /// destroys the last 'count' elements
         void reduce( std::size_t count )
         {
-            fill_ -= count;
+            destroy( fill_ - count );
         }
 
         template<typename... Args>
         iterator emplace( const_iterator pos, Args&&... args )
         {
-            iterator last;
-            for( last = end( ); last != pos; --last ) {
-                *last = std::move( *(last - 1) );
+            auto p = begin( ) + (pos - begin( ));
+            if( p == end( ) ) {
+                construct( fill_, std::forward<Args>(args)...);
+            } else {
+                value_type tmp(std::forward<Args>(args)...);
+                dyn_array_detail::relocate( p + 1, p, end( ) - p );
+                new (p) value_type(std::move(tmp));
             }
-            *last = value_type(std::forward<Args>(args)...);
             fill_ ++;
-            return last;
+            return p;
         }
 
         iterator insert( const_iterator pos, value_type val )
@@ -140,11 +288,8 @@ namespace etool {
 
         iterator erase( iterator pos )
         {
-            for( auto tmp = pos; tmp != end( ); ++tmp ) {
-                if( tmp + 1 != end( ) ) {
-                    *tmp = std::move(*(tmp + 1));
-                }
-            }
+            pos->~value_type( );
+            dyn_array_detail::relocate( pos, pos + 1, end( ) - pos - 1 );
             --fill_;
             return pos;
         }
@@ -154,19 +299,26 @@ namespace etool {
             return erase( begin( ) + pos );
         }
 
+        /// moves the element out; the slot stays valid but unspecified
+        value_type take( std::size_t pos )
+        {
+            return std::move(data( )[pos]);
+        }
+
         value_type &front( )
         {
-            return vals_[0];
+            return data( )[0];
         }
 
         value_type &back( )
         {
-            return vals_[fill_ - 1];
+            return data( )[fill_ - 1];
         }
 
         void push_back( value_type val )
         {
-            vals_[fill_++] = std::move(val);
+            construct( fill_, std::move(val) );
+            ++fill_;
         }
 
         void push_front( value_type val )
@@ -174,34 +326,118 @@ namespace etool {
             emplace(begin( ), std::move(val));
         }
 
+        /// merges 'count' sorted values from 'b' into the sorted array
+        /// in one pass; before( val, elem ) tells whether 'val' goes
+        /// in front of 'elem'. There must be room for 'count' values.
+        template <typename ItrT, typename Before>
+        void merge( ItrT b, std::size_t count, Before before )
+        {
+            auto d = data( );
+
+            std::size_t dst = 0;
+            while( dst != fill_ && !before( *b, d[dst] ) ) {
+                ++dst;
+            }
+
+            /// the tail moves up by 'count';
+            /// [dst, src) stays raw while the merge fills it
+            std::size_t last = fill_ + count;
+            std::size_t src  = dst + count;
+            dyn_array_detail::relocate( d + src, d + dst, fill_ - dst );
+
+            while( count ) {
+                if( src != last && !before( *b, d[src] ) ) {
+                    dyn_array_detail::relocate( d + dst++, d + src++, 1 );
+                } else {
+                    construct( dst++, *b );
+                    ++b;
+                    --count;
+                }
+            }
+            fill_ = last;
+        }
+
+        /// moves [first, last) of 'other' in front of 'pos';
+        /// 'other' closes the gap. There must be room for the values
+        /// and 'other' must be another array.
+        template <std::size_t S>
+        void splice( std::size_t pos, dyn_array<value_type, S> &other,
+                     std::size_t first, std::size_t last )
+        {
+            using dyn_array_detail::relocate;
+
+            auto count = last - first;
+            auto d     = data( );
+            auto od    = other.begin( );
+            auto tail  = other.size( ) - last;
+
+            relocate( d + pos + count, d + pos, fill_ - pos );
+            relocate( d + pos, od + first, count );
+            relocate( od + first, od + last, tail );
+
+            fill_ += count;
+            other.forget( count );
+        }
+
+        /// moves [first, last) of 'other' to the end; see 'splice'
+        template <std::size_t S>
+        void append_range( dyn_array<value_type, S> &other,
+                           std::size_t first, std::size_t last )
+        {
+            splice( fill_, other, first, last );
+        }
+
+        /// replaces the content with [b, e); up to max_size( ) values
         template <typename ItrT>
         void assign( ItrT b, ItrT e )
         {
-            std::size_t count = 0;
-            while( (count != max_size( )) && (b != e) ) {
-                vals_[count++] = *(b++);
-            }
-            if( count != max_size( ) ) {
-                fill_ = count;
+            clear( );
+            while( (fill_ != max_size( )) && (b != e) ) {
+                push_back( *(b++) );
             }
         }
 
         template <typename ItrT>
         void assign_move( ItrT b, ItrT e )
         {
-            std::size_t count = 0;
-            while( (count != max_size( )) && (b != e) ) {
-                vals_[count++] = std::move(*(b++));
-            }
-            if( count != max_size( ) ) {
-                fill_ = count;
+            clear( );
+            while( (fill_ != max_size( )) && (b != e) ) {
+                push_back( std::move(*(b++)) );
             }
         }
 
     private:
 
-        std::size_t fill_ = 0;
-        value_type  vals_[maximum];
+        using storage_type = dyn_array_detail::storage<T, Max>;
+
+        using storage_type::fill_;
+        using storage_type::vals_;
+        using storage_type::destroy;
+
+        value_type *data( )
+        {
+            return vals_.data( );
+        }
+
+        const value_type *data( ) const
+        {
+            return vals_.data( );
+        }
+
+        template <typename... Args>
+        void construct( std::size_t pos, Args&&... args )
+        {
+            vals_.construct( pos, std::forward<Args>(args)...);
+        }
+
+        /// the last 'count' slots were relocated away
+        void forget( std::size_t count )
+        {
+            fill_ -= count;
+        }
+
+        template <typename, std::size_t>
+        friend struct dyn_array;
     };
 
 }
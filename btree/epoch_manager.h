@@ -0,0 +1,211 @@
+#ifndef EPOCH_MANAGER_H
+#define EPOCH_MANAGER_H
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <limits>
+#include <stdexcept>
+
+namespace etool {
+
+namespace epoch_detail {
+
+    /// small process-wide numbers for threads;
+    /// a number is given back when its thread exits
+    struct registry {
+
+        static
+        registry &instance( )
+        {
+            static registry inst;
+            return inst;
+        }
+
+        std::size_t acquire( )
+        {
+            std::lock_guard<std::mutex> lck(lock_);
+            if( !free_.empty( ) ) {
+                auto id = free_.back( );
+                free_.pop_back( );
+                return id;
+            }
+            return next_++;
+        }
+
+        void release( std::size_t id )
+        {
+            std::lock_guard<std::mutex> lck(lock_);
+            free_.push_back( id );
+        }
+
+    private:
+
+        std::mutex               lock_;
+        std::vector<std::size_t> free_;
+        std::size_t              next_ = 0;
+    };
+
+    struct thread_number {
+
+        thread_number( )
+            :id_(registry::instance( ).acquire( ))
+        { }
+
+        ~thread_number( )
+        {
+            registry::instance( ).release( id_ );
+        }
+
+        std::size_t id_;
+    };
+
+    inline
+    std::size_t this_thread( )
+    {
+        static thread_local thread_number num;
+        return num.id_;
+    }
+
+}
+
+    /// Epoch based reclamation.
+    /// Threads touch shared nodes only inside a 'guard'; a node unlinked
+    /// from the structure is 'retire'd and freed once every thread
+    /// that could still see it has left its guard.
+    /// Thread numbers are process-wide and reused after a thread exits;
+    /// a thread whose number is MaxThreads or more gets
+    /// std::length_error from 'guard' and 'retire', so at most
+    /// MaxThreads threads may be alive while one of them uses a manager.
+    template <std::size_t MaxThreads = 256>
+    struct epoch_manager {
+
+        using deleter_type = void (*)( void * );
+
+        static const std::size_t max_threads = MaxThreads;
+
+        /// retired nodes a thread collects before it tries to free them
+        static const std::size_t collect_threshold = 64;
+
+        struct guard {
+
+            explicit
+            guard( epoch_manager &mgr )
+                :mgr_(mgr)
+                ,slot_(mgr.enter( ))
+            { }
+
+            guard( const guard & ) = delete;
+            guard &operator = ( const guard & ) = delete;
+
+            ~guard( )
+            {
+                mgr_.leave( slot_ );
+            }
+
+        private:
+            epoch_manager &mgr_;
+            std::size_t    slot_;
+        };
+
+        epoch_manager( ) = default;
+
+        epoch_manager( const epoch_manager & ) = delete;
+        epoch_manager &operator = ( const epoch_manager & ) = delete;
+
+        /// no thread may be inside a guard
+        ~epoch_manager( )
+        {
+            for( auto &s: slots_ ) {
+                for( auto &r: s.retired_ ) {
+                    r.deleter_( r.ptr_ );
+                }
+            }
+        }
+
+        /// must be called inside a guard, after 'ptr' became unreachable
+        void retire( void *ptr, deleter_type deleter )
+        {
+            auto &s = slots_[slot_id( )];
+            s.retired_.push_back( retired { ptr, deleter, global_.load( ) } );
+            if( s.retired_.size( ) >= collect_threshold ) {
+                collect( s );
+            }
+        }
+
+    private:
+
+        static const std::uint64_t idle =
+                std::numeric_limits<std::uint64_t>::max( );
+
+        struct retired {
+            void          *ptr_;
+            deleter_type   deleter_;
+            std::uint64_t  epoch_;
+        };
+
+        struct alignas(64) slot {
+            std::atomic<std::uint64_t> epoch_ { idle };
+            std::size_t                depth_ = 0;
+            std::vector<retired>       retired_;
+        };
+
+        std::size_t slot_id( )
+        {
+            auto id = epoch_detail::this_thread( );
+            if( id >= MaxThreads ) {
+                throw std::length_error( "epoch_manager: too many threads" );
+            }
+            return id;
+        }
+
+        std::size_t enter( )
+        {
+            auto id = slot_id( );
+            auto &s = slots_[id];
+            if( s.depth_++ == 0 ) {
+                s.epoch_.store( global_.load( ) );
+                /// the epoch has to be visible before any node is read
+                std::atomic_thread_fence( std::memory_order_seq_cst );
+            }
+            return id;
+        }
+
+        void leave( std::size_t id )
+        {
+            auto &s = slots_[id];
+            if( --s.depth_ == 0 ) {
+                s.epoch_.store( idle, std::memory_order_release );
+            }
+        }
+
+        void collect( slot &s )
+        {
+            global_.fetch_add( 1 );
+
+            auto oldest = idle;
+            for( auto &o: slots_ ) {
+                auto e = o.epoch_.load( );
+                oldest = e < oldest ? e : oldest;
+            }
+
+            std::size_t kept = 0;
+            for( auto &r: s.retired_ ) {
+                if( r.epoch_ < oldest ) {
+                    r.deleter_( r.ptr_ );
+                } else {
+                    s.retired_[kept++] = r;
+                }
+            }
+            s.retired_.resize( kept );
+        }
+
+        std::atomic<std::uint64_t> global_ { 0 };
+        slot                       slots_[MaxThreads];
+    };
+
+}
+
+#endif // EPOCH_MANAGER_H
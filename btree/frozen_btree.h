@@ -0,0 +1,823 @@
+#ifndef FROZEN_BTREE_H
+#define FROZEN_BTREE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <memory>
+#include <iterator>
+#include <utility>
+#include <type_traits>
+
+#if defined(_WIN32)
+#   define ETOOL_FROZEN_MMAP 0
+#else
+#   define ETOOL_FROZEN_MMAP 1
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <fcntl.h>
+#   include <unistd.h>
+#endif
+
+#include "node_search.h"
+#include "node_sizing.h"
+#include "btree.h"
+
+namespace etool {
+
+namespace frozen_detail {
+
+    inline
+    void prefetch( const void *addr )
+    {
+#if defined(__GNUC__) || defined(__clang__)
+        __builtin_prefetch( addr );
+#elif defined(ETOOL_SEARCH_SSE2)
+        _mm_prefetch( static_cast<const char *>( addr ), _MM_HINT_T0 );
+#else
+        (void)addr;
+#endif
+    }
+
+    /// keys of one cache line; two at least
+    template <typename K>
+    struct block_for {
+        static const std::size_t fit   = sizing::cache_line / sizeof(K);
+        static const std::size_t value = fit > 2 ? fit : 2;
+    };
+
+    /// the mapped type of a map trait; a set has none
+    template <typename Trait, typename = void>
+    struct mapped_of {
+        static const bool value = false;
+        using type = char;
+    };
+
+    template <typename Trait>
+    struct mapped_of<Trait, typename std::conditional<true, void,
+                                    typename Trait::mapped_type>::type> {
+        static const bool value = true;
+        using type = typename Trait::mapped_type;
+    };
+
+    /// the first bytes of an image, in the byte order of the machine
+    /// that wrote it; 'order' tells whether it is this one
+    struct header {
+
+        static const std::uint32_t native  = 0x01020304;
+        static const std::uint32_t version = 1;
+
+        char          magic[4];
+        std::uint32_t order;
+        std::uint32_t format;
+        std::uint32_t key_bytes;
+        std::uint32_t mapped_bytes;
+        std::uint32_t block;
+        std::uint64_t count;
+        std::uint64_t keys;   ///< key slots of all the layers
+        std::uint64_t mapped; ///< offset of the mapped values
+        std::uint64_t bytes;  ///< of the whole image
+    };
+
+    static const std::size_t header_bytes = sizing::cache_line;
+    static_assert( sizeof(header) <= header_bytes, "Header is too big" );
+
+    inline
+    std::size_t align_up( std::size_t val )
+    {
+        return ( val + sizing::cache_line - 1 )
+             / sizing::cache_line * sizing::cache_line;
+    }
+
+    /// the bytes of an image: owned, or a read-only mapping of a file
+    struct storage {
+
+        storage( ) = default;
+
+        storage( const storage & ) = delete;
+        storage &operator = ( const storage & ) = delete;
+
+        storage( storage &&other )
+        {
+            swap( other );
+        }
+
+        storage &operator = ( storage &&other )
+        {
+            storage tmp( std::move(other) );
+            swap( tmp );
+            return *this;
+        }
+
+        ~storage( )
+        {
+#if ETOOL_FROZEN_MMAP
+            if( mapped_ ) {
+                ::munmap( const_cast<char *>( data_ ), size_ );
+            }
+#endif
+        }
+
+        void swap( storage &other )
+        {
+            std::swap( owned_,  other.owned_ );
+            std::swap( data_,   other.data_ );
+            std::swap( size_,   other.size_ );
+            std::swap( mapped_, other.mapped_ );
+        }
+
+        /// zeroed memory on a cache line boundary
+        static
+        storage allocate( std::size_t size )
+        {
+            storage res;
+            res.owned_.reset( new char[size + sizing::cache_line]( ) );
+            auto addr  = reinterpret_cast<std::uintptr_t>( res.owned_.get( ) );
+            auto shift = ( sizing::cache_line - addr % sizing::cache_line )
+                       % sizing::cache_line;
+            res.data_ = res.owned_.get( ) + shift;
+            res.size_ = size;
+            return res;
+        }
+
+        /// the file mapped as it is; read into memory where there
+        /// is no mmap. Empty if the file can't be read
+        static
+        storage map( const std::string &path )
+        {
+            storage res;
+#if ETOOL_FROZEN_MMAP
+            int fd = ::open( path.c_str( ), O_RDONLY );
+            if( fd < 0 ) {
+                return res;
+            }
+            struct stat st;
+            if( ::fstat( fd, &st ) == 0 && st.st_size > 0 ) {
+                auto size = static_cast<std::size_t>( st.st_size );
+                void *addr = ::mmap( nullptr, size, PROT_READ,
+                                     MAP_SHARED, fd, 0 );
+                if( addr != MAP_FAILED ) {
+                    res.data_   = static_cast<const char *>( addr );
+                    res.size_   = size;
+                    res.mapped_ = true;
+                }
+            }
+            ::close( fd );
+#else
+            FILE *file = fopen( path.c_str( ), "rb" );
+            if( !file ) {
+                return res;
+            }
+            fseek( file, 0, SEEK_END );
+            auto size = static_cast<std::size_t>( ftell( file ) );
+            fseek( file, 0, SEEK_SET );
+            auto tmp = allocate( size );
+            if( fread( tmp.writable( ), 1, size, file ) == size ) {
+                res.swap( tmp );
+            }
+            fclose( file );
+#endif
+            return res;
+        }
+
+        const char *data( ) const
+        {
+            return data_;
+        }
+
+        /// null for a mapped file
+        char *writable( )
+        {
+            return owned_.get( ) ? const_cast<char *>( data_ ) : nullptr;
+        }
+
+        std::size_t size( ) const
+        {
+            return size_;
+        }
+
+    private:
+
+        std::unique_ptr<char[]>  owned_;
+        const char              *data_   = nullptr;
+        std::size_t              size_   = 0;
+        bool                     mapped_ = false;
+    };
+}
+
+/// read-only image of a sorted set or map in one contiguous block of
+/// memory without pointers, a static B+tree with implicit links.
+/// The keys are laid out in layers of nodes of 'Block' keys (a cache
+/// line by default). The bottom layer is all the keys in order; every
+/// layer above has a separator for each but the first child of its
+/// nodes, and the children of node k are the nodes
+/// k * (Block + 1) ... k * (Block + 1) + Block one layer down.
+/// Mapped values of a map trait follow the keys, in key order.
+/// Lookups take one node per layer, searched without branches by the
+/// search policy of the trait; lower_bound_batch walks a few keys
+/// together and prefetches the next node of every one.
+/// Keys and mapped values have to be trivially copyable; the image is
+/// written in the byte order of the machine and 'open' maps it as is.
+template <typename ValueTrait,
+          std::size_t Block =
+                frozen_detail::block_for<
+                        typename ValueTrait::key_type>::value >
+struct frozen_btree {
+
+    static_assert( Block >= 2, "Block must be at least 2" );
+
+    using value_trait = ValueTrait;
+    using value_type  = typename value_trait::value_type;
+    using key_type    = typename value_trait::key_type;
+    using less_cmp    = typename value_trait::less;
+    using key_access  = typename value_trait::key_access;
+
+    static const bool has_mapped = frozen_detail::mapped_of<ValueTrait>::value;
+    using mapped_type = typename frozen_detail::mapped_of<ValueTrait>::type;
+
+    static_assert( std::is_trivially_copyable<key_type>::value,
+                   "Keys of a frozen tree must be trivially copyable" );
+    static_assert( std::is_trivially_copyable<mapped_type>::value,
+                   "Values of a frozen tree must be trivially copyable" );
+
+    static const std::size_t block = Block;
+
+    /// every layer has at most 1 / (Block + 1) of the nodes below
+    static const std::size_t max_height = 64;
+
+    using search_policy = typename search::select<
+                                        typename value_trait::search,
+                                        key_type, key_type, less_cmp,
+                                        Block>::type;
+
+    using reference = typename std::conditional<has_mapped,
+                            std::pair<const key_type &, const mapped_type &>,
+                            const key_type &>::type;
+
+    /// position in key order
+    struct const_iterator {
+
+        using iterator_category = std::random_access_iterator_tag;
+        using value_type        = typename frozen_btree::value_type;
+        using difference_type   = std::ptrdiff_t;
+        using reference         = typename frozen_btree::reference;
+        using pointer   = typename btree_detail::arrow<reference>::pointer;
+
+        const_iterator( ) = default;
+
+        const_iterator( const frozen_btree *tree, std::size_t pos )
+            :tree_(tree)
+            ,pos_(pos)
+        { }
+
+        reference operator * ( ) const
+        {
+            return tree_->at( pos_ );
+        }
+
+        pointer operator -> ( ) const
+        {
+            return btree_detail::arrow<reference>::make( **this );
+        }
+
+        reference operator [ ] ( difference_type off ) const
+        {
+            return *( *this + off );
+        }
+
+        const_iterator &operator ++ ( )
+        {
+            ++pos_;
+            return *this;
+        }
+
+        const_iterator &operator -- ( )
+        {
+            --pos_;
+            return *this;
+        }
+
+        const_iterator operator ++ ( int )
+        {
+            auto tmp = *this;
+            ++pos_;
+            return tmp;
+        }
+
+        const_iterator operator -- ( int )
+        {
+            auto tmp = *this;
+            --pos_;
+            return tmp;
+        }
+
+        const_iterator &operator += ( difference_type off )
+        {
+            pos_ += off;
+            return *this;
+        }
+
+        const_iterator &operator -= ( difference_type off )
+        {
+            pos_ -= off;
+            return *this;
+        }
+
+        const_iterator operator + ( difference_type off ) const
+        {
+            return const_iterator( tree_, pos_ + off );
+        }
+
+        const_iterator operator - ( difference_type off ) const
+        {
+            return const_iterator( tree_, pos_ - off );
+        }
+
+        difference_type operator - ( const const_iterator &other ) const
+        {
+            return static_cast<difference_type>( pos_ )
+                 - static_cast<difference_type>( other.pos_ );
+        }
+
+        bool operator == ( const const_iterator &other ) const
+        {
+            return pos_ == other.pos_;
+        }
+
+        bool operator != ( const const_iterator &other ) const
+        {
+            return pos_ != other.pos_;
+        }
+
+        bool operator < ( const const_iterator &other ) const
+        {
+            return pos_ < other.pos_;
+        }
+
+        /// the index in key order
+        std::size_t index( ) const
+        {
+            return pos_;
+        }
+
+    private:
+        const frozen_btree *tree_ = nullptr;
+        std::size_t         pos_  = 0;
+    };
+
+    using iterator = const_iterator;
+
+    frozen_btree( ) = default;
+
+    frozen_btree( const frozen_btree & ) = delete;
+    frozen_btree &operator = ( const frozen_btree & ) = delete;
+
+    frozen_btree( frozen_btree &&other )
+    {
+        swap( other );
+    }
+
+    frozen_btree &operator = ( frozen_btree &&other )
+    {
+        frozen_btree tmp( std::move(other) );
+        swap( tmp );
+        return *this;
+    }
+
+    /// the image of the sorted range [b, e)
+    template <typename ItrT>
+    frozen_btree( ItrT b, ItrT e )
+    {
+        build( b, static_cast<std::size_t>( std::distance( b, e ) ) );
+    }
+
+    void swap( frozen_btree &other )
+    {
+        storage_.swap( other.storage_ );
+        std::swap( count_,  other.count_ );
+        std::swap( height_, other.height_ );
+        std::swap( keys_,   other.keys_ );
+        std::swap( mapped_, other.mapped_ );
+        for( std::size_t i = 0; i < max_height; ++i ) {
+            std::swap( layers_[i], other.layers_[i] );
+        }
+    }
+
+    /// an image written by 'save'; not open if the file isn't one
+    /// of this key, mapped value and block size
+    static
+    frozen_btree open( const std::string &path )
+    {
+        frozen_btree res;
+        res.storage_ = frozen_detail::storage::map( path );
+        if( !res.setup( ) ) {
+            return frozen_btree( );
+        }
+        return res;
+    }
+
+    /// writes the image as it is in memory
+    bool save( const std::string &path ) const
+    {
+        if( !is_open( ) ) {
+            return false;
+        }
+        FILE *file = fopen( path.c_str( ), "wb" );
+        if( !file ) {
+            return false;
+        }
+        auto done = fwrite( storage_.data( ), 1, storage_.size( ), file );
+        bool res  = ( fclose( file ) == 0 ) && ( done == storage_.size( ) );
+        return res;
+    }
+
+    bool is_open( ) const
+    {
+        return storage_.data( ) != nullptr;
+    }
+
+    std::size_t size( ) const
+    {
+        return count_;
+    }
+
+    bool empty( ) const
+    {
+        return count_ == 0;
+    }
+
+    /// layers of keys
+    std::size_t height( ) const
+    {
+        return height_;
+    }
+
+    /// of the whole image
+    std::size_t bytes( ) const
+    {
+        return storage_.size( );
+    }
+
+    const_iterator begin( ) const
+    {
+        return const_iterator( this, 0 );
+    }
+
+    const_iterator end( ) const
+    {
+        return const_iterator( this, count_ );
+    }
+
+    const_iterator cbegin( ) const
+    {
+        return begin( );
+    }
+
+    const_iterator cend( ) const
+    {
+        return end( );
+    }
+
+    /// first element not less than 'key'
+    const_iterator lower_bound( const key_type &key ) const
+    {
+        return const_iterator( this, descend<false>( key ) );
+    }
+
+    /// first element greater than 'key'
+    const_iterator upper_bound( const key_type &key ) const
+    {
+        return const_iterator( this, descend<true>( key ) );
+    }
+
+    std::pair<const_iterator, const_iterator>
+    equal_range( const key_type &key ) const
+    {
+        return std::make_pair( lower_bound( key ), upper_bound( key ) );
+    }
+
+    const_iterator find( const key_type &key ) const
+    {
+        auto pos = descend<false>( key );
+        if( pos != count_ && !less( key, leaf( )[pos] ) ) {
+            return const_iterator( this, pos );
+        }
+        return end( );
+    }
+
+    bool contains( const key_type &key ) const
+    {
+        return find( key ) != end( );
+    }
+
+    /// lower_bound of every key of [b, e) to 'out', in order
+    /// The keys go down the layers in groups; the next node of every
+    /// key of a group is prefetched before any of them is searched,
+    /// so the misses of the group overlap.
+    template <typename ItrT, typename OutItr>
+    OutItr lower_bound_batch( ItrT b, ItrT e, OutItr out ) const
+    {
+        static const std::size_t group = 8;
+
+        key_type    keys[group];
+        std::size_t pos[group];
+        bool        past[group];
+
+        while( b != e ) {
+            std::size_t count = 0;
+            for( ; b != e && count < group; ++b, ++count ) {
+                keys[count] = *b;
+                pos[count]  = 0;
+                past[count] = count_ == 0
+                           || less( leaf( )[count_ - 1], keys[count] );
+            }
+
+            for( std::size_t h = height_; h > 1; --h ) {
+                auto layer = keys_ + layers_[h - 1];
+                auto below = keys_ + layers_[h - 2];
+                for( std::size_t i = 0; i < count; ++i ) {
+                    if( past[i] ) {
+                        continue;
+                    }
+                    pos[i] = pos[i] * ( Block + 1 )
+                           + lower_of( layer + pos[i] * Block, keys[i] );
+                    frozen_detail::prefetch( below + pos[i] * Block );
+                }
+            }
+
+            for( std::size_t i = 0; i < count; ++i ) {
+                std::size_t res = count_;
+                if( !past[i] ) {
+                    res = pos[i] * Block
+                        + lower_of( leaf( ) + pos[i] * Block, keys[i] );
+                }
+                *out++ = const_iterator( this, res );
+            }
+        }
+        return out;
+    }
+
+private:
+
+    using header = frozen_detail::header;
+
+    static
+    bool less( const key_type &l, const key_type &r )
+    {
+        return less_cmp( )( l, r );
+    }
+
+    static
+    std::size_t lower_of( const key_type *node, const key_type &key )
+    {
+        return search_policy::template
+               lower<search::identity, less_cmp>( node, Block, key );
+    }
+
+    static
+    std::size_t upper_of( const key_type *node, const key_type &key )
+    {
+        return search_policy::template
+               upper<search::identity, less_cmp>( node, Block, key );
+    }
+
+    static
+    std::size_t nodes_for( std::size_t keys )
+    {
+        return ( keys + Block - 1 ) / Block;
+    }
+
+    const key_type *leaf( ) const
+    {
+        return keys_ + layers_[0];
+    }
+
+    reference at( std::size_t pos ) const
+    {
+        return at( pos, std::integral_constant<bool, has_mapped>( ) );
+    }
+
+    reference at( std::size_t pos, std::false_type ) const
+    {
+        return leaf( )[pos];
+    }
+
+    reference at( std::size_t pos, std::true_type ) const
+    {
+        return reference( leaf( )[pos], mapped_[pos] );
+    }
+
+    /// the position of the first key not less (Upper: greater) than
+    /// 'key'. The slots past the last key hold a copy of it, so for
+    /// any key not past the last one they count as greater and the
+    /// search never leaves the nodes that exist
+    template <bool Upper>
+    std::size_t descend( const key_type &key ) const
+    {
+        if( count_ == 0 ) {
+            return 0;
+        }
+        const auto &last = leaf( )[count_ - 1];
+        if( Upper ? !less( key, last ) : less( last, key ) ) {
+            return count_;
+        }
+
+        std::size_t pos = 0;
+        for( std::size_t h = height_; h > 0; --h ) {
+            auto node = keys_ + layers_[h - 1] + pos * Block;
+            auto skip = Upper ? upper_of( node, key ) : lower_of( node, key );
+            pos = ( h > 1 ) ? pos * ( Block + 1 ) + skip
+                            : pos * Block + skip;
+        }
+        return pos;
+    }
+
+    /// the key slots of every layer, the bottom one first;
+    /// the number of layers
+    static
+    std::size_t shape( std::size_t count, std::size_t *slots )
+    {
+        if( count == 0 ) {
+            return 0;
+        }
+        std::size_t height = 0;
+        auto nodes = nodes_for( count );
+        slots[height++] = nodes * Block;
+        while( nodes > 1 ) {
+            nodes = ( nodes + Block ) / ( Block + 1 );
+            slots[height++] = nodes * Block;
+        }
+        return height;
+    }
+
+    /// the top layer goes first in the image,
+    /// the layers fill on the way down
+    void place( const std::size_t *slots )
+    {
+        std::size_t off = 0;
+        for( std::size_t h = height_; h > 0; --h ) {
+            layers_[h - 1] = off;
+            off += slots[h - 1];
+        }
+    }
+
+    template <typename ItrT>
+    void build( ItrT b, std::size_t count )
+    {
+        std::size_t slots[max_height];
+        auto height = shape( count, slots );
+
+        std::size_t keys = 0;
+        for( std::size_t h = 0; h < height; ++h ) {
+            keys += slots[h];
+        }
+
+        auto mapped = frozen_detail::align_up( frozen_detail::header_bytes
+                                             + keys * sizeof(key_type) );
+        auto bytes  = frozen_detail::align_up( mapped + ( has_mapped
+                                             ? count * sizeof(mapped_type)
+                                             : 0 ) );
+
+        storage_ = frozen_detail::storage::allocate( bytes );
+        auto data = storage_.writable( );
+
+        header head;
+        std::memset( &head, 0, sizeof(head) );
+        std::memcpy( head.magic, "EFRZ", 4 );
+        head.order        = header::native;
+        head.format       = header::version;
+        head.key_bytes    = sizeof(key_type);
+        head.mapped_bytes = has_mapped ? sizeof(mapped_type) : 0;
+        head.block        = Block;
+        head.count        = count;
+        head.keys         = keys;
+        head.mapped       = mapped;
+        head.bytes        = bytes;
+        std::memcpy( data, &head, sizeof(head) );
+
+        count_  = count;
+        height_ = height;
+        keys_   = reinterpret_cast<key_type *>(
+                                data + frozen_detail::header_bytes );
+        mapped_ = reinterpret_cast<mapped_type *>( data + mapped );
+        place( slots );
+
+        auto bottom = const_cast<key_type *>( leaf( ) );
+        auto values = const_cast<mapped_type *>( mapped_ );
+        for( std::size_t i = 0; i < count; ++i, ++b ) {
+            bottom[i] = key_access::get( *b );
+            put_mapped( values, i, *b,
+                        std::integral_constant<bool, has_mapped>( ) );
+        }
+        for( std::size_t i = count; height && i < slots[0]; ++i ) {
+            bottom[i] = bottom[count - 1];
+        }
+
+        /// separator i of node k in layer h is the first key under its
+        /// child i + 1: leftmost down to the node 'first' of the bottom
+        std::size_t span = 1;
+        for( std::size_t h = 1; h < height; ++h ) {
+            span *= Block + 1;
+            auto layer = const_cast<key_type *>( keys_ + layers_[h] );
+            for( std::size_t s = 0; s < slots[h]; ++s ) {
+                auto child = s / Block * ( Block + 1 ) + s % Block + 1;
+                auto first = child * ( span / ( Block + 1 ) ) * Block;
+                layer[s] = first < count ? bottom[first] : bottom[count - 1];
+            }
+        }
+    }
+
+    template <typename V>
+    static
+    void put_mapped( mapped_type *, std::size_t, const V &, std::false_type )
+    { }
+
+    template <typename V>
+    static
+    void put_mapped( mapped_type *values, std::size_t pos, const V &val,
+                     std::true_type )
+    {
+        values[pos] = val.second;
+    }
+
+    /// checks the header of a mapped image and finds the layers in it
+    bool setup( )
+    {
+        if( storage_.size( ) < frozen_detail::header_bytes ) {
+            return false;
+        }
+        auto data = storage_.data( );
+
+        header head;
+        std::memcpy( &head, data, sizeof(head) );
+        if( std::memcmp( head.magic, "EFRZ", 4 ) != 0
+         || head.order        != header::native
+         || head.format       != header::version
+         || head.key_bytes    != sizeof(key_type)
+         || head.mapped_bytes != ( has_mapped ? sizeof(mapped_type) : 0 )
+         || head.block        != Block
+         || head.bytes        != storage_.size( ) )
+        {
+            return false;
+        }
+
+        std::size_t slots[max_height];
+        auto height = shape( static_cast<std::size_t>( head.count ), slots );
+        std::size_t keys = 0;
+        for( std::size_t h = 0; h < height; ++h ) {
+            keys += slots[h];
+        }
+        auto end = head.mapped + ( has_mapped ? head.count
+                                              * sizeof(mapped_type) : 0 );
+        if( keys != head.keys
+         || frozen_detail::header_bytes + keys * sizeof(key_type)
+                                        > head.mapped
+         || end > head.bytes )
+        {
+            return false;
+        }
+
+        count_  = static_cast<std::size_t>( head.count );
+        height_ = height;
+        keys_   = reinterpret_cast<const key_type *>(
+                                data + frozen_detail::header_bytes );
+        mapped_ = reinterpret_cast<const mapped_type *>(
+                                data + head.mapped );
+        place( slots );
+        return true;
+    }
+
+    frozen_detail::storage  storage_;
+    std::size_t             count_  = 0;
+    std::size_t             height_ = 0;
+    const key_type         *keys_   = nullptr;
+    const mapped_type      *mapped_ = nullptr;
+    std::size_t             layers_[max_height] = { };
+};
+
+/// the live values of 'tree' as a frozen image; the tree stays
+template <std::size_t Block, typename ValueTrait, std::size_t NodeMax,
+          typename NodeAllocator, typename Stats, typename Summary,
+          typename Deletion>
+frozen_btree<ValueTrait, Block>
+freeze( const btree<ValueTrait, NodeMax, NodeAllocator,
+                    Stats, Summary, Deletion> &tree )
+{
+    return frozen_btree<ValueTrait, Block>( tree.begin( ), tree.end( ) );
+}
+
+template <typename ValueTrait, std::size_t NodeMax,
+          typename NodeAllocator, typename Stats, typename Summary,
+          typename Deletion>
+frozen_btree<ValueTrait>
+freeze( const btree<ValueTrait, NodeMax, NodeAllocator,
+                    Stats, Summary, Deletion> &tree )
+{
+    return frozen_btree<ValueTrait>( tree.begin( ), tree.end( ) );
+}
+
+}
+
+#endif // FROZEN_BTREE_H
@@ -0,0 +1,340 @@
+#ifndef NODE_ALLOCATOR_H
+#define NODE_ALLOCATOR_H
+
+#include <cstdint>
+#include <cstddef>
+#include <new>
+#include <vector>
+#include <utility>
+#include <iterator>
+#include <algorithm>
+
+namespace etool {
+
+    /// Node allocation policies for btree.
+    /// A policy provides 'pool<Node>' with create/destroy/clear;
+    /// the tree owns one pool and hands it every node it makes or drops.
+    /// 'balance' counts the nodes made minus those destroyed through
+    /// the pool, so the tree can tell what an operation gave back.
+    /// 'shared_nodes' tells whether nodes may be shared between trees
+    /// (see btree::snapshot).
+
+    /// every node is a separate new/delete
+    struct heap_allocator {
+
+        static const bool shared_nodes = false;
+
+        template <typename Node>
+        struct pool {
+
+            /// 'clear' doesn't free anything,
+            /// the tree has to destroy every node itself
+            static const bool release_all = false;
+
+            pool( ) = default;
+
+            pool( const pool & ) = delete;
+            pool &operator = ( const pool & ) = delete;
+
+            pool( pool && ) = default;
+            pool &operator = ( pool && ) = default;
+
+            Node *create( )
+            {
+                auto res = new Node;
+                ++balance_;
+                return res;
+            }
+
+            void destroy( Node *node )
+            {
+                delete node;
+                --balance_;
+            }
+
+            void clear( )
+            { }
+
+            std::ptrdiff_t balance( ) const
+            {
+                return balance_;
+            }
+
+            /// nothing is kept, 'destroy' gives every node back
+            std::size_t release_empty( )
+            {
+                return 0;
+            }
+
+        private:
+
+            std::ptrdiff_t balance_ = 0;
+        };
+    };
+
+    /// nodes are cut from chunks of 'ChunkBytes',
+    /// every slot starts on an 'Align' boundary (a cache line by default).
+    /// Freed slots are kept in a free list and reused first;
+    /// 'clear' drops all the chunks at once, 'release_empty' those
+    /// without a live node.
+    template <std::size_t ChunkBytes = 64 * 1024, std::size_t Align = 64>
+    struct slab_allocator {
+
+        static_assert( (Align & (Align - 1)) == 0,
+                       "Align must be a power of 2" );
+
+        static const bool shared_nodes = false;
+
+        template <typename Node>
+        struct pool {
+
+            static_assert( Align % alignof(Node) == 0,
+                           "Align is too weak for the node" );
+
+            /// 'clear' frees memory of all nodes;
+            /// the tree still has to call destructors if they do something
+            static const bool release_all = true;
+
+            static const std::size_t slot_size =
+                    ( ( sizeof(Node) > sizeof(void *) ? sizeof(Node)
+                                                      : sizeof(void *) )
+                      + Align - 1 ) / Align * Align;
+
+            static const std::size_t chunk_slots =
+                    ( ChunkBytes / slot_size ) ? ( ChunkBytes / slot_size ) : 1;
+
+            pool( ) = default;
+
+            pool( const pool & ) = delete;
+            pool &operator = ( const pool & ) = delete;
+
+            pool( pool &&other )
+            {
+                swap( other );
+            }
+
+            pool &operator = ( pool &&other )
+            {
+                clear( );
+                swap( other );
+                return *this;
+            }
+
+            ~pool( )
+            {
+                clear( );
+            }
+
+            void swap( pool &other )
+            {
+                std::swap( chunks_,  other.chunks_ );
+                std::swap( current_, other.current_ );
+                std::swap( used_,    other.used_ );
+                std::swap( free_,    other.free_ );
+                std::swap( balance_, other.balance_ );
+            }
+
+            Node *create( )
+            {
+                void *slot = free_;
+                if( slot ) {
+                    free_ = *static_cast<void **>( slot );
+                } else {
+                    slot = next_slot( );
+                }
+                ++balance_;
+                return new (slot) Node;
+            }
+
+            void destroy( Node *node )
+            {
+                node->~Node( );
+                void *slot = node;
+                *static_cast<void **>( slot ) = free_;
+                free_ = slot;
+                --balance_;
+            }
+
+            void clear( )
+            {
+                for( auto c: chunks_ ) {
+                    ::operator delete( c );
+                }
+                chunks_.clear( );
+                current_ = nullptr;
+                used_    = chunk_slots;
+                free_    = nullptr;
+                balance_ = 0;
+            }
+
+            std::ptrdiff_t balance( ) const
+            {
+                return balance_;
+            }
+
+            std::size_t chunks( ) const
+            {
+                return chunks_.size( );
+            }
+
+            /// gives the chunks whose slots are all free back to the
+            /// system; returns the bytes released.
+            /// A walk over the free list, which keeps its order
+            std::size_t release_empty( )
+            {
+                if( !free_ ) {
+                    return 0;
+                }
+
+                /// chunk starts in address order with their indexes
+                std::vector<std::pair<char *, std::size_t> > order;
+                order.reserve( chunks_.size( ) );
+                for( std::size_t i = 0; i < chunks_.size( ); ++i ) {
+                    order.push_back( std::make_pair( start_of( chunks_[i] ),
+                                                     i ) );
+                }
+                std::sort( order.begin( ), order.end( ) );
+
+                auto chunk_of = [&order]( void *slot ) {
+                    auto p = static_cast<char *>( slot );
+                    auto f = std::upper_bound( order.begin( ), order.end( ),
+                                    std::make_pair( p, std::size_t( -1 ) ) );
+                    return std::prev( f )->second;
+                };
+
+                std::vector<std::size_t> free_slots( chunks_.size( ), 0 );
+                for( auto s = free_; s; s = *static_cast<void **>( s ) ) {
+                    ++free_slots[chunk_of( s )];
+                }
+
+                std::vector<bool> empty( chunks_.size( ), false );
+                bool any = false;
+                for( std::size_t i = 0; i < chunks_.size( ); ++i ) {
+                    auto cur = start_of( chunks_[i] ) == current_;
+                    empty[i] = free_slots[i] == ( cur ? used_ : chunk_slots );
+                    any = any || empty[i];
+                }
+                if( !any ) {
+                    return 0;
+                }
+
+                void **link = &free_;
+                for( auto s = free_; s; s = *static_cast<void **>( s ) ) {
+                    if( !empty[chunk_of( s )] ) {
+                        *link = s;
+                        link  = static_cast<void **>( s );
+                    }
+                }
+                *link = nullptr;
+
+                std::size_t res  = 0;
+                std::size_t kept = 0;
+                for( std::size_t i = 0; i < chunks_.size( ); ++i ) {
+                    if( !empty[i] ) {
+                        chunks_[kept++] = chunks_[i];
+                        continue;
+                    }
+                    if( start_of( chunks_[i] ) == current_ ) {
+                        current_ = nullptr;
+                        used_    = chunk_slots;
+                    }
+                    ::operator delete( chunks_[i] );
+                    res += chunk_bytes;
+                }
+                chunks_.resize( kept );
+                return res;
+            }
+
+        private:
+
+            static const std::size_t chunk_bytes =
+                    chunk_slots * slot_size + Align - 1;
+
+            static
+            char *start_of( char *raw )
+            {
+                auto addr = reinterpret_cast<std::uintptr_t>( raw );
+                return raw + ( Align - addr % Align ) % Align;
+            }
+
+            void *next_slot( )
+            {
+                if( used_ == chunk_slots ) {
+                    chunks_.reserve( chunks_.size( ) + 1 );
+
+                    auto raw = static_cast<char *>(
+                                            ::operator new( chunk_bytes ) );
+                    chunks_.push_back( raw );
+
+                    current_  = start_of( raw );
+                    used_     = 0;
+                }
+                return current_ + slot_size * used_++;
+            }
+
+            std::vector<char *> chunks_;
+            char               *current_ = nullptr;
+            std::size_t         used_    = chunk_slots;
+            void               *free_    = nullptr;
+            std::ptrdiff_t      balance_ = 0;
+        };
+    };
+
+    /// nodes shared by a tree and its snapshots
+    /// Every node is a separate new/delete and counts its owners;
+    /// whichever tree lets go of a node last deletes it, from any thread.
+    /// The pool keeps no nodes, so a node may outlive the tree that made
+    /// it; its balance then stays up, the snapshot's pool goes down.
+    struct shared_allocator {
+
+        static const bool shared_nodes = true;
+
+        template <typename Node>
+        struct pool {
+
+            static const bool release_all = false;
+
+            pool( ) = default;
+
+            pool( const pool & ) = delete;
+            pool &operator = ( const pool & ) = delete;
+
+            pool( pool && ) = default;
+            pool &operator = ( pool && ) = default;
+
+            Node *create( )
+            {
+                auto res = new Node;
+                ++balance_;
+                return res;
+            }
+
+            void destroy( Node *node )
+            {
+                delete node;
+                --balance_;
+            }
+
+            void clear( )
+            { }
+
+            std::ptrdiff_t balance( ) const
+            {
+                return balance_;
+            }
+
+            /// nothing is kept, 'destroy' gives every node back
+            std::size_t release_empty( )
+            {
+                return 0;
+            }
+
+        private:
+
+            std::ptrdiff_t balance_ = 0;
+        };
+    };
+
+}
+
+#endif // NODE_ALLOCATOR_H
@@ -0,0 +1,243 @@
+#ifndef NODE_LAYOUT_H
+#define NODE_LAYOUT_H
+
+#include <cstdint>
+#include <cstring>
+#include <utility>
+
+#include "dyn_array.h"
+#include "soa_array.h"
+#include "prefix_array.h"
+#include "node_search.h"
+
+namespace etool { namespace layout {
+
+    /// How a btree node stores its values; chosen by the value trait.
+    /// A layout provides:
+    ///   array<Trait, Max>    the container for the node values
+    ///   search_value<Trait>  the element type the in-node search scans
+    ///   search_access<Trait> key access for that element
+    ///   search_base(arr)     pointer to the first scanned element
+    ///   key_result<Trait>    what key(arr, pos) returns
+    ///   key<Trait>(arr, pos) the key of the element at 'pos'
+    ///   lower_of/upper_of<Policy, Access, Less>(arr, key)
+    ///                        the in-node search
+    ///   less_at/greater_at/equal_at<Trait, Less>(arr, pos, key)
+    ///                        the element at 'pos' against 'key',
+    ///                        without building its key
+    ///   put(arr, pos, val)   overwrites the element at 'pos'
+
+    /// the elements are real objects the search scans in place
+    template <typename Layout>
+    struct direct {
+
+        template <typename Trait>
+        using key_result = const typename Trait::key_type &;
+
+        template <typename Trait, typename Array>
+        static
+        key_result<Trait> key( const Array &arr, std::size_t pos )
+        {
+            return Trait::key_access::get( arr[pos] );
+        }
+
+        template <typename Policy, typename Access, typename Less,
+                  typename Array, typename Key>
+        static
+        std::size_t lower_of( const Array &arr, const Key &key )
+        {
+            return Policy::template lower<Access, Less>(
+                            Layout::search_base( arr ), arr.size( ), key );
+        }
+
+        template <typename Policy, typename Access, typename Less,
+                  typename Array, typename Key>
+        static
+        std::size_t upper_of( const Array &arr, const Key &key )
+        {
+            return Policy::template upper<Access, Less>(
+                            Layout::search_base( arr ), arr.size( ), key );
+        }
+
+        template <typename Trait, typename Less, typename Array,
+                  typename Key>
+        static
+        bool less_at( const Array &arr, std::size_t pos, const Key &val )
+        {
+            return Less( )( key<Trait>( arr, pos ), val );
+        }
+
+        template <typename Trait, typename Less, typename Array,
+                  typename Key>
+        static
+        bool greater_at( const Array &arr, std::size_t pos, const Key &val )
+        {
+            return Less( )( val, key<Trait>( arr, pos ) );
+        }
+
+        template <typename Trait, typename Less, typename Array,
+                  typename Key>
+        static
+        bool equal_at( const Array &arr, std::size_t pos, const Key &val )
+        {
+            return !less_at<Trait, Less>( arr, pos, val )
+                && !greater_at<Trait, Less>( arr, pos, val );
+        }
+
+        template <typename Array, typename Value>
+        static
+        void put( Array &arr, std::size_t pos, Value &&val )
+        {
+            arr[pos] = std::forward<Value>(val);
+        }
+    };
+
+    /// whole values one after another;
+    /// a key comparison pulls the rest of the value into cache too
+    struct interleaved: direct<interleaved> {
+
+        template <typename Trait, std::size_t Max>
+        using array = dyn_array<typename Trait::value_type, Max>;
+
+        template <typename Trait>
+        using search_value = typename Trait::value_type;
+
+        template <typename Trait>
+        using search_access = typename Trait::key_access;
+
+        template <typename T, std::size_t Max>
+        static
+        const T *search_base( const dyn_array<T, Max> &arr )
+        {
+            return arr.begin( );
+        }
+    };
+
+    /// keys and mapped values in separate arrays (map_trait only);
+    /// the search scans packed keys, a mapped value is read on a hit
+    struct split: direct<split> {
+
+        template <typename Trait, std::size_t Max>
+        using array = soa_array<typename Trait::key_type,
+                                typename Trait::mapped_type, Max>;
+
+        template <typename Trait>
+        using search_value = typename Trait::key_type;
+
+        template <typename Trait>
+        using search_access = search::identity;
+
+        template <typename K, typename V, std::size_t Max>
+        static
+        const K *search_base( const soa_array<K, V, Max> &arr )
+        {
+            return arr.keys( );
+        }
+    };
+
+    /// std::string keys, prefix compressed per node (see prefix_array);
+    /// the search skips the shared prefix and scans suffixes only.
+    /// Keys are built on access, so key_result is a value.
+    struct prefix {
+
+        template <typename Trait, std::size_t Max>
+        using array = prefix_array<Max>;
+
+        template <typename Trait>
+        using search_value = typename Trait::key_type;
+
+        template <typename Trait>
+        using search_access = search::identity;
+
+        template <typename Trait>
+        using key_result = typename Trait::key_type;
+
+        template <typename Trait, std::size_t Max>
+        static
+        key_result<Trait> key( const prefix_array<Max> &arr, std::size_t pos )
+        {
+            return arr[pos];
+        }
+
+        /// a probe as bytes: std::string or anything else with
+        /// data( ) and size( ), or a C string. Transparent lookups
+        /// search with it as it is, no std::string is built
+        using bytes = std::pair<const char *, std::size_t>;
+
+        template <typename Key>
+        static
+        bytes bytes_of( const Key &key )
+        {
+            return bytes( key.data( ), key.size( ) );
+        }
+
+        static
+        bytes bytes_of( const char *key )
+        {
+            return bytes( key, std::strlen( key ) );
+        }
+
+        /// the byte order of the array is the only order;
+        /// the policy is not used
+        template <typename Policy, typename Access, typename Less,
+                  std::size_t Max, typename Key>
+        static
+        std::size_t lower_of( const prefix_array<Max> &arr, const Key &key )
+        {
+            auto probe = bytes_of( key );
+            return arr.lower_of( probe.first, probe.second );
+        }
+
+        template <typename Policy, typename Access, typename Less,
+                  std::size_t Max, typename Key>
+        static
+        std::size_t upper_of( const prefix_array<Max> &arr, const Key &key )
+        {
+            auto probe = bytes_of( key );
+            return arr.upper_of( probe.first, probe.second );
+        }
+
+        /// one byte comparison against the stored suffix;
+        /// 'Less' has to agree with the byte order
+        template <typename Trait, typename Less, std::size_t Max,
+                  typename Key>
+        static
+        bool less_at( const prefix_array<Max> &arr, std::size_t pos,
+                      const Key &val )
+        {
+            auto probe = bytes_of( val );
+            return arr.compare_to( pos, probe.first, probe.second ) < 0;
+        }
+
+        template <typename Trait, typename Less, std::size_t Max,
+                  typename Key>
+        static
+        bool greater_at( const prefix_array<Max> &arr, std::size_t pos,
+                         const Key &val )
+        {
+            auto probe = bytes_of( val );
+            return arr.compare_to( pos, probe.first, probe.second ) > 0;
+        }
+
+        template <typename Trait, typename Less, std::size_t Max,
+                  typename Key>
+        static
+        bool equal_at( const prefix_array<Max> &arr, std::size_t pos,
+                       const Key &val )
+        {
+            auto probe = bytes_of( val );
+            return arr.compare_to( pos, probe.first, probe.second ) == 0;
+        }
+
+        template <std::size_t Max>
+        static
+        void put( prefix_array<Max> &arr, std::size_t pos,
+                  const std::string &val )
+        {
+            arr.replace( pos, val );
+        }
+    };
+
+}}
+
+#endif // NODE_LAYOUT_H
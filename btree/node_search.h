@@ -0,0 +1,604 @@
+#ifndef NODE_SEARCH_H
+#define NODE_SEARCH_H
+
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+#include <type_traits>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#   define ETOOL_SEARCH_SSE2 1
+#   include <emmintrin.h>
+#endif
+
+#if defined(__AVX2__)
+#   define ETOOL_SEARCH_AVX2 1
+#   include <immintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+#   include <intrin.h>
+#endif
+
+namespace etool { namespace search {
+
+    /// In-node search policies.
+    /// Every policy has
+    ///     lower<KeyAccess, Less>( arr, length, key )
+    ///     upper<KeyAccess, Less>( arr, length, key )
+    /// which return the same positions as std::lower_bound/upper_bound.
+
+    struct identity {
+        template <typename T>
+        static
+        const T &get( const T &t )
+        {
+            return t;
+        }
+    };
+
+    /// plain binary search
+    struct binary {
+
+        template <typename KA, typename Less, typename V, typename K>
+        static
+        std::size_t lower( const V *arr, std::size_t length, const K &key )
+        {
+            std::size_t next = 0;
+            while( next < length ) {
+                std::size_t middle = next + ( ( length - next ) >> 1 );
+                if( Less( )( KA::get(arr[middle]), key ) ) {
+                    next = middle + 1;
+                } else {
+                    length = middle;
+                }
+            }
+            return next;
+        }
+
+        template <typename KA, typename Less, typename V, typename K>
+        static
+        std::size_t upper( const V *arr, std::size_t length, const K &key )
+        {
+            std::size_t next = 0;
+            while( next < length ) {
+                std::size_t middle = next + ( ( length - next ) >> 1 );
+                if( Less( )( key, KA::get(arr[middle]) ) ) {
+                    length = middle;
+                } else {
+                    next = middle + 1;
+                }
+            }
+            return next;
+        }
+    };
+
+    /// binary search without a data dependent branch;
+    /// the compiler turns the step into a conditional move
+    struct branchless {
+
+        template <typename KA, typename Less, typename V, typename K>
+        static
+        std::size_t lower( const V *arr, std::size_t length, const K &key )
+        {
+            if( length == 0 ) {
+                return 0;
+            }
+            const V *base = arr;
+            while( length > 1 ) {
+                std::size_t half = length >> 1;
+                base = Less( )( KA::get(base[half - 1]), key ) ? base + half
+                                                               : base;
+                length -= half;
+            }
+            return static_cast<std::size_t>( base - arr )
+                 + ( Less( )( KA::get(*base), key ) ? 1 : 0 );
+        }
+
+        template <typename KA, typename Less, typename V, typename K>
+        static
+        std::size_t upper( const V *arr, std::size_t length, const K &key )
+        {
+            if( length == 0 ) {
+                return 0;
+            }
+            const V *base = arr;
+            while( length > 1 ) {
+                std::size_t half = length >> 1;
+                base = Less( )( key, KA::get(base[half - 1]) ) ? base
+                                                               : base + half;
+                length -= half;
+            }
+            return static_cast<std::size_t>( base - arr )
+                 + ( Less( )( key, KA::get(*base) ) ? 0 : 1 );
+        }
+    };
+
+    /// counts the elements in front of the key;
+    /// no branches at all, good for small nodes
+    struct linear {
+
+        template <typename KA, typename Less, typename V, typename K>
+        static
+        std::size_t lower( const V *arr, std::size_t length, const K &key )
+        {
+            std::size_t res = 0;
+            for( std::size_t i = 0; i < length; ++i ) {
+                res += Less( )( KA::get(arr[i]), key ) ? 1 : 0;
+            }
+            return res;
+        }
+
+        template <typename KA, typename Less, typename V, typename K>
+        static
+        std::size_t upper( const V *arr, std::size_t length, const K &key )
+        {
+            std::size_t res = 0;
+            for( std::size_t i = 0; i < length; ++i ) {
+                res += Less( )( key, KA::get(arr[i]) ) ? 0 : 1;
+            }
+            return res;
+        }
+    };
+
+    namespace kernels {
+
+        inline
+        std::size_t popcount( unsigned mask )
+        {
+#if defined(_MSC_VER)
+            return __popcnt( mask );
+#else
+            return static_cast<std::size_t>( __builtin_popcount( mask ) );
+#endif
+        }
+
+        /// count_less(arr, n, key)    -> number of arr[i] <  key
+        /// count_greater(arr, n, key) -> number of arr[i] >  key
+        template <typename T>
+        struct scalar {
+
+            static
+            std::size_t count_less( const T *arr, std::size_t n, T key )
+            {
+                std::size_t res = 0;
+                for( std::size_t i = 0; i < n; ++i ) {
+                    res += ( arr[i] < key ) ? 1 : 0;
+                }
+                return res;
+            }
+
+            static
+            std::size_t count_greater( const T *arr, std::size_t n, T key )
+            {
+                std::size_t res = 0;
+                for( std::size_t i = 0; i < n; ++i ) {
+                    res += ( key < arr[i] ) ? 1 : 0;
+                }
+                return res;
+            }
+        };
+
+        /// 'supported' is false where only the scalar code exists
+        template <typename T>
+        struct vec: scalar<T> {
+            static const bool supported = false;
+        };
+
+        /// 'Ops' supplies lanes, load, set1, less_mask and greater_mask
+        template <typename T, typename Ops>
+        struct vec_impl {
+
+            static const bool supported = true;
+
+            static
+            std::size_t count_less( const T *arr, std::size_t n, T key )
+            {
+                std::size_t res = 0;
+                std::size_t i   = 0;
+                auto k = Ops::set1( key );
+                for( ; i + Ops::lanes <= n; i += Ops::lanes ) {
+                    res += popcount( Ops::less_mask( Ops::load(arr + i), k ) );
+                }
+                return res + scalar<T>::count_less( arr + i, n - i, key );
+            }
+
+            static
+            std::size_t count_greater( const T *arr, std::size_t n, T key )
+            {
+                std::size_t res = 0;
+                std::size_t i   = 0;
+                auto k = Ops::set1( key );
+                for( ; i + Ops::lanes <= n; i += Ops::lanes ) {
+                    res += popcount( Ops::greater_mask( Ops::load(arr + i),
+                                                        k ) );
+                }
+                return res + scalar<T>::count_greater( arr + i, n - i, key );
+            }
+        };
+
+#if defined(ETOOL_SEARCH_AVX2)
+
+        struct i32_ops {
+            static const std::size_t lanes = 8;
+            static __m256i load( const std::int32_t *p )
+            {
+                return _mm256_loadu_si256( reinterpret_cast<const __m256i *>(p) );
+            }
+            static __m256i set1( std::int32_t v )
+            {
+                return _mm256_set1_epi32( v );
+            }
+            static unsigned less_mask( __m256i a, __m256i k )
+            {
+                return static_cast<unsigned>( _mm256_movemask_ps(
+                            _mm256_castsi256_ps( _mm256_cmpgt_epi32( k, a ) ) ) );
+            }
+            static unsigned greater_mask( __m256i a, __m256i k )
+            {
+                return static_cast<unsigned>( _mm256_movemask_ps(
+                            _mm256_castsi256_ps( _mm256_cmpgt_epi32( a, k ) ) ) );
+            }
+        };
+
+        struct u32_ops {
+            static const std::size_t lanes = 8;
+            static __m256i flip( __m256i v )
+            {
+                return _mm256_xor_si256( v, _mm256_set1_epi32(
+                                 static_cast<int>( 0x80000000u ) ) );
+            }
+            static __m256i load( const std::uint32_t *p )
+            {
+                return flip( _mm256_loadu_si256(
+                                 reinterpret_cast<const __m256i *>(p) ) );
+            }
+            static __m256i set1( std::uint32_t v )
+            {
+                return flip( _mm256_set1_epi32( static_cast<int>(v) ) );
+            }
+            static unsigned less_mask( __m256i a, __m256i k )
+            {
+                return i32_ops::less_mask( a, k );
+            }
+            static unsigned greater_mask( __m256i a, __m256i k )
+            {
+                return i32_ops::greater_mask( a, k );
+            }
+        };
+
+        struct i64_ops {
+            static const std::size_t lanes = 4;
+            static __m256i load( const std::int64_t *p )
+            {
+                return _mm256_loadu_si256( reinterpret_cast<const __m256i *>(p) );
+            }
+            static __m256i set1( std::int64_t v )
+            {
+                return _mm256_set1_epi64x( v );
+            }
+            static unsigned less_mask( __m256i a, __m256i k )
+            {
+                return static_cast<unsigned>( _mm256_movemask_pd(
+                            _mm256_castsi256_pd( _mm256_cmpgt_epi64( k, a ) ) ) );
+            }
+            static unsigned greater_mask( __m256i a, __m256i k )
+            {
+                return static_cast<unsigned>( _mm256_movemask_pd(
+                            _mm256_castsi256_pd( _mm256_cmpgt_epi64( a, k ) ) ) );
+            }
+        };
+
+        struct u64_ops {
+            static const std::size_t lanes = 4;
+            static __m256i flip( __m256i v )
+            {
+                return _mm256_xor_si256( v, _mm256_set1_epi64x(
+                        static_cast<long long>( 0x8000000000000000ull ) ) );
+            }
+            static __m256i load( const std::uint64_t *p )
+            {
+                return flip( _mm256_loadu_si256(
+                                 reinterpret_cast<const __m256i *>(p) ) );
+            }
+            static __m256i set1( std::uint64_t v )
+            {
+                return flip( _mm256_set1_epi64x( static_cast<long long>(v) ) );
+            }
+            static unsigned less_mask( __m256i a, __m256i k )
+            {
+                return i64_ops::less_mask( a, k );
+            }
+            static unsigned greater_mask( __m256i a, __m256i k )
+            {
+                return i64_ops::greater_mask( a, k );
+            }
+        };
+
+        struct f32_ops {
+            static const std::size_t lanes = 8;
+            static __m256 load( const float *p )
+            {
+                return _mm256_loadu_ps( p );
+            }
+            static __m256 set1( float v )
+            {
+                return _mm256_set1_ps( v );
+            }
+            static unsigned less_mask( __m256 a, __m256 k )
+            {
+                return static_cast<unsigned>(
+                            _mm256_movemask_ps( _mm256_cmp_ps( a, k, _CMP_LT_OQ ) ) );
+            }
+            static unsigned greater_mask( __m256 a, __m256 k )
+            {
+                return static_cast<unsigned>(
+                            _mm256_movemask_ps( _mm256_cmp_ps( a, k, _CMP_GT_OQ ) ) );
+            }
+        };
+
+        struct f64_ops {
+            static const std::size_t lanes = 4;
+            static __m256d load( const double *p )
+            {
+                return _mm256_loadu_pd( p );
+            }
+            static __m256d set1( double v )
+            {
+                return _mm256_set1_pd( v );
+            }
+            static unsigned less_mask( __m256d a, __m256d k )
+            {
+                return static_cast<unsigned>(
+                            _mm256_movemask_pd( _mm256_cmp_pd( a, k, _CMP_LT_OQ ) ) );
+            }
+            static unsigned greater_mask( __m256d a, __m256d k )
+            {
+                return static_cast<unsigned>(
+                            _mm256_movemask_pd( _mm256_cmp_pd( a, k, _CMP_GT_OQ ) ) );
+            }
+        };
+
+        template <> struct vec<std::int32_t>:  vec_impl<std::int32_t,  i32_ops> { };
+        template <> struct vec<std::uint32_t>: vec_impl<std::uint32_t, u32_ops> { };
+        template <> struct vec<std::int64_t>:  vec_impl<std::int64_t,  i64_ops> { };
+        template <> struct vec<std::uint64_t>: vec_impl<std::uint64_t, u64_ops> { };
+        template <> struct vec<float>:         vec_impl<float,         f32_ops> { };
+        template <> struct vec<double>:        vec_impl<double,        f64_ops> { };
+
+#elif defined(ETOOL_SEARCH_SSE2)
+
+        /// SSE2 has no 64 bit integer compare; those stay scalar
+
+        struct i32_ops {
+            static const std::size_t lanes = 4;
+            static __m128i load( const std::int32_t *p )
+            {
+                return _mm_loadu_si128( reinterpret_cast<const __m128i *>(p) );
+            }
+            static __m128i set1( std::int32_t v )
+            {
+                return _mm_set1_epi32( v );
+            }
+            static unsigned less_mask( __m128i a, __m128i k )
+            {
+                return static_cast<unsigned>( _mm_movemask_ps(
+                            _mm_castsi128_ps( _mm_cmplt_epi32( a, k ) ) ) );
+            }
+            static unsigned greater_mask( __m128i a, __m128i k )
+            {
+                return static_cast<unsigned>( _mm_movemask_ps(
+                            _mm_castsi128_ps( _mm_cmpgt_epi32( a, k ) ) ) );
+            }
+        };
+
+        struct u32_ops {
+            static const std::size_t lanes = 4;
+            static __m128i flip( __m128i v )
+            {
+                return _mm_xor_si128( v, _mm_set1_epi32(
+                                 static_cast<int>( 0x80000000u ) ) );
+            }
+            static __m128i load( const std::uint32_t *p )
+            {
+                return flip( _mm_loadu_si128(
+                                 reinterpret_cast<const __m128i *>(p) ) );
+            }
+            static __m128i set1( std::uint32_t v )
+            {
+                return flip( _mm_set1_epi32( static_cast<int>(v) ) );
+            }
+            static unsigned less_mask( __m128i a, __m128i k )
+            {
+                return i32_ops::less_mask( a, k );
+            }
+            static unsigned greater_mask( __m128i a, __m128i k )
+            {
+                return i32_ops::greater_mask( a, k );
+            }
+        };
+
+        struct f32_ops {
+            static const std::size_t lanes = 4;
+            static __m128 load( const float *p )
+            {
+                return _mm_loadu_ps( p );
+            }
+            static __m128 set1( float v )
+            {
+                return _mm_set1_ps( v );
+            }
+            static unsigned less_mask( __m128 a, __m128 k )
+            {
+                return static_cast<unsigned>(
+                            _mm_movemask_ps( _mm_cmplt_ps( a, k ) ) );
+            }
+            static unsigned greater_mask( __m128 a, __m128 k )
+            {
+                return static_cast<unsigned>(
+                            _mm_movemask_ps( _mm_cmpgt_ps( a, k ) ) );
+            }
+        };
+
+        struct f64_ops {
+            static const std::size_t lanes = 2;
+            static __m128d load( const double *p )
+            {
+                return _mm_loadu_pd( p );
+            }
+            static __m128d set1( double v )
+            {
+                return _mm_set1_pd( v );
+            }
+            static unsigned less_mask( __m128d a, __m128d k )
+            {
+                return static_cast<unsigned>(
+                            _mm_movemask_pd( _mm_cmplt_pd( a, k ) ) );
+            }
+            static unsigned greater_mask( __m128d a, __m128d k )
+            {
+                return static_cast<unsigned>(
+                            _mm_movemask_pd( _mm_cmpgt_pd( a, k ) ) );
+            }
+        };
+
+        template <> struct vec<std::int32_t>:  vec_impl<std::int32_t,  i32_ops> { };
+        template <> struct vec<std::uint32_t>: vec_impl<std::uint32_t, u32_ops> { };
+        template <> struct vec<float>:         vec_impl<float,         f32_ops> { };
+        template <> struct vec<double>:        vec_impl<double,        f64_ops> { };
+
+#endif
+
+        /// the values are the keys and they are compared with plain '<'
+        template <typename V, typename K, typename Less>
+        struct applicable {
+            static const bool value =
+                    std::is_same<V, K>::value
+                 && ( std::is_same<Less, std::less<K> >::value
+#if __cplusplus >= 201402L
+                   || std::is_same<Less, std::less<> >::value
+#endif
+                    );
+        };
+
+    }
+
+    /// narrows the range with branchless steps
+    /// and counts the last 'window' elements with vector compares.
+    /// Falls back to 'branchless' when there are no kernels
+    /// for the key type or the comparator isn't std::less.
+    struct simd {
+
+        static const std::size_t window = 16;
+
+        template <typename KA, typename Less, typename V, typename K>
+        static
+        std::size_t lower( const V *arr, std::size_t length, const K &key )
+        {
+            return lower_impl<KA, Less>( arr, length, key,
+                                         dispatch<V, K, Less>( ) );
+        }
+
+        template <typename KA, typename Less, typename V, typename K>
+        static
+        std::size_t upper( const V *arr, std::size_t length, const K &key )
+        {
+            return upper_impl<KA, Less>( arr, length, key,
+                                         dispatch<V, K, Less>( ) );
+        }
+
+    private:
+
+        template <typename V, typename K, typename Less>
+        static
+        std::integral_constant<bool, kernels::applicable<V, K, Less>::value
+                                  && kernels::vec<V>::supported>
+        dispatch( )
+        {
+            return { };
+        }
+
+        template <typename KA, typename Less, typename V, typename K>
+        static
+        std::size_t lower_impl( const V *arr, std::size_t length,
+                                const K &key, std::false_type )
+        {
+            return branchless::lower<KA, Less>( arr, length, key );
+        }
+
+        template <typename KA, typename Less, typename V, typename K>
+        static
+        std::size_t upper_impl( const V *arr, std::size_t length,
+                                const K &key, std::false_type )
+        {
+            return branchless::upper<KA, Less>( arr, length, key );
+        }
+
+        /// invariant: the result is in [lo, lo + length]
+        template <typename KA, typename Less, typename V, typename K>
+        static
+        std::size_t lower_impl( const V *arr, std::size_t length,
+                                const K &key, std::true_type )
+        {
+            std::size_t lo = 0;
+            while( length > window ) {
+                std::size_t half = length >> 1;
+                lo += ( arr[lo + half - 1] < key ) ? half : 0;
+                length -= half;
+            }
+            return lo + kernels::vec<V>::count_less( arr + lo, length, key );
+        }
+
+        template <typename KA, typename Less, typename V, typename K>
+        static
+        std::size_t upper_impl( const V *arr, std::size_t length,
+                                const K &key, std::true_type )
+        {
+            std::size_t lo = 0;
+            while( length > window ) {
+                std::size_t half = length >> 1;
+                lo += ( key < arr[lo + half - 1] ) ? 0 : half;
+                length -= half;
+            }
+            return lo + length
+                 - kernels::vec<V>::count_greater( arr + lo, length, key );
+        }
+    };
+
+    /// picked by the tree from the key type and the node size
+    struct automatic { };
+
+    /// Policy -> the policy itself;
+    /// automatic -> simd where kernels exist, the counting loop for
+    /// small nodes of arithmetic keys, the branchless search for bigger
+    /// ones and the plain binary search for everything else
+    /// NodeMax == 0 means the length is not known in advance
+    template <typename Policy, typename V, typename K, typename Less,
+              std::size_t NodeMax>
+    struct select {
+        using type = Policy;
+    };
+
+    template <typename V, typename K, typename Less, std::size_t NodeMax>
+    struct select<automatic, V, K, Less, NodeMax> {
+
+        static const bool vector =
+                kernels::applicable<V, K, Less>::value
+             && kernels::vec<V>::supported;
+
+        static const bool small =
+                ( NodeMax != 0 ) && ( NodeMax <= simd::window );
+
+        using scalar = typename std::conditional<
+                          std::is_arithmetic<K>::value,
+                          typename std::conditional<small, linear,
+                                                    branchless>::type,
+                          binary>::type;
+
+        using type = typename std::conditional<vector, simd, scalar>::type;
+    };
+
+}}
+
+#endif // NODE_SEARCH_H
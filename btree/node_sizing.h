@@ -0,0 +1,122 @@
+#ifndef NODE_SIZING_H
+#define NODE_SIZING_H
+
+#include <cstdint>
+#include <cstddef>
+
+#include "dyn_array.h"
+
+namespace etool { namespace sizing {
+
+    /// Node footprints to size btree nodes for;
+    /// the slab allocator puts every node on a cache line boundary.
+    static const std::size_t cache_line = 64;
+    static const std::size_t page       = 4 * 1024;
+    static const std::size_t huge_page  = 2 * 1024 * 1024;
+
+namespace detail {
+
+    /// the members of btree::bnode for 'Trait' and 'NodeMax'
+    /// without any policy (refcount, summaries, tombstones)
+    template <typename Trait, std::size_t NodeMax>
+    struct node_shape {
+        typename Trait::layout::template array<Trait, NodeMax> values_;
+        dyn_array<void *, NodeMax + 1>                         next_;
+    };
+
+    /// Node::bytes<NodeMax>::value is the size of a node
+    template <typename Trait>
+    struct plain_node {
+        template <std::size_t NodeMax>
+        struct bytes {
+            static const std::size_t value =
+                    sizeof(node_shape<Trait, NodeMax>);
+        };
+    };
+
+    template <typename Node, std::size_t NodeMax>
+    struct node_bytes {
+        static const std::size_t value =
+                Node::template bytes<NodeMax>::value;
+    };
+
+    /// from 'NodeMax' up while one more slot still fits
+    template <typename Node, std::size_t Target, std::size_t NodeMax,
+              bool Up = ( node_bytes<Node, NodeMax + 1>::value <= Target )>
+    struct grow {
+        static const std::size_t value = NodeMax;
+    };
+
+    template <typename Node, std::size_t Target, std::size_t NodeMax>
+    struct grow<Node, Target, NodeMax, true> {
+        static const std::size_t value =
+                grow<Node, Target, NodeMax + 1>::value;
+    };
+
+    /// from 'NodeMax' down while it doesn't fit; never below 'Least'
+    template <typename Node, std::size_t Target, std::size_t NodeMax,
+              std::size_t Least,
+              bool Down = ( NodeMax > Least ) &&
+                          ( node_bytes<Node, NodeMax>::value > Target )>
+    struct shrink {
+        static const std::size_t value = NodeMax;
+    };
+
+    template <typename Node, std::size_t Target, std::size_t NodeMax,
+              std::size_t Least>
+    struct shrink<Node, Target, NodeMax, Least, true> {
+        static const std::size_t value =
+                shrink<Node, Target, NodeMax - 1, Least>::value;
+    };
+
+}
+
+    /// NodeMax for a btree of 'ValueTrait' whose nodes fit 'TargetBytes'
+    /// A node is 'NodeMax' value slots (in the layout of the trait)
+    /// and 'NodeMax + 1' child pointers. A linear estimate of the node
+    /// size gives the start, the exact sizes of the nearby shapes
+    /// (padding included) settle it.
+    /// 'Node' gives the size of a node for a NodeMax (see
+    /// detail::plain_node); sized_btree passes the real btree::bnode
+    /// so that policies adding per-node members are accounted for.
+    /// Targets below the smallest node give NodeMax 3 and 'fits' false.
+    template <typename ValueTrait, std::size_t TargetBytes,
+              typename Node = detail::plain_node<ValueTrait> >
+    struct btree_geometry {
+
+        static const std::size_t target_bytes = TargetBytes;
+        static const std::size_t smallest     = 3;
+
+    private:
+
+        static const std::size_t probe = 64;
+
+        static const std::size_t slot_bytes =
+                ( detail::node_bytes<Node, probe * 2>::value
+                - detail::node_bytes<Node, probe>::value ) / probe;
+
+        static const std::size_t fixed_bytes =
+                detail::node_bytes<Node, probe>::value
+              - slot_bytes * probe;
+
+        static const std::size_t estimate =
+                TargetBytes > fixed_bytes + slot_bytes * smallest
+                    ? ( TargetBytes - fixed_bytes ) / slot_bytes
+                    : smallest;
+
+    public:
+
+        static const std::size_t node_max =
+                detail::shrink<Node, TargetBytes,
+                    detail::grow<Node, TargetBytes, estimate>::value,
+                    smallest>::value;
+
+        static const std::size_t node_bytes =
+                detail::node_bytes<Node, node_max>::value;
+
+        static const bool fits = node_bytes <= TargetBytes;
+    };
+
+}}
+
+#endif // NODE_SIZING_H
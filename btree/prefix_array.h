@@ -0,0 +1,548 @@
+#ifndef PREFIX_ARRAY_H
+#define PREFIX_ARRAY_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <iterator>
+#include <utility>
+#include <algorithm>
+
+namespace etool {
+
+    /// sorted std::string values of one node, prefix compressed:
+    /// the prefix all of them share is kept once, the suffixes are
+    /// stored back to back in one buffer.
+    /// The order is the byte order of std::string (std::less).
+    /// Elements are built on access, so references are values;
+    /// use 'replace' to change one.
+    template <std::size_t Max>
+    struct prefix_array {
+
+        using value_type      = std::string;
+        using reference       = std::string;
+        using const_reference = std::string;
+
+        static const size_t maximum = Max;
+
+        struct const_iterator {
+
+            using iterator_category = std::random_access_iterator_tag;
+            using value_type        = std::string;
+            using difference_type   = std::ptrdiff_t;
+            using reference         = std::string;
+            using pointer           = void;
+
+            const_iterator( ) = default;
+
+            const_iterator( const prefix_array *arr, std::size_t pos )
+                :arr_(arr)
+                ,pos_(pos)
+            { }
+
+            reference operator * ( ) const
+            {
+                return (*arr_)[pos_];
+            }
+
+            const_iterator &operator ++ ( )
+            {
+                ++pos_;
+                return *this;
+            }
+
+            const_iterator &operator -- ( )
+            {
+                --pos_;
+                return *this;
+            }
+
+            const_iterator operator ++ ( int )
+            {
+                const_iterator tmp(*this);
+                ++pos_;
+                return tmp;
+            }
+
+            const_iterator operator -- ( int )
+            {
+                const_iterator tmp(*this);
+                --pos_;
+                return tmp;
+            }
+
+            const_iterator operator + ( difference_type n ) const
+            {
+                return const_iterator( arr_, pos_ + n );
+            }
+
+            const_iterator operator - ( difference_type n ) const
+            {
+                return const_iterator( arr_, pos_ - n );
+            }
+
+            difference_type operator - ( const const_iterator &o ) const
+            {
+                return static_cast<difference_type>( pos_ )
+                     - static_cast<difference_type>( o.pos_ );
+            }
+
+            bool operator == ( const const_iterator &other ) const
+            {
+                return pos_ == other.pos_;
+            }
+
+            bool operator != ( const const_iterator &other ) const
+            {
+                return pos_ != other.pos_;
+            }
+
+            const prefix_array *arr_ = nullptr;
+            std::size_t         pos_ = 0;
+        };
+
+        using iterator = const_iterator;
+
+        const_iterator begin( ) const
+        {
+            return const_iterator( this, 0 );
+        }
+
+        const_iterator end( ) const
+        {
+            return const_iterator( this, fill_ );
+        }
+
+        std::string operator [ ]( std::size_t pos ) const
+        {
+            std::string res;
+            res.reserve( prefix_.size( ) + suffix_size( pos ) );
+            res.append( prefix_ );
+            res.append( suffix( pos ), suffix_size( pos ) );
+            return res;
+        }
+
+        /// the shared part of all the values
+        const std::string &prefix( ) const
+        {
+            return prefix_;
+        }
+
+        /// bytes taken by the values; the node itself not included
+        std::size_t bytes( ) const
+        {
+            return prefix_.capacity( ) + bytes_.capacity( );
+        }
+
+        std::size_t size ( ) const
+        {
+            return fill_;
+        }
+
+        constexpr
+        std::size_t max_size ( ) const
+        {
+            return maximum;
+        }
+
+        bool empty( ) const
+        {
+            return size( ) == 0;
+        }
+
+        bool full( ) const
+        {
+            return size( ) == max_size( );
+        }
+
+        bool clear( )
+        {
+            prefix_.clear( );
+            bytes_.clear( );
+            fill_ = 0;
+            return false;
+        }
+
+        /// first value not less than 'key'
+        std::size_t lower_of( const std::string &key ) const
+        {
+            return bound_of<false>( key.data( ), key.size( ) );
+        }
+
+        std::size_t lower_of( const char *key, std::size_t len ) const
+        {
+            return bound_of<false>( key, len );
+        }
+
+        /// first value greater than 'key'
+        std::size_t upper_of( const std::string &key ) const
+        {
+            return bound_of<true>( key.data( ), key.size( ) );
+        }
+
+        std::size_t upper_of( const char *key, std::size_t len ) const
+        {
+            return bound_of<true>( key, len );
+        }
+
+        /// the value at 'pos' against 'key': less than, equal to or
+        /// greater than zero as the value is less, equal or greater;
+        /// the value is not built
+        int compare_to( std::size_t pos, const char *key,
+                        std::size_t len ) const
+        {
+            auto plen = prefix_.size( );
+            auto head = compare( prefix_.data( ), plen,
+                                 key, std::min( len, plen ) );
+            return head != 0 ? head : compare_at( pos, key, len );
+        }
+
+        std::string front( ) const
+        {
+            return (*this)[0];
+        }
+
+        std::string back( ) const
+        {
+            return (*this)[fill_ - 1];
+        }
+
+        /// a copy; the element stays
+        std::string take( std::size_t pos ) const
+        {
+            return (*this)[pos];
+        }
+
+        template<typename... Args>
+        iterator emplace( const_iterator pos, Args&&... args )
+        {
+            insert_at( pos.pos_, std::string(std::forward<Args>(args)...) );
+            return iterator( this, pos.pos_ );
+        }
+
+        iterator insert( const_iterator pos, std::string val )
+        {
+            insert_at( pos.pos_, val );
+            return iterator( this, pos.pos_ );
+        }
+
+        void push_back( const std::string &val )
+        {
+            insert_at( fill_, val );
+        }
+
+        void push_front( const std::string &val )
+        {
+            insert_at( 0, val );
+        }
+
+        /// overwrites the value at 'pos' in place; the order is up to
+        /// the caller, so the prefix is not extended here
+        void replace( std::size_t pos, const std::string &val )
+        {
+            start_prefix( val.data( ), val.size( ) );
+
+            auto at   = begin_of( pos );
+            auto len  = val.size( ) - prefix_.size( );
+            auto was  = suffix_size( pos );
+            bytes_.replace( at, was, val, prefix_.size( ), len );
+
+            for( auto i = pos; i < fill_; ++i ) {
+                ends_[i] = static_cast<std::uint32_t>( ends_[i] + len - was );
+            }
+        }
+
+        iterator erase_pos( std::size_t pos )
+        {
+            remove( pos, pos + 1 );
+            return iterator( this, pos );
+        }
+
+        void reduce( std::size_t count )
+        {
+            remove( fill_ - count, fill_ );
+        }
+
+        /// merges 'count' sorted values from 'b' in one pass;
+        /// a new value goes in front of the equal ones.
+        /// 'before' has to agree with the byte order, it isn't called.
+        template <typename ItrT, typename Before>
+        void merge( ItrT b, std::size_t count, Before )
+        {
+            /// the new prefix is shared by the old one
+            /// and by the first and the last new values
+            auto last = b;
+            std::advance( last, count - 1 );
+            const std::string &lo = *b;
+            const std::string &hi = *last;
+            start_prefix( lo.data( ), lo.size( ) );
+            fit_prefix( hi.data( ), hi.size( ) );
+
+            std::string bytes;
+            bytes.reserve( bytes_.size( ) + count * 16 );
+
+            std::size_t out = 0;
+            std::size_t old = 0;
+            std::uint32_t ends[Max];
+
+            while( count ) {
+                const std::string &val = *b;
+                if( old != fill_ &&
+                    compare_at( old, val.data( ), val.size( ) ) < 0 )
+                {
+                    bytes.append( suffix( old ), suffix_size( old ) );
+                    ++old;
+                } else {
+                    bytes.append( val, prefix_.size( ), std::string::npos );
+                    ++b;
+                    --count;
+                }
+                ends[out++] = static_cast<std::uint32_t>( bytes.size( ) );
+            }
+            for( ; old != fill_; ++old ) {
+                bytes.append( suffix( old ), suffix_size( old ) );
+                ends[out++] = static_cast<std::uint32_t>( bytes.size( ) );
+            }
+
+            bytes_.swap( bytes );
+            std::copy( ends, ends + out, ends_ );
+            fill_ = out;
+        }
+
+        /// moves [first, last) of 'other' in front of 'pos';
+        /// 'other' closes the gap
+        template <std::size_t S>
+        void splice( std::size_t pos, prefix_array<S> &other,
+                     std::size_t first, std::size_t last )
+        {
+            if( first == last ) {
+                return;
+            }
+
+            /// the values are sorted, so the first and the last
+            /// bound the prefix of the range
+            auto lo = other[first];
+            auto hi = other[last - 1];
+            start_prefix( lo.data( ), lo.size( ) );
+            fit_prefix( hi.data( ), hi.size( ) );
+
+            auto count = last - first;
+            std::string moved;
+            std::uint32_t ends[S];
+            for( std::size_t i = first; i < last; ++i ) {
+                auto val = other[i];
+                moved.append( val, prefix_.size( ), std::string::npos );
+                ends[i - first] = static_cast<std::uint32_t>( moved.size( ) );
+            }
+
+            auto at = begin_of( pos );
+            bytes_.insert( at, moved );
+            std::copy_backward( ends_ + pos, ends_ + fill_,
+                                ends_ + fill_ + count );
+            for( std::size_t i = 0; i < count; ++i ) {
+                ends_[pos + i] = static_cast<std::uint32_t>( at + ends[i] );
+            }
+            for( auto i = pos + count; i < fill_ + count; ++i ) {
+                ends_[i] += static_cast<std::uint32_t>( moved.size( ) );
+            }
+            fill_ += count;
+
+            other.remove( first, last );
+        }
+
+        template <std::size_t S>
+        void append_range( prefix_array<S> &other,
+                           std::size_t first, std::size_t last )
+        {
+            splice( fill_, other, first, last );
+        }
+
+    private:
+
+        template <std::size_t>
+        friend struct prefix_array;
+
+        std::size_t begin_of( std::size_t pos ) const
+        {
+            return pos ? ends_[pos - 1] : 0;
+        }
+
+        const char *suffix( std::size_t pos ) const
+        {
+            return bytes_.data( ) + begin_of( pos );
+        }
+
+        std::size_t suffix_size( std::size_t pos ) const
+        {
+            return ends_[pos] - begin_of( pos );
+        }
+
+        static
+        int compare( const char *l, std::size_t ll,
+                     const char *r, std::size_t rl )
+        {
+            auto res = std::memcmp( l, r, std::min( ll, rl ) );
+            if( res != 0 ) {
+                return res;
+            }
+            return ll < rl ? -1 : ( ll > rl ? 1 : 0 );
+        }
+
+        /// compares the value at 'pos' to a key that starts
+        /// with the prefix
+        int compare_at( std::size_t pos, const char *key,
+                        std::size_t len ) const
+        {
+            auto skip = prefix_.size( );
+            return compare( suffix( pos ), suffix_size( pos ),
+                            key + skip, len - skip );
+        }
+
+        /// the prefix is compared once,
+        /// the search runs over the suffixes only
+        template <bool Upper>
+        std::size_t bound_of( const char *key, std::size_t len ) const
+        {
+            if( fill_ == 0 ) {
+                return 0;
+            }
+
+            auto plen = prefix_.size( );
+            auto head = compare( key, std::min( len, plen ),
+                                 prefix_.data( ), plen );
+            if( head < 0 ) {
+                return 0;
+            } else if( head > 0 ) {
+                return fill_;
+            }
+
+            std::size_t next   = 0;
+            std::size_t length = fill_;
+            while( next < length ) {
+                std::size_t middle = next + ( ( length - next ) >> 1 );
+                auto c = compare_at( middle, key, len );
+                if( Upper ? c <= 0 : c < 0 ) {
+                    next = middle + 1;
+                } else {
+                    length = middle;
+                }
+            }
+            return next;
+        }
+
+        /// shrinks the prefix to the part it shares with 'val';
+        /// the cut part goes back in front of every suffix
+        void fit_prefix( const char *val, std::size_t len )
+        {
+            std::size_t common = 0;
+            auto top = std::min( len, prefix_.size( ) );
+            while( common < top && prefix_[common] == val[common] ) {
+                ++common;
+            }
+            if( common == prefix_.size( ) ) {
+                return;
+            }
+
+            auto cut = prefix_.size( ) - common;
+            std::string bytes;
+            bytes.reserve( bytes_.size( ) + fill_ * cut );
+            std::size_t from = 0;
+            for( std::size_t i = 0; i < fill_; ++i ) {
+                bytes.append( prefix_, common, cut );
+                bytes.append( bytes_, from, ends_[i] - from );
+                from     = ends_[i];
+                ends_[i] = static_cast<std::uint32_t>( bytes.size( ) );
+            }
+            bytes_.swap( bytes );
+            prefix_.resize( common );
+        }
+
+        /// an empty array takes all of 'val' as its prefix
+        void start_prefix( const char *val, std::size_t len )
+        {
+            if( fill_ == 0 ) {
+                prefix_.assign( val, len );
+                bytes_.clear( );
+            } else {
+                fit_prefix( val, len );
+            }
+        }
+
+        /// grows the prefix by what the first and the last suffixes share
+        void tighten( )
+        {
+            if( fill_ == 0 ) {
+                clear( );
+                return;
+            }
+
+            auto first = suffix( 0 );
+            auto last  = suffix( fill_ - 1 );
+            auto top   = std::min( suffix_size( 0 ),
+                                   suffix_size( fill_ - 1 ) );
+            std::size_t extra = 0;
+            while( extra < top && first[extra] == last[extra] ) {
+                ++extra;
+            }
+            if( extra == 0 ) {
+                return;
+            }
+
+            prefix_.append( first, extra );
+            std::string bytes;
+            bytes.reserve( bytes_.size( ) - fill_ * extra );
+            std::size_t from = 0;
+            for( std::size_t i = 0; i < fill_; ++i ) {
+                bytes.append( bytes_, from + extra, ends_[i] - from - extra );
+                from     = ends_[i];
+                ends_[i] = static_cast<std::uint32_t>( bytes.size( ) );
+            }
+            bytes_.swap( bytes );
+        }
+
+        void insert_at( std::size_t pos, const std::string &val )
+        {
+            start_prefix( val.data( ), val.size( ) );
+
+            auto at  = begin_of( pos );
+            auto len = val.size( ) - prefix_.size( );
+            bytes_.insert( at, val, prefix_.size( ), len );
+
+            std::copy_backward( ends_ + pos, ends_ + fill_,
+                                ends_ + fill_ + 1 );
+            ends_[pos] = static_cast<std::uint32_t>( at + len );
+            for( auto i = pos + 1; i <= fill_; ++i ) {
+                ends_[i] += static_cast<std::uint32_t>( len );
+            }
+            ++fill_;
+        }
+
+        /// drops [first, last); removing an end may lengthen the prefix
+        void remove( std::size_t first, std::size_t last )
+        {
+            auto from = begin_of( first );
+            auto to   = begin_of( last );
+            auto len  = to - from;
+            bytes_.erase( from, len );
+
+            std::copy( ends_ + last, ends_ + fill_, ends_ + first );
+            fill_ -= last - first;
+            for( auto i = first; i < fill_; ++i ) {
+                ends_[i] -= static_cast<std::uint32_t>( len );
+            }
+
+            if( first == 0 || first == fill_ ) {
+                tighten( );
+            }
+        }
+
+        std::size_t   fill_ = 0;
+        std::string   prefix_;
+        std::string   bytes_;
+        std::uint32_t ends_[Max];
+    };
+
+}
+
+#endif // PREFIX_ARRAY_H
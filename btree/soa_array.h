@@ -0,0 +1,484 @@
+#ifndef SOA_ARRAY_H
+#define SOA_ARRAY_H
+
+#include <cstdint>
+#include <cstddef>
+#include <iterator>
+#include <utility>
+#include <algorithm>
+#include <type_traits>
+
+#include "dyn_array.h"
+
+namespace etool {
+
+namespace soa_array_detail {
+
+    /// raw key and value slots; only [0, fill_) are constructed
+    /// see dyn_array_detail::storage
+    template <typename K, typename V, std::size_t Max,
+              bool Trivial = std::is_trivially_destructible<K>::value &&
+                             std::is_trivially_destructible<V>::value>
+    struct storage {
+
+        void destroy( std::size_t from )
+        {
+            keys_.destroy( from, fill_ );
+            vals_.destroy( from, fill_ );
+            fill_ = from;
+        }
+
+        std::size_t                     fill_ = 0;
+        dyn_array_detail::slots<K, Max> keys_;
+        dyn_array_detail::slots<V, Max> vals_;
+    };
+
+    template <typename K, typename V, std::size_t Max>
+    struct storage<K, V, Max, false>: storage<K, V, Max, true> {
+
+        ~storage( )
+        {
+            this->destroy( 0 );
+        }
+    };
+
+}
+
+    /// dyn_array of std::pair<K, V> that keeps keys and mapped values
+    /// in two separate arrays.
+    /// Elements are reached through proxies: std::pair<K &, V &>
+    /// (std::pair<const K &, const V &> for const access).
+    /// Copying a proxy into a value_type copies; use 'take' to move out.
+    template <typename K, typename V, std::size_t Max>
+    struct soa_array: private soa_array_detail::storage<K, V, Max> {
+
+        using key_type        = K;
+        using mapped_type     = V;
+        using value_type      = std::pair<K, V>;
+
+        using reference       = std::pair<K &, V &>;
+        using const_reference = std::pair<const K &, const V &>;
+
+        static const size_t maximum = Max;
+
+        template <typename ArrT, typename RefT>
+        struct basic_iterator {
+
+            using iterator_category = std::random_access_iterator_tag;
+            using value_type        = typename soa_array::value_type;
+            using difference_type   = std::ptrdiff_t;
+            using reference         = RefT;
+            using pointer           = void;
+
+            basic_iterator( ) = default;
+
+            basic_iterator( ArrT *arr, std::size_t pos )
+                :arr_(arr)
+                ,pos_(pos)
+            { }
+
+            template <typename A, typename R>
+            basic_iterator( const basic_iterator<A, R> &other )
+                :arr_(other.arr_)
+                ,pos_(other.pos_)
+            { }
+
+            reference operator * ( ) const
+            {
+                return (*arr_)[pos_];
+            }
+
+            reference operator [ ] ( difference_type n ) const
+            {
+                return (*arr_)[pos_ + n];
+            }
+
+            basic_iterator &operator ++ ( )
+            {
+                ++pos_;
+                return *this;
+            }
+
+            basic_iterator &operator -- ( )
+            {
+                --pos_;
+                return *this;
+            }
+
+            basic_iterator operator ++ ( int )
+            {
+                basic_iterator tmp(*this);
+                ++pos_;
+                return tmp;
+            }
+
+            basic_iterator operator -- ( int )
+            {
+                basic_iterator tmp(*this);
+                --pos_;
+                return tmp;
+            }
+
+            basic_iterator &operator += ( difference_type n )
+            {
+                pos_ += n;
+                return *this;
+            }
+
+            basic_iterator &operator -= ( difference_type n )
+            {
+                pos_ -= n;
+                return *this;
+            }
+
+            basic_iterator operator + ( difference_type n ) const
+            {
+                return basic_iterator( arr_, pos_ + n );
+            }
+
+            basic_iterator operator - ( difference_type n ) const
+            {
+                return basic_iterator( arr_, pos_ - n );
+            }
+
+            template <typename A, typename R>
+            difference_type operator - ( const basic_iterator<A, R> &o ) const
+            {
+                return static_cast<difference_type>( pos_ )
+                     - static_cast<difference_type>( o.pos_ );
+            }
+
+            template <typename A, typename R>
+            bool operator == ( const basic_iterator<A, R> &other ) const
+            {
+                return pos_ == other.pos_;
+            }
+
+            template <typename A, typename R>
+            bool operator != ( const basic_iterator<A, R> &other ) const
+            {
+                return pos_ != other.pos_;
+            }
+
+            template <typename A, typename R>
+            bool operator < ( const basic_iterator<A, R> &other ) const
+            {
+                return pos_ < other.pos_;
+            }
+
+            ArrT        *arr_ = nullptr;
+            std::size_t  pos_ = 0;
+        };
+
+        using iterator       = basic_iterator<soa_array, reference>;
+        using const_iterator = basic_iterator<const soa_array,
+                                              const_reference>;
+
+        soa_array( ) = default;
+
+        soa_array( const soa_array &other )
+            :storage_type( )
+        {
+            operator = (other);
+        }
+
+        soa_array( soa_array &&other )
+            :storage_type( )
+        {
+            operator = (std::move(other));
+        }
+
+        soa_array &operator = ( const soa_array &other )
+        {
+            if( this != &other ) {
+                clear( );
+                for( std::size_t i = 0; i < other.size( ); ++i ) {
+                    keys_.construct( i, other.key_data( )[i] );
+                    vals_.construct( i, other.val_data( )[i] );
+                }
+                fill_ = other.size( );
+            }
+            return *this;
+        }
+
+        soa_array &operator = ( soa_array &&other )
+        {
+            if( this != &other ) {
+                clear( );
+                for( std::size_t i = 0; i < other.size( ); ++i ) {
+                    keys_.construct( i, std::move(other.key_data( )[i]) );
+                    vals_.construct( i, std::move(other.val_data( )[i]) );
+                }
+                fill_ = other.size( );
+            }
+            return *this;
+        }
+
+        iterator begin( )
+        {
+            return iterator( this, 0 );
+        }
+
+        iterator end( )
+        {
+            return iterator( this, fill_ );
+        }
+
+        const_iterator begin( ) const
+        {
+            return const_iterator( this, 0 );
+        }
+
+        const_iterator end( ) const
+        {
+            return const_iterator( this, fill_ );
+        }
+
+        reference operator [ ](size_t pos )
+        {
+            return reference( key_data( )[pos], val_data( )[pos] );
+        }
+
+        const_reference operator [ ](size_t pos ) const
+        {
+            return const_reference( key_data( )[pos], val_data( )[pos] );
+        }
+
+        /// the dense key array; what the node search runs over
+        const key_type *keys( ) const
+        {
+            return key_data( );
+        }
+
+        const mapped_type *values( ) const
+        {
+            return val_data( );
+        }
+
+        std::size_t size ( ) const
+        {
+            return fill_;
+        }
+
+        constexpr
+        std::size_t max_size ( ) const
+        {
+            return maximum;
+        }
+
+        bool empty( ) const
+        {
+            return size( ) == 0;
+        }
+
+        bool full( ) const
+        {
+            return size( ) == max_size( );
+        }
+
+        bool clear( )
+        {
+            destroy( 0 );
+            return false;
+        }
+
+        /// destroys the last 'count' elements
+        void reduce( std::size_t count )
+        {
+            destroy( fill_ - count );
+        }
+
+        template<typename... Args>
+        iterator emplace( const_iterator pos, Args&&... args )
+        {
+            using dyn_array_detail::relocate;
+
+            value_type val(std::forward<Args>(args)...);
+            std::size_t p = pos.pos_;
+            auto k = key_data( );
+            auto v = val_data( );
+            relocate( k + p + 1, k + p, fill_ - p );
+            relocate( v + p + 1, v + p, fill_ - p );
+            construct( p, std::move(val) );
+            fill_ ++;
+            return iterator( this, p );
+        }
+
+        iterator insert( const_iterator pos, value_type val )
+        {
+            return emplace(pos, std::move(val));
+        }
+
+        iterator erase( iterator pos )
+        {
+            return erase_pos( pos.pos_ );
+        }
+
+        iterator erase_pos( std::size_t pos )
+        {
+            using dyn_array_detail::relocate;
+
+            auto k = key_data( );
+            auto v = val_data( );
+            keys_.destroy( pos, pos + 1 );
+            vals_.destroy( pos, pos + 1 );
+            relocate( k + pos, k + pos + 1, fill_ - pos - 1 );
+            relocate( v + pos, v + pos + 1, fill_ - pos - 1 );
+            --fill_;
+            return iterator( this, pos );
+        }
+
+        /// moves the element out; the slot stays valid but unspecified
+        value_type take( std::size_t pos )
+        {
+            return value_type( std::move(key_data( )[pos]),
+                               std::move(val_data( )[pos]) );
+        }
+
+        reference front( )
+        {
+            return (*this)[0];
+        }
+
+        reference back( )
+        {
+            return (*this)[fill_ - 1];
+        }
+
+        void push_back( value_type val )
+        {
+            construct( fill_, std::move(val) );
+            ++fill_;
+        }
+
+        void push_front( value_type val )
+        {
+            emplace(begin( ), std::move(val));
+        }
+
+        /// see dyn_array::merge
+        template <typename ItrT, typename Before>
+        void merge( ItrT b, std::size_t count, Before before )
+        {
+            using dyn_array_detail::relocate;
+
+            auto k = key_data( );
+            auto v = val_data( );
+
+            std::size_t dst = 0;
+            while( dst != fill_ && !before( *b, (*this)[dst] ) ) {
+                ++dst;
+            }
+
+            std::size_t last = fill_ + count;
+            std::size_t src  = dst + count;
+            relocate( k + src, k + dst, fill_ - dst );
+            relocate( v + src, v + dst, fill_ - dst );
+
+            while( count ) {
+                if( src != last && !before( *b, (*this)[src] ) ) {
+                    relocate( k + dst, k + src, 1 );
+                    relocate( v + dst++, v + src++, 1 );
+                } else {
+                    construct( dst++, value_type(*b) );
+                    ++b;
+                    --count;
+                }
+            }
+            fill_ = last;
+        }
+
+        /// see dyn_array::splice
+        template <std::size_t S>
+        void splice( std::size_t pos, soa_array<K, V, S> &other,
+                     std::size_t first, std::size_t last )
+        {
+            using dyn_array_detail::relocate;
+
+            auto count = last - first;
+            auto tail  = other.size( ) - last;
+            auto k     = key_data( );
+            auto v     = val_data( );
+            auto ok    = other.key_data( );
+            auto ov    = other.val_data( );
+
+            relocate( k + pos + count, k + pos, fill_ - pos );
+            relocate( v + pos + count, v + pos, fill_ - pos );
+            relocate( k + pos, ok + first, count );
+            relocate( v + pos, ov + first, count );
+            relocate( ok + first, ok + last, tail );
+            relocate( ov + first, ov + last, tail );
+
+            fill_ += count;
+            other.fill_ -= count;
+        }
+
+        /// see dyn_array::append_range
+        template <std::size_t S>
+        void append_range( soa_array<K, V, S> &other,
+                           std::size_t first, std::size_t last )
+        {
+            splice( fill_, other, first, last );
+        }
+
+        /// replaces the content with [b, e); up to max_size( ) values
+        template <typename ItrT>
+        void assign( ItrT b, ItrT e )
+        {
+            clear( );
+            while( (fill_ != max_size( )) && (b != e) ) {
+                push_back( value_type(*(b++)) );
+            }
+        }
+
+        template <typename ItrT>
+        void assign_move( ItrT b, ItrT e )
+        {
+            clear( );
+            while( (fill_ != max_size( )) && (b != e) ) {
+                push_back( std::move(*(b++)) );
+            }
+        }
+
+    private:
+
+        using storage_type = soa_array_detail::storage<K, V, Max>;
+
+        using storage_type::fill_;
+        using storage_type::keys_;
+        using storage_type::vals_;
+        using storage_type::destroy;
+
+        key_type *key_data( )
+        {
+            return keys_.data( );
+        }
+
+        const key_type *key_data( ) const
+        {
+            return keys_.data( );
+        }
+
+        mapped_type *val_data( )
+        {
+            return vals_.data( );
+        }
+
+        const mapped_type *val_data( ) const
+        {
+            return vals_.data( );
+        }
+
+        void construct( std::size_t pos, value_type &&val )
+        {
+            keys_.construct( pos, std::move(val.first) );
+            vals_.construct( pos, std::move(val.second) );
+        }
+
+        template <typename, typename, std::size_t>
+        friend struct soa_array;
+    };
+
+}
+
+#endif // SOA_ARRAY_H
@@ -0,0 +1,214 @@
+#ifndef TASK_POOL_H
+#define TASK_POOL_H
+
+#include <cstdint>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <exception>
+#include <functional>
+#include <condition_variable>
+
+namespace etool {
+
+    /// fixed set of worker threads running indexed tasks
+    /// Every 'run' deals the task indices out to per-thread queues
+    /// in contiguous blocks; a thread takes from the front of its own
+    /// queue and, when that is empty, steals from the back of another.
+    /// The calling thread works along, so a pool of N threads
+    /// runs tasks on N + 1.
+    struct task_pool {
+
+        static
+        std::size_t default_threads( )
+        {
+            auto hw = std::thread::hardware_concurrency( );
+            return hw > 1 ? hw - 1 : 0;
+        }
+
+        explicit
+        task_pool( std::size_t threads = default_threads( ) )
+        {
+            for( std::size_t i = 0; i < threads + 1; ++i ) {
+                queues_.emplace_back( new queue );
+            }
+            for( std::size_t i = 1; i < threads + 1; ++i ) {
+                workers_.emplace_back( [this, i]( ) { work( i ); } );
+            }
+        }
+
+        task_pool( const task_pool & ) = delete;
+        task_pool &operator = ( const task_pool & ) = delete;
+
+        ~task_pool( )
+        {
+            {
+                std::lock_guard<std::mutex> lck(state_lock_);
+                stop_ = true;
+            }
+            wake_.notify_all( );
+            for( auto &w: workers_ ) {
+                w.join( );
+            }
+        }
+
+        /// threads running tasks, the caller of 'run' included
+        std::size_t size( ) const
+        {
+            return queues_.size( );
+        }
+
+        /// calls call( i ) for i in [0, count) and returns when all
+        /// are done; the first exception a task throws is rethrown here.
+        /// One run at a time; a task must not call 'run' of its pool.
+        template <typename Call>
+        void run( std::size_t count, Call call )
+        {
+            if( count == 0 ) {
+                return;
+            }
+
+            std::lock_guard<std::mutex> run_lck(run_lock_);
+
+            std::function<void(std::size_t)> job( std::ref(call) );
+
+            /// the job is published before any of its tasks is queued;
+            /// a worker still draining the last run may take them
+            {
+                std::lock_guard<std::mutex> lck(state_lock_);
+                job_     = &job;
+                pending_ = count;
+            }
+
+            auto per = count / size( );
+            auto odd = count % size( );
+            std::size_t next = 0;
+            for( std::size_t q = 0; q < size( ); ++q ) {
+                auto last = next + per + ( q < odd ? 1 : 0 );
+                std::lock_guard<std::mutex> lck(queues_[q]->lock_);
+                for( ; next < last; ++next ) {
+                    queues_[q]->items_.push_back( next );
+                }
+            }
+
+            {
+                std::lock_guard<std::mutex> lck(state_lock_);
+                ++generation_;
+            }
+            wake_.notify_all( );
+
+            drain( 0 );
+
+            std::unique_lock<std::mutex> lck(state_lock_);
+            done_.wait( lck, [this]( ) {
+                return pending_ == 0 && active_ == 0;
+            } );
+            job_ = nullptr;
+
+            if( error_ ) {
+                auto err = error_;
+                error_ = nullptr;
+                std::rethrow_exception( err );
+            }
+        }
+
+    private:
+
+        struct queue {
+            std::mutex              lock_;
+            std::deque<std::size_t> items_;
+        };
+
+        bool pop( std::size_t self, std::size_t &task )
+        {
+            auto &q = *queues_[self];
+            std::lock_guard<std::mutex> lck(q.lock_);
+            if( q.items_.empty( ) ) {
+                return false;
+            }
+            task = q.items_.front( );
+            q.items_.pop_front( );
+            return true;
+        }
+
+        bool steal( std::size_t self, std::size_t &task )
+        {
+            for( std::size_t i = 1; i < size( ); ++i ) {
+                auto &q = *queues_[(self + i) % size( )];
+                std::lock_guard<std::mutex> lck(q.lock_);
+                if( !q.items_.empty( ) ) {
+                    task = q.items_.back( );
+                    q.items_.pop_back( );
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        /// runs tasks until no queue has any left
+        void drain( std::size_t self )
+        {
+            std::size_t task;
+            while( pop( self, task ) || steal( self, task ) ) {
+                try {
+                    (*job_)( task );
+                } catch( ... ) {
+                    std::lock_guard<std::mutex> lck(state_lock_);
+                    if( !error_ ) {
+                        error_ = std::current_exception( );
+                    }
+                }
+                if( pending_.fetch_sub( 1 ) == 1 ) {
+                    std::lock_guard<std::mutex> lck(state_lock_);
+                    done_.notify_all( );
+                }
+            }
+        }
+
+        void work( std::size_t self )
+        {
+            std::uint64_t seen = 0;
+            while( true ) {
+                {
+                    std::unique_lock<std::mutex> lck(state_lock_);
+                    wake_.wait( lck, [this, seen]( ) {
+                        return stop_ || generation_ != seen;
+                    } );
+                    if( stop_ ) {
+                        return;
+                    }
+                    seen = generation_;
+                    ++active_;
+                }
+
+                drain( self );
+
+                std::lock_guard<std::mutex> lck(state_lock_);
+                --active_;
+                done_.notify_all( );
+            }
+        }
+
+        std::vector<std::unique_ptr<queue> >    queues_;
+        std::vector<std::thread>                workers_;
+
+        std::mutex                              run_lock_;
+        std::mutex                              state_lock_;
+        std::condition_variable                 wake_;
+        std::condition_variable                 done_;
+
+        std::function<void(std::size_t)>       *job_ = nullptr;
+        std::atomic<std::size_t>                pending_ {0};
+        std::size_t                             active_ = 0;
+        std::uint64_t                           generation_ = 0;
+        bool                                    stop_ = false;
+        std::exception_ptr                      error_;
+    };
+
+}
+
+#endif // TASK_POOL_H
@@ -8,3 +8,6 @@ CONFIG -= qt
 INCLUDEPATH += /home/data/github/etool/include
 
 SOURCES += main.cpp
+
+HEADERS += \
+    data_source.h
@@ -0,0 +1,148 @@
+#include <iostream>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "data_source.h"
+#include "bench_util.h"
+
+using namespace etool;
+using namespace etool::filealloc;
+
+/// Throughput and latency of data_source allocate/free/save
+/// usage: filealloc_bench [count] [file]
+/// Prints CSV, see bench::report.
+
+namespace {
+
+    /// 512 byte blocks
+    static const scale_factor block_factor = 0;
+
+    /// frees between two saves
+    static const std::size_t save_every = 1000;
+
+    /// block counts to allocate and the order to free them in
+    struct workload {
+        std::string                name;
+        std::vector<std::uint64_t> blocks;
+        std::vector<std::uint64_t> frees;
+    };
+
+    std::vector<std::uint64_t> plus_one( std::vector<std::uint64_t> v )
+    {
+        for( auto &i: v ) {
+            ++i;
+        }
+        return v;
+    }
+
+    std::vector<workload> workloads( std::size_t count )
+    {
+        std::vector<workload> res;
+
+        res.push_back( workload { "sequential",
+                                  std::vector<std::uint64_t>( count, 1 ),
+                                  bench::sequence( count ) } );
+
+        res.push_back( workload { "random",
+                                  plus_one( bench::uniform( count, 16, 1 ) ),
+                                  bench::permutation( count, 2 ) } );
+
+        res.push_back( workload { "zipfian",
+                                  plus_one( bench::zipf( count, 64, 3 ) ),
+                                  bench::permutation( count, 4 ) } );
+        return res;
+    }
+
+    void row( const std::string &workload, const std::string &op,
+              bench::result &res )
+    {
+        bench::report::row( "filealloc", "data_source", 0,
+                            workload, op, res );
+    }
+
+    std::size_t bytes_for( data_source &ds, std::uint64_t blocks )
+    {
+        return blocks * ds.block_size_ - allocated_block::size( );
+    }
+
+    /// runs step( i ) for i in [0, count) in chunks of 'save_every'
+    /// with a save after each chunk; steps and saves are timed apart
+    template <typename Step>
+    void with_saves( data_source &ds, std::size_t count, Step step,
+                     const std::string &workload, const std::string &op )
+    {
+        bench::result steps;
+        bench::result saves;
+
+        for( std::size_t first = 0; first < count; first += save_every ) {
+            auto last = std::min( count, first + save_every );
+            steps.append( bench::timed( last - first, [&]( std::size_t i ) {
+                step( first + i );
+            } ) );
+            saves.append( bench::timed( 1, [&]( std::size_t ) {
+                ds.save( );
+            } ) );
+        }
+
+        row( workload, op, steps );
+        row( workload, "save", saves );
+    }
+
+    void run( std::size_t count, const std::string &path )
+    {
+        for( auto &wl: workloads( count ) ) {
+
+            data_source::create( path, block_factor, 0 );
+            auto ds = data_source::open( path );
+
+            std::vector<allocated_block_info> infos( count );
+            auto alloc = bench::timed( count, [&]( std::size_t i ) {
+                infos[i] = ds.allocate( bytes_for( ds, wl.blocks[i] ) );
+            } );
+            row( wl.name, "allocate", alloc );
+
+            with_saves( ds, count, [&]( std::size_t i ) {
+                ds.free( infos[wl.frees[i]] );
+            }, wl.name, "free" );
+        }
+
+        /// a window of live blocks: every step allocates one
+        /// and frees the oldest
+        data_source::create( path, block_factor, 0 );
+        auto ds = data_source::open( path );
+
+        auto window = count / 10 + 1;
+        auto sizes  = plus_one( bench::uniform( count, 16, 5 ) );
+        std::vector<allocated_block_info> live( window );
+
+        with_saves( ds, count, [&]( std::size_t i ) {
+            auto &slot = live[i % window];
+            if( i >= window ) {
+                ds.free( slot );
+            }
+            slot = ds.allocate( bytes_for( ds, sizes[i] ) );
+        }, "sliding", "allocate_free" );
+    }
+
+}
+
+int main( int argc, char *argv[] )
+{
+    std::size_t count = 100000;
+    std::string path  = "/tmp/filealloc_bench.bin";
+
+    if( argc > 1 ) {
+        count = std::strtoull( argv[1], nullptr, 10 );
+    }
+    if( argc > 2 ) {
+        path = argv[2];
+    }
+
+    bench::report::header( );
+    run( count, path );
+
+    return 0;
+}
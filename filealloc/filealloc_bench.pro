@@ -0,0 +1,15 @@
+TEMPLATE = app
+CONFIG += console c++11
+CONFIG -= app_bundle
+CONFIG -= qt
+
+
+
+INCLUDEPATH += /home/data/github/etool/include
+INCLUDEPATH += ../btree
+
+SOURCES += filealloc_bench.cpp
+
+HEADERS += \
+    data_source.h \
+    ../btree/bench_util.h
@@ -0,0 +1,1930 @@
+#include <iostream>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <set>
+#include <map>
+#include <random>
+#include <fstream>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <stdexcept>
+
+#include "btree.h"
+#include "bplus_tree.h"
+#include "buffered_btree.h"
+#include "concurrent_btree.h"
+#include "dyn_array.h"
+#include "frozen_btree.h"
+#include "disk_btree.h"
+
+using namespace etool;
+
+/// Reference-model tests: every container runs the same random
+/// operations as a std container and has to end up with its content.
+/// usage: btree_test [scratch directory]
+/// Prints a line per failed check; the exit code is the number of them.
+
+namespace {
+
+    int failures = 0;
+
+    void check( bool ok, const char *what, const std::string &where )
+    {
+        if( !ok ) {
+            ++failures;
+            std::cout << "FAILED: " << what << " (" << where << ")\n";
+        }
+    }
+
+    using key_type = std::uint64_t;
+    using model    = std::multiset<key_type>;
+
+    using values = std::vector<key_type>;
+
+    template <typename Tree>
+    values content_of( const Tree &tree )
+    {
+        return values( tree.begin( ), tree.end( ) );
+    }
+
+    values content_of( const model &ref )
+    {
+        return values( ref.begin( ), ref.end( ) );
+    }
+
+    std::streamoff file_size( const std::string &path )
+    {
+        std::ifstream f( path, std::ios::binary | std::ios::ate );
+        return f.tellg( );
+    }
+
+    template <typename Tree>
+    model disk_content( Tree &tree )
+    {
+        model res;
+        tree.for_each( [&res]( const key_type &v ) { res.insert( v ); } );
+        return res;
+    }
+
+    /// create, insert, erase enough to merge and collapse nodes,
+    /// flush, open, insert again into the freed blocks, verify.
+    /// Blocks of freed nodes have to come back from the free list
+    /// after reopening: the file doesn't grow while there are enough
+    void test_disk_round_trip( const std::string &dir )
+    {
+        using tree_type = disk_btree<value_trait<key_type> >;
+
+        const std::string path = dir + "/btree_test.edb";
+        std::remove( path.c_str( ) );
+
+        std::mt19937_64 rnd( 1 );
+        model ref;
+
+        {
+            auto tree = tree_type::create( path, 0, 8 );
+            check( tree.is_open( ), "create", "disk" );
+            for( int i = 0; i < 5000; ++i ) {
+                auto k = rnd( ) % 100000;
+                tree.insert( k );
+                ref.insert( k );
+            }
+            while( ref.size( ) > 300 ) {
+                auto k = *std::next( ref.begin( ), rnd( ) % ref.size( ) );
+                check( tree.erase( k ), "erase", "disk" );
+                ref.erase( ref.find( k ) );
+            }
+            check( !tree.erase( 100000 ), "erase missing", "disk" );
+            tree.flush( );
+        }
+
+        const auto shrunk = file_size( path );
+
+        for( int round = 0; round < 3; ++round ) {
+            auto tree = tree_type::open( path, 8 );
+            check( tree.is_open( ), "open", "disk" );
+            if( !tree.is_open( ) ) {
+                return;
+            }
+            check( tree.size( ) == ref.size( ), "size after open", "disk" );
+            check( disk_content( tree ) == ref, "content after open",
+                   "disk" );
+
+            for( int i = 0; i < 2000; ++i ) {
+                auto k = rnd( ) % 100000;
+                tree.insert( k );
+                ref.insert( k );
+            }
+            for( int i = 0; i < 1500; ++i ) {
+                auto k = *std::next( ref.begin( ), rnd( ) % ref.size( ) );
+                check( tree.erase( k ), "erase", "disk" );
+                ref.erase( ref.find( k ) );
+            }
+            check( disk_content( tree ) == ref, "content after updates",
+                   "disk" );
+            if( round == 0 ) {
+                tree.flush( );
+                check( file_size( path ) == shrunk, "free blocks reused",
+                       "disk" );
+            }
+            for( int i = 0; i < 200; ++i ) {
+                auto k = rnd( ) % 100000;
+                check( tree.contains( k ) == ( ref.count( k ) > 0 ),
+                       "contains", "disk" );
+            }
+            tree.flush( );
+        }
+
+        std::remove( path.c_str( ) );
+    }
+
+    /// range construction from sorted and unsorted input at a few
+    /// fill factors, then assign over a tree that has content
+    void test_bulk_load( )
+    {
+        using tree_type = btree<value_trait<key_type>, 6>;
+        const std::string name = "bulk load";
+
+        std::mt19937_64 rnd( 12 );
+        for( std::size_t count: { 0, 1, 5, 6, 7, 100, 5000 } ) {
+            values input;
+            for( std::size_t i = 0; i < count; ++i ) {
+                input.push_back( rnd( ) % ( count + 1 ) );
+            }
+            values sorted( input );
+            std::sort( sorted.begin( ), sorted.end( ) );
+
+            for( double fill: { 0.0, 0.5, 0.7, 1.0 } ) {
+                tree_type tree( input.begin( ), input.end( ), fill );
+                check( content_of( tree ) == sorted, "unsorted", name );
+                check( tree.size( ) == count, "size", name );
+
+                tree_type from_sorted( sorted.begin( ), sorted.end( ),
+                                       fill );
+                check( content_of( from_sorted ) == sorted, "sorted", name );
+
+                /// a packed tree has to split on the way
+                model ref( sorted.begin( ), sorted.end( ) );
+                for( int i = 0; i < 300; ++i ) {
+                    key_type k = rnd( ) % ( count + 1 );
+                    if( rnd( ) % 2 ) {
+                        from_sorted.insert( k );
+                        ref.insert( k );
+                    } else {
+                        from_sorted.erase( k );
+                        auto f = ref.find( k );
+                        if( f != ref.end( ) ) {
+                            ref.erase( f );
+                        }
+                    }
+                }
+                check( content_of( from_sorted ) == content_of( ref ),
+                       "updates", name );
+
+                tree.assign( from_sorted.begin( ), from_sorted.end( ),
+                             fill );
+                check( content_of( tree ) == content_of( ref ), "assign",
+                       name );
+            }
+        }
+    }
+
+    template <typename Tree>
+    values reverse_of( const Tree &tree )
+    {
+        values res;
+        for( auto b = tree.end( ); b != tree.begin( ); ) {
+            res.push_back( *--b );
+        }
+        return res;
+    }
+
+    /// lower_bound, upper_bound and find of a few keys as positions
+    template <typename Tree>
+    void check_bounds( const Tree &tree, const model &ref,
+                       std::mt19937_64 &rnd, key_type range,
+                       const std::string &where )
+    {
+        for( int i = 0; i < 100; ++i ) {
+            key_type k = rnd( ) % ( range + 2 );
+            auto lb = std::distance( tree.begin( ), tree.lower_bound( k ) );
+            auto ub = std::distance( tree.begin( ), tree.upper_bound( k ) );
+            check( lb == std::distance( ref.begin( ), ref.lower_bound( k ) ),
+                   "lower_bound", where );
+            check( ub == std::distance( ref.begin( ), ref.upper_bound( k ) ),
+                   "upper_bound", where );
+            check( ( tree.find( k ) != tree.end( ) ) == ( ref.count( k ) > 0 ),
+                   "find", where );
+        }
+    }
+
+    /// walks both ways, from the bounds and back and forth over runs
+    /// of equal keys; iterators stay a few words however high the tree
+    template <std::size_t NodeMax>
+    void test_iterators( const std::string &name )
+    {
+        using tree_type = btree<value_trait<key_type>, NodeMax>;
+        static_assert( sizeof(typename tree_type::iterator)
+                        <= 8 * sizeof(void *), "iterator size" );
+
+        std::mt19937_64 rnd( 13 );
+        const key_type range = 700;
+
+        tree_type tree;
+        model ref;
+        check( tree.begin( ) == tree.end( ), "empty", name );
+        for( int i = 0; i < 3000; ++i ) {
+            key_type k = rnd( ) % range;
+            tree.insert( k );
+            ref.insert( k );
+        }
+        check( content_of( tree ) == content_of( ref ), "forward", name );
+        check( reverse_of( tree ) == values( ref.rbegin( ), ref.rend( ) ),
+               "reverse", name );
+        check_bounds( tree, ref, rnd, range, name );
+
+        for( int i = 0; i < 100; ++i ) {
+            key_type k = rnd( ) % ( range + 2 );
+            auto range_of = tree.equal_range( k );
+            check( static_cast<std::size_t>( std::distance( range_of.first,
+                                                 range_of.second ) )
+                   == ref.count( k ), "equal_range", name );
+
+            /// a few steps forward and the same number back
+            auto it = tree.lower_bound( k );
+            auto rt = ref.lower_bound( k );
+            std::size_t steps = 0;
+            for( ; steps < 20 && it != tree.end( ); ++steps, ++it, ++rt ) {
+                check( *it == *rt, "step forward", name );
+            }
+            for( ; steps > 0; --steps ) {
+                check( *--it == *--rt, "step back", name );
+            }
+            check( it == tree.lower_bound( k ), "back at start", name );
+
+            typename tree_type::const_iterator cit = it;
+            check( cit == tree.lower_bound( k ), "const conversion", name );
+            if( it != tree.end( ) ) {
+                check( *cit == *it, "const value", name );
+            }
+        }
+    }
+
+    /// the same updates through every node pool, with the tree moved
+    /// around in between; a moved-from tree is empty and still usable
+    template <typename Alloc>
+    void test_allocator( const std::string &name )
+    {
+        using tree_type = btree<value_trait<key_type>, 6, Alloc>;
+
+        std::mt19937_64 rnd( 14 );
+        tree_type tree;
+        model ref;
+
+        for( int round = 0; round < 4; ++round ) {
+            for( int i = 0; i < 3000; ++i ) {
+                key_type k = rnd( ) % 2000;
+                if( rnd( ) % 3 ) {
+                    tree.insert( k );
+                    ref.insert( k );
+                } else {
+                    tree.erase( k );
+                    auto f = ref.find( k );
+                    if( f != ref.end( ) ) {
+                        ref.erase( f );
+                    }
+                }
+            }
+
+            tree_type moved( std::move( tree ) );
+            check( tree.empty( ) && tree.begin( ) == tree.end( ),
+                   "moved from", name );
+            tree.insert( 1 );
+            check( content_of( tree ) == values { 1 }, "reused", name );
+
+            check( content_of( moved ) == content_of( ref ), "moved",
+                   name );
+            tree = std::move( moved );
+            check( content_of( tree ) == content_of( ref ), "assigned",
+                   name );
+            check( moved.empty( ), "assigned from", name );
+        }
+
+        values none;
+        tree.assign( none.begin( ), none.end( ) );
+        check( tree.empty( ) && tree.begin( ) == tree.end( ),
+               "assign nothing", name );
+        tree.insert( 2 );
+        check( content_of( tree ) == values { 2 }, "after assign", name );
+    }
+
+    /// one search policy against std::lower_bound/upper_bound
+    /// on sorted runs with repeats, of every length up to 'max'
+    template <typename Policy, typename T>
+    void test_search( const std::string &name )
+    {
+        using less = std::less<T>;
+        const std::size_t max = 70;
+
+        std::mt19937_64 rnd( 11 );
+        for( std::size_t len = 0; len <= max; ++len ) {
+            for( int round = 0; round < 20; ++round ) {
+                std::vector<T> arr( len );
+                for( auto &v: arr ) {
+                    v = static_cast<T>( rnd( ) % ( len + 1 ) );
+                }
+                std::sort( arr.begin( ), arr.end( ) );
+                for( std::size_t k = 0; k <= len + 1; ++k ) {
+                    auto key = static_cast<T>( k );
+                    auto lb = std::lower_bound( arr.begin( ), arr.end( ),
+                                                key ) - arr.begin( );
+                    auto ub = std::upper_bound( arr.begin( ), arr.end( ),
+                                                key ) - arr.begin( );
+                    auto l = Policy::template lower<search::identity, less>(
+                                                arr.data( ), len, key );
+                    auto u = Policy::template upper<search::identity, less>(
+                                                arr.data( ), len, key );
+                    if( l != static_cast<std::size_t>( lb )
+                     || u != static_cast<std::size_t>( ub ) )
+                    {
+                        check( false, "bounds", name );
+                        return;
+                    }
+                }
+            }
+        }
+    }
+
+    template <typename Policy>
+    void test_search_types( const std::string &name )
+    {
+        test_search<Policy, std::int32_t>( name + " int32" );
+        test_search<Policy, std::uint32_t>( name + " uint32" );
+        test_search<Policy, std::int64_t>( name + " int64" );
+        test_search<Policy, std::uint64_t>( name + " uint64" );
+        test_search<Policy, std::int16_t>( name + " int16" );
+        test_search<Policy, float>( name + " float" );
+        test_search<Policy, double>( name + " double" );
+    }
+
+    template <typename Tree>
+    values walk_of( Tree &tree )
+    {
+        values res;
+        tree.for_each( [&res]( const key_type &v ) { res.push_back( v ); } );
+        return res;
+    }
+
+    /// iterators, the leaf list walk and bounds over repeated keys
+    void test_bplus_tree( )
+    {
+        using tree_type = bplus_tree<value_trait<key_type>, 8, 4>;
+        const std::string name = "bplus_tree";
+
+        std::mt19937_64 rnd( 7 );
+        tree_type tree;
+        model ref;
+
+        for( int i = 0; i < 20000; ++i ) {
+            key_type k = rnd( ) % 1500;
+            if( rnd( ) % 3 ) {
+                tree.insert( k );
+                ref.insert( k );
+            } else {
+                tree.erase( k );
+                auto f = ref.find( k );
+                if( f != ref.end( ) ) {
+                    ref.erase( f );
+                }
+            }
+        }
+        check( tree.size( ) == ref.size( ), "size", name );
+        check( content_of( tree ) == content_of( ref ), "content", name );
+        check( walk_of( tree ) == content_of( ref ), "for_each", name );
+        check_bounds( tree, ref, rnd, 1500, name );
+
+        for( auto k: values( ref.begin( ), ref.end( ) ) ) {
+            tree.erase( k );
+        }
+        check( tree.empty( ), "emptied", name );
+    }
+
+    /// random single inserts and erases with many repeats,
+    /// so splits, borrows and merges run at every level
+    template <typename Tree>
+    void test_btree( const std::string &name )
+    {
+        std::mt19937_64 rnd( 2 );
+        const key_type range = 3000;
+
+        Tree tree;
+        model ref;
+
+        for( int round = 0; round < 4; ++round ) {
+            for( int i = 0; i < 4000; ++i ) {
+                key_type k = rnd( ) % range;
+                if( rnd( ) % 3 ) {
+                    tree.insert( k );
+                    ref.insert( k );
+                } else {
+                    tree.erase( k );
+                    auto f = ref.find( k );
+                    if( f != ref.end( ) ) {
+                        ref.erase( f );
+                    }
+                }
+            }
+            check( tree.size( ) == ref.size( ), "size", name );
+            check( content_of( tree ) == content_of( ref ), "content", name );
+            check( reverse_of( tree ) == values( ref.rbegin( ), ref.rend( ) ),
+                   "reverse", name );
+            check_bounds( tree, ref, rnd, range, name );
+        }
+
+        values all( ref.begin( ), ref.end( ) );
+        std::shuffle( all.begin( ), all.end( ), rnd );
+        for( auto k: all ) {
+            tree.erase( k );
+        }
+        check( tree.empty( ) && tree.begin( ) == tree.end( ), "emptied",
+               name );
+    }
+
+    void mapped_of( key_type k, key_type &out )
+    {
+        out = k * 7 + 1;
+    }
+
+    void mapped_of( key_type k, std::string &out )
+    {
+        out = std::to_string( k ) + std::string( k % 40, 'v' );
+    }
+
+    /// unique keys with their mapped values against std::map;
+    /// values are updated in place through the iterators
+    template <typename Layout, typename Mapped>
+    void test_map( const std::string &name )
+    {
+        using trait     = map_trait<key_type, Mapped, std::less<key_type>,
+                                    search::automatic, Layout>;
+        using tree_type = btree<trait, 6>;
+        using content   = std::vector<std::pair<key_type, Mapped> >;
+
+        std::mt19937_64 rnd( 15 );
+        tree_type tree;
+        std::map<key_type, Mapped> ref;
+
+        auto content_of_map = [ ]( const tree_type &t ) {
+            content res;
+            for( auto b = t.begin( ); b != t.end( ); ++b ) {
+                res.emplace_back( b->first, b->second );
+            }
+            return res;
+        };
+
+        for( int round = 0; round < 4; ++round ) {
+            for( int i = 0; i < 4000; ++i ) {
+                key_type k = rnd( ) % 2500;
+                Mapped m;
+                mapped_of( k + round, m );
+                auto f = tree.find( k );
+                switch( rnd( ) % 3 ) {
+                case 0:
+                    if( f == tree.end( ) ) {
+                        tree.insert( std::make_pair( k, m ) );
+                    } else {
+                        f->second = m;
+                    }
+                    ref[k] = m;
+                    break;
+                case 1:
+                    if( f != tree.end( ) ) {
+                        f->second = m;
+                        ref[k] = m;
+                    }
+                    break;
+                default:
+                    tree.erase( k );
+                    ref.erase( k );
+                }
+            }
+            check( tree.size( ) == ref.size( ), "size", name );
+            check( content_of_map( tree ) == content( ref.begin( ),
+                                                      ref.end( ) ),
+                   "content", name );
+
+            for( int i = 0; i < 200; ++i ) {
+                key_type k = rnd( ) % 2600;
+                auto f = tree.find( k );
+                auto r = ref.find( k );
+                check( ( f == tree.end( ) ) == ( r == ref.end( ) )
+                       && ( r == ref.end( ) || f->second == r->second ),
+                       "find", name );
+                auto lb = tree.lower_bound( k );
+                auto rl = ref.lower_bound( k );
+                check( ( lb == tree.end( ) ) == ( rl == ref.end( ) )
+                       && ( rl == ref.end( ) || lb->first == rl->first ),
+                       "lower_bound", name );
+            }
+        }
+    }
+
+    /// unique keys; every thread owns the keys equal to its number
+    /// modulo the thread count, so the end result is known
+    void test_concurrent_btree( )
+    {
+        using tree_type = concurrent_btree<value_trait<key_type>, 8, 4>;
+        const std::string name = "concurrent_btree";
+        const unsigned threads = 4;
+
+        tree_type tree;
+        std::vector<std::set<key_type> > refs( threads );
+        std::vector<int> wrong( threads, 0 );
+
+        std::vector<std::thread> pool;
+        for( unsigned t = 0; t < threads; ++t ) {
+            pool.emplace_back( [&, t]( ) {
+                std::mt19937_64 rnd( 9 + t );
+                auto &ref = refs[t];
+                for( int i = 0; i < 20000; ++i ) {
+                    key_type k = ( rnd( ) % 3000 ) * threads + t;
+                    bool res = false;
+                    bool exp = false;
+                    switch( rnd( ) % 3 ) {
+                    case 0:
+                        res = tree.insert( k );
+                        exp = ref.insert( k ).second;
+                        break;
+                    case 1:
+                        res = tree.erase( k );
+                        exp = ref.erase( k ) > 0;
+                        break;
+                    default:
+                        res = tree.contains( k );
+                        exp = ref.count( k ) > 0;
+                    }
+                    wrong[t] += res != exp;
+                }
+            } );
+        }
+        for( auto &p: pool ) {
+            p.join( );
+        }
+
+        std::set<key_type> all;
+        for( unsigned t = 0; t < threads; ++t ) {
+            check( wrong[t] == 0, "results", name );
+            all.insert( refs[t].begin( ), refs[t].end( ) );
+        }
+        check( walk_of( tree ) == values( all.begin( ), all.end( ) ),
+               "for_each", name );
+        for( auto k: all ) {
+            key_type out = 0;
+            if( !tree.find( k, out ) || out != k ) {
+                check( false, "find", name );
+                break;
+            }
+        }
+    }
+
+    /// sorted and unsorted batches with repeats, inside and around the
+    /// keys the tree has; erase_batch removes one value per entry
+    template <typename Tree>
+    void test_batches( const std::string &name )
+    {
+        std::mt19937_64 rnd( 16 );
+        const key_type range = 3000;
+
+        Tree tree;
+        model ref;
+
+        for( int round = 0; round < 8; ++round ) {
+            values batch;
+            std::size_t count = round % 2 ? 40 : 700;
+            for( std::size_t i = 0; i < count; ++i ) {
+                batch.push_back( rnd( ) % range + ( round == 3 ? range : 0 ) );
+            }
+            if( round % 4 == 0 ) {
+                std::sort( batch.begin( ), batch.end( ) );
+            }
+            tree.insert_batch( batch.begin( ), batch.end( ) );
+            ref.insert( batch.begin( ), batch.end( ) );
+            check( content_of( tree ) == content_of( ref ),
+                   "insert_batch", name );
+
+            batch.clear( );
+            for( std::size_t i = 0; i < count / 2; ++i ) {
+                batch.push_back( rnd( ) % ( range * 2 ) );
+            }
+            std::size_t erased = 0;
+            for( auto k: batch ) {
+                auto f = ref.find( k );
+                if( f != ref.end( ) ) {
+                    ref.erase( f );
+                    ++erased;
+                }
+            }
+            check( tree.erase_batch( batch.begin( ), batch.end( ) ) == erased,
+                   "erase_batch result", name );
+            check( content_of( tree ) == content_of( ref ),
+                   "erase_batch", name );
+            check( reverse_of( tree ) == values( ref.rbegin( ), ref.rend( ) ),
+                   "reverse", name );
+            check_bounds( tree, ref, rnd, range * 2, name );
+        }
+
+        values all( ref.begin( ), ref.end( ) );
+        check( tree.erase_batch( all.begin( ), all.end( ) ) == all.size( ),
+               "erase all", name );
+        check( tree.empty( ) && tree.begin( ) == tree.end( ), "emptied",
+               name );
+    }
+
+    /// counts its live objects; never default constructed by the array
+    struct tracked {
+
+        static int alive;
+        static int defaults;
+
+        tracked( )
+        {
+            ++alive;
+            ++defaults;
+        }
+
+        explicit
+        tracked( key_type v )
+            :value(v)
+        {
+            ++alive;
+        }
+
+        tracked( const tracked &other )
+            :value(other.value)
+        {
+            ++alive;
+        }
+
+        tracked &operator = ( const tracked & ) = default;
+
+        ~tracked( )
+        {
+            --alive;
+        }
+
+        key_type value = 0;
+    };
+
+    int tracked::alive    = 0;
+    int tracked::defaults = 0;
+
+    /// only the live elements of a dyn_array are objects: none is made
+    /// up front and every one is destroyed, through copies and moves
+    void test_dyn_array_storage( )
+    {
+        using array_type = dyn_array<tracked, 16>;
+        const std::string name = "dyn_array storage";
+
+        {
+            array_type arr;
+            check( tracked::alive == 0, "empty", name );
+            for( key_type i = 0; i < 10; ++i ) {
+                arr.push_back( tracked( i ) );
+            }
+            check( tracked::alive == 10, "filled", name );
+
+            array_type copy( arr );
+            check( tracked::alive == 20, "copied", name );
+            array_type moved( std::move( copy ) );
+            copy.clear( );
+            check( tracked::alive == 20, "moved", name );
+
+            arr.erase_pos( 3 );
+            arr.insert( arr.begin( ) + 5, tracked( 100 ) );
+            arr.reduce( 4 );
+            check( tracked::alive == 16 && arr.size( ) == 6, "reduced",
+                   name );
+
+            moved = arr;
+            check( tracked::alive == 12, "assigned", name );
+            check( moved[5].value == 100 && moved[3].value == 4,
+                   "content", name );
+        }
+        check( tracked::alive == 0, "destroyed", name );
+        check( tracked::defaults == 0, "default constructed", name );
+
+        dyn_array<tracked, 1024> big;
+        check( tracked::alive == 0 && tracked::defaults == 0, "big array",
+               name );
+    }
+
+    template <typename T>
+    T element_of( key_type k );
+
+    template <>
+    key_type element_of<key_type>( key_type k )
+    {
+        return k;
+    }
+
+    template <>
+    std::string element_of<std::string>( key_type k )
+    {
+        return std::to_string( k ) + std::string( k % 30, 's' );
+    }
+
+    /// insert, erase, merge, splice and append_range against
+    /// std::vector, for a relocatable and a non-relocatable element
+    template <typename T>
+    void test_dyn_array_moves( const std::string &name )
+    {
+        const std::size_t max = 24;
+        using array_type = dyn_array<T, max>;
+        using vector     = std::vector<T>;
+
+        auto same = [ ]( const array_type &arr, const vector &ref ) {
+            return vector( arr.begin( ), arr.end( ) ) == ref;
+        };
+
+        std::mt19937_64 rnd( 17 );
+        for( int round = 0; round < 2000; ++round ) {
+            array_type a;
+            array_type b;
+            vector ra;
+            vector rb;
+            for( std::size_t i = rnd( ) % max; i > 0; --i ) {
+                auto pos = rnd( ) % ( ra.size( ) + 1 );
+                auto val = element_of<T>( rnd( ) % 100 );
+                a.insert( a.begin( ) + pos, val );
+                ra.insert( ra.begin( ) + pos, val );
+            }
+            for( std::size_t i = rnd( ) % max; i > 0; --i ) {
+                b.push_back( element_of<T>( i ) );
+                rb.push_back( element_of<T>( i ) );
+            }
+            if( !ra.empty( ) && rnd( ) % 2 ) {
+                auto pos = rnd( ) % ra.size( );
+                a.erase_pos( pos );
+                ra.erase( ra.begin( ) + pos );
+            }
+            check( same( a, ra ) && same( b, rb ), "insert erase", name );
+
+            auto room  = max - ra.size( );
+            auto first = rnd( ) % ( rb.size( ) + 1 );
+            auto last  = first + rnd( ) % ( rb.size( ) - first + 1 );
+            if( last - first > room ) {
+                last = first + room;
+            }
+            auto pos = rnd( ) % ( ra.size( ) + 1 );
+            if( rnd( ) % 2 ) {
+                a.splice( pos, b, first, last );
+                ra.insert( ra.begin( ) + pos, rb.begin( ) + first,
+                           rb.begin( ) + last );
+            } else {
+                a.append_range( b, first, last );
+                ra.insert( ra.end( ), rb.begin( ) + first,
+                           rb.begin( ) + last );
+            }
+            rb.erase( rb.begin( ) + first, rb.begin( ) + last );
+            check( same( a, ra ) && same( b, rb ), "splice", name );
+
+            /// sorted merge of what still fits
+            std::sort( a.begin( ), a.end( ) );
+            std::sort( ra.begin( ), ra.end( ) );
+            vector add( rb.begin( ), rb.begin( )
+                            + std::min( rb.size( ), max - ra.size( ) ) );
+            std::sort( add.begin( ), add.end( ) );
+            if( !add.empty( ) ) {
+                a.merge( add.begin( ), add.size( ), std::less<T>( ) );
+                vector res;
+                std::merge( ra.begin( ), ra.end( ), add.begin( ), add.end( ),
+                            std::back_inserter( res ) );
+                ra.swap( res );
+            }
+            check( same( a, ra ), "merge", name );
+        }
+    }
+
+    /// the real node of a sized tree fits its target, and one more
+    /// slot would not; then the tree runs the usual updates
+    template <std::size_t Target, typename Summary, typename Deletion,
+              typename Alloc>
+    void test_sized( const std::string &name )
+    {
+        using tree_type = sized_btree<value_trait<key_type>, Target, Alloc,
+                                      stats::disabled, Summary, Deletion>;
+        using wider     = btree<value_trait<key_type>,
+                                tree_type::maximum + 1, Alloc,
+                                stats::disabled, Summary, Deletion>;
+
+        static_assert( sizeof(typename tree_type::bnode) <= Target,
+                       "sized node exceeds its target" );
+        static_assert( sizeof(typename wider::bnode) > Target,
+                       "sized node leaves a slot unused" );
+
+        test_btree<tree_type>( name );
+    }
+
+    /// the plain estimate for a few traits and targets
+    using small_geometry = sizing::btree_geometry<
+                                value_trait<std::uint32_t>,
+                                sizing::cache_line>;
+    using page_geometry  = sizing::btree_geometry<value_trait<key_type>,
+                                                  sizing::page>;
+    using map_geometry   = sizing::btree_geometry<
+                                map_trait<key_type, key_type>,
+                                sizing::page>;
+    using tiny_geometry  = sizing::btree_geometry<value_trait<key_type>, 8>;
+
+    static_assert( small_geometry::fits
+                   && small_geometry::node_bytes <= sizing::cache_line,
+                   "cache line geometry" );
+    static_assert( page_geometry::fits
+                   && page_geometry::node_bytes <= sizing::page
+                   && page_geometry::node_max > map_geometry::node_max,
+                   "page geometry" );
+    static_assert( !tiny_geometry::fits
+                   && tiny_geometry::node_max == tiny_geometry::smallest,
+                   "below the smallest node" );
+
+    using strings = std::vector<std::string>;
+
+    /// keys that share long prefixes, as URLs and paths do
+    std::string url_of( std::mt19937_64 &rnd, std::size_t spread )
+    {
+        static const char *hosts[] = { "http://a.example.com/",
+                                       "http://a.example.org/",
+                                       "https://b.example.com/" };
+        auto n = rnd( ) % spread;
+        std::string res = hosts[n % 3];
+        res += "dir" + std::to_string( n % 17 ) + "/";
+        if( n % 5 ) {
+            res += "item" + std::to_string( n );
+        }
+        return res;
+    }
+
+    /// a prefix array against a sorted vector, including keys that
+    /// stop inside the shared prefix
+    void test_prefix_array( )
+    {
+        const std::size_t max = 32;
+        const std::string name = "prefix_array";
+
+        std::mt19937_64 rnd( 18 );
+        for( int round = 0; round < 300; ++round ) {
+            prefix_array<max> arr;
+            strings ref;
+            for( std::size_t i = rnd( ) % max; i > 0; --i ) {
+                auto val = url_of( rnd, 200 );
+                auto pos = std::upper_bound( ref.begin( ), ref.end( ), val )
+                         - ref.begin( );
+                arr.insert( arr.begin( ) + pos, val );
+                ref.insert( ref.begin( ) + pos, val );
+            }
+            if( !ref.empty( ) && rnd( ) % 2 ) {
+                auto pos = rnd( ) % ref.size( );
+                arr.erase_pos( pos );
+                ref.erase( ref.begin( ) + pos );
+            }
+            check( strings( arr.begin( ), arr.end( ) ) == ref, "content",
+                   name );
+
+            for( int i = 0; i < 20; ++i ) {
+                auto key = url_of( rnd, 220 );
+                key.resize( rnd( ) % ( key.size( ) + 1 ) );
+                auto lb = std::lower_bound( ref.begin( ), ref.end( ), key )
+                        - ref.begin( );
+                auto ub = std::upper_bound( ref.begin( ), ref.end( ), key )
+                        - ref.begin( );
+                check( arr.lower_of( key ) == static_cast<std::size_t>( lb )
+                    && arr.upper_of( key ) == static_cast<std::size_t>( ub ),
+                       "bounds", name );
+                bool same = true;
+                for( std::size_t pos = 0; pos < ref.size( ); ++pos ) {
+                    auto c = arr.compare_to( pos, key.data( ), key.size( ) );
+                    auto r = ref[pos].compare( key );
+                    same = same && ( c < 0 ) == ( r < 0 )
+                                && ( c > 0 ) == ( r > 0 );
+                }
+                check( same, "compare_to", name );
+            }
+        }
+    }
+
+    /// a string_trait tree with prefix compressed nodes
+    /// against a multiset of strings
+    template <std::size_t NodeMax>
+    void test_string_keys( const std::string &name )
+    {
+        using tree_type = btree<string_trait, NodeMax>;
+        using ref_type  = std::multiset<std::string>;
+
+        std::mt19937_64 rnd( 19 );
+        tree_type tree;
+        ref_type ref;
+
+        for( int round = 0; round < 4; ++round ) {
+            for( int i = 0; i < 3000; ++i ) {
+                auto k = url_of( rnd, 1500 );
+                if( rnd( ) % 3 ) {
+                    tree.insert( k );
+                    ref.insert( k );
+                } else {
+                    tree.erase( k );
+                    auto f = ref.find( k );
+                    if( f != ref.end( ) ) {
+                        ref.erase( f );
+                    }
+                }
+            }
+
+            strings batch;
+            for( int i = 0; i < 300; ++i ) {
+                batch.push_back( url_of( rnd, 1500 ) );
+            }
+            tree.insert_batch( batch.begin( ), batch.end( ) );
+            ref.insert( batch.begin( ), batch.end( ) );
+            std::shuffle( batch.begin( ), batch.end( ), rnd );
+            batch.resize( 200 );
+            std::size_t erased = 0;
+            for( auto &k: batch ) {
+                auto f = ref.find( k );
+                if( f != ref.end( ) ) {
+                    ref.erase( f );
+                    ++erased;
+                }
+            }
+            check( tree.erase_batch( batch.begin( ), batch.end( ) ) == erased,
+                   "erase_batch", name );
+
+            check( tree.size( ) == ref.size( ), "size", name );
+            check( strings( tree.begin( ), tree.end( ) )
+                   == strings( ref.begin( ), ref.end( ) ), "content", name );
+
+            for( int i = 0; i < 200; ++i ) {
+                auto k = url_of( rnd, 1600 );
+                k.resize( rnd( ) % 4 ? k.size( ) : k.size( ) / 2 );
+                auto lb = std::distance( tree.begin( ), tree.lower_bound( k ) );
+                auto ub = std::distance( tree.begin( ), tree.upper_bound( k ) );
+                check( lb == std::distance( ref.begin( ),
+                                            ref.lower_bound( k ) )
+                       && ub == std::distance( ref.begin( ),
+                                               ref.upper_bound( k ) ),
+                       "bounds", name );
+                auto f = tree.find( k );
+                check( ( f != tree.end( ) ) == ( ref.count( k ) > 0 )
+                       && ( f == tree.end( ) || *f == k ), "find", name );
+            }
+        }
+    }
+
+    /// task_pool runs every index once, rethrows what a task throws
+    /// and keeps working after that
+    void test_task_pool( )
+    {
+        const std::string name = "task_pool";
+
+        for( std::size_t threads: { 0, 1, 3 } ) {
+            task_pool pool( threads );
+            check( pool.size( ) == threads + 1, "size", name );
+            for( std::size_t count: { 0, 1, 7, 1000 } ) {
+                std::vector<std::atomic<int> > hits( count );
+                for( auto &h: hits ) {
+                    h = 0;
+                }
+                pool.run( count, [&hits]( std::size_t i ) { ++hits[i]; } );
+                bool once = true;
+                for( auto &h: hits ) {
+                    once = once && h == 1;
+                }
+                check( once, "every index once", name );
+            }
+
+            bool thrown = false;
+            try {
+                pool.run( 100, [ ]( std::size_t i ) {
+                    if( i == 42 ) {
+                        throw std::runtime_error( "task" );
+                    }
+                } );
+            } catch( const std::runtime_error & ) {
+                thrown = true;
+            }
+            check( thrown, "rethrown", name );
+
+            std::atomic<std::size_t> sum( 0 );
+            pool.run( 100, [&sum]( std::size_t i ) { sum += i; } );
+            check( sum == 4950, "after a throw", name );
+        }
+    }
+
+    /// scans and folds over the whole tree and key ranges
+    /// against the model, for small trees and many threads
+    void test_parallel( )
+    {
+        using tree_type = btree<value_trait<key_type>, 5>;
+        const std::string name = "parallel";
+
+        task_pool pool( 3 );
+        std::mt19937_64 rnd( 20 );
+        for( std::size_t count: { 0, 1, 4, 30, 5000 } ) {
+            values input;
+            for( std::size_t i = 0; i < count; ++i ) {
+                input.push_back( rnd( ) % ( count + 1 ) );
+            }
+            tree_type tree( input.begin( ), input.end( ) );
+            model ref( input.begin( ), input.end( ) );
+
+            std::mutex lock;
+            values seen;
+            tree.parallel_for_each( [&]( const key_type &v ) {
+                std::lock_guard<std::mutex> lck(lock);
+                seen.push_back( v );
+            }, pool );
+            std::sort( seen.begin( ), seen.end( ) );
+            check( seen == content_of( ref ), "for_each", name );
+
+            /// the ordered fold gives the values in order
+            auto all = tree.parallel_reduce( values( ),
+                [ ]( values acc, const key_type &v ) {
+                    acc.push_back( v );
+                    return acc;
+                },
+                [ ]( values l, const values &r ) {
+                    l.insert( l.end( ), r.begin( ), r.end( ) );
+                    return l;
+                }, pool );
+            check( all == content_of( ref ), "reduce", name );
+
+            for( int i = 0; i < 20; ++i ) {
+                key_type lo = rnd( ) % ( count + 2 );
+                key_type hi = rnd( ) % ( count + 2 );
+                key_type sum = 0;
+                if( lo < hi ) {
+                    for( auto b = ref.lower_bound( lo );
+                         b != ref.lower_bound( hi ); ++b )
+                    {
+                        sum += *b;
+                    }
+                }
+                std::atomic<key_type> scanned( 0 );
+                tree.parallel_for_each( lo, hi, [&]( const key_type &v ) {
+                    scanned += v;
+                }, pool );
+                auto folded = tree.parallel_reduce( lo, hi, key_type( 0 ),
+                    [ ]( key_type acc, const key_type &v ) {
+                        return acc + v;
+                    },
+                    [ ]( key_type l, key_type r ) { return l + r; }, pool );
+                check( scanned == sum && folded == sum, "range", name );
+            }
+        }
+    }
+
+    /// snapshots keep what they were taken with while the tree changes;
+    /// a changed snapshot leaves the tree alone
+    template <typename Deletion>
+    void test_snapshots( const std::string &name )
+    {
+        using tree_type = btree<value_trait<key_type>, 8, shared_allocator,
+                                stats::disabled, summary::none, Deletion>;
+
+        std::mt19937_64 rnd( 4 );
+        tree_type tree;
+        model ref;
+
+        std::vector<tree_type> snaps;
+        std::vector<model>     refs;
+
+        for( int round = 0; round < 6; ++round ) {
+            for( int i = 0; i < 1500; ++i ) {
+                key_type k = rnd( ) % 1000;
+                if( rnd( ) % 2 ) {
+                    tree.insert( k );
+                    ref.insert( k );
+                } else {
+                    tree.erase( k );
+                    auto f = ref.find( k );
+                    if( f != ref.end( ) ) {
+                        ref.erase( f );
+                    }
+                }
+            }
+            snaps.push_back( tree.snapshot( ) );
+            refs.push_back( ref );
+            if( round % 2 ) {
+                tree.compact( );
+            } else {
+                values batch;
+                for( int i = 0; i < 200; ++i ) {
+                    batch.push_back( rnd( ) % 1000 );
+                }
+                tree.insert_batch( batch.begin( ), batch.end( ) );
+                ref.insert( batch.begin( ), batch.end( ) );
+            }
+        }
+
+        auto copy = snaps[2].snapshot( );
+        for( int i = 0; i < 500; ++i ) {
+            key_type k = rnd( ) % 1000;
+            snaps[2].insert( k );
+            snaps[2].erase( k + 1 );
+        }
+        check( content_of( copy ) == content_of( refs[2] ),
+               "snapshot of a snapshot", name );
+        snaps[2] = std::move( copy );
+
+        check( content_of( tree ) == content_of( ref ), "tree", name );
+        for( std::size_t i = 0; i < snaps.size( ); ++i ) {
+            check( content_of( snaps[i] ) == content_of( refs[i] ),
+                   "snapshot", name );
+        }
+        snaps.clear( );
+        check( content_of( tree ) == content_of( ref ), "after drop", name );
+    }
+
+    /// the counters account for every node the tree has: each split
+    /// adds one, each merge takes one, a root split or collapse
+    /// changes the height; the shape has to match the walk
+    void test_statistics( )
+    {
+        using tree_type = btree<value_trait<key_type>, 6, slab_allocator< >,
+                                stats::counting>;
+        const std::string name = "statistics";
+
+        auto check_shape = [&name]( const tree_type &tree,
+                                    const std::string &when ) {
+            auto s = tree.statistics( );
+            check( s.counting, "counting", name + when );
+            check( s.shape.nodes == 1 + s.ops.splits + s.ops.root_splits
+                                  - s.ops.merges - s.ops.root_collapses,
+                   "nodes", name + when );
+            check( s.shape.height == 1 + s.ops.root_splits
+                                   - s.ops.root_collapses,
+                   "height", name + when );
+            check( s.shape.values == tree.size( ), "values", name + when );
+            /// 'maximum' values is the overflow, a node holds one less
+            check( s.shape.capacity
+                   == s.shape.nodes * ( tree_type::maximum - 1 ),
+                   "capacity", name + when );
+            check( s.shape.node_bytes
+                   == s.shape.nodes * sizeof(typename tree_type::bnode),
+                   "node bytes", name + when );
+            check( s.shape.leaves > 0 && s.shape.leaves <= s.shape.nodes,
+                   "leaves", name + when );
+            std::size_t filled = 0;
+            for( auto f: s.shape.fill ) {
+                filled += f;
+            }
+            check( filled == s.shape.nodes, "fill buckets", name + when );
+            check( s.ops.longest_split_chain <= s.shape.height
+                   && s.ops.longest_merge_chain <= s.shape.height,
+                   "chains", name + when );
+        };
+
+        std::mt19937_64 rnd( 21 );
+        tree_type tree;
+        check_shape( tree, " empty" );
+
+        for( int i = 0; i < 5000; ++i ) {
+            tree.insert( rnd( ) % 3000 );
+        }
+        check_shape( tree, " inserts" );
+        auto grown = tree.statistics( );
+        check( grown.ops.splits > 0 && grown.ops.root_splits > 0
+               && grown.ops.split_cascades > 0 && grown.ops.merges == 0,
+               "growth", name );
+
+        for( int i = 0; i < 4000; ++i ) {
+            tree.erase( rnd( ) % 3000 );
+        }
+        check_shape( tree, " erases" );
+        auto shrunk = tree.statistics( );
+        check( shrunk.ops.merges > 0 && shrunk.ops.borrows_left > 0
+               && shrunk.ops.borrows_right > 0, "shrink", name );
+
+        /// lookups count once each and visit a node per level at most
+        tree.reset_statistics( );
+        auto height = tree.statistics( ).shape.height;
+        for( key_type k = 0; k < 100; ++k ) {
+            tree.find( k );
+            tree.lower_bound( k );
+            tree.upper_bound( k );
+        }
+        auto looked = tree.statistics( );
+        check( looked.ops.lookups == 300, "lookups", name );
+        check( looked.ops.lookup_nodes >= looked.ops.lookups
+               && looked.ops.lookup_nodes <= looked.ops.lookups * height,
+               "lookup nodes", name );
+        check( looked.ops.lookup_comparisons >= looked.ops.lookup_nodes,
+               "lookup comparisons", name );
+        check( looked.ops.splits == 0 && looked.ops.merges == 0,
+               "reset", name );
+
+        for( auto k: content_of( tree ) ) {
+            tree.erase( k );
+        }
+        auto empty = tree.statistics( ).shape;
+        check( empty.height == 1 && empty.nodes == 1 && empty.values == 0,
+               "emptied", name );
+
+        btree<value_trait<key_type>, 6> plain;
+        plain.insert( 1 );
+        auto off = plain.statistics( );
+        check( !off.counting && off.ops.splits == 0 && off.ops.lookups == 0
+               && off.shape.values == 1 && off.shape.nodes == 1,
+               "disabled", name );
+    }
+
+    /// copies of shared nodes are counted when a snapshot holds them
+    void test_copy_statistics( )
+    {
+        using tree_type = btree<value_trait<key_type>, 6, shared_allocator,
+                                stats::counting>;
+        const std::string name = "copy statistics";
+
+        tree_type tree;
+        for( key_type k = 0; k < 1000; ++k ) {
+            tree.insert( k );
+        }
+        check( tree.statistics( ).ops.node_copies == 0, "unshared", name );
+        auto snap = tree.snapshot( );
+        tree.insert( 500 );
+        auto copies = tree.statistics( ).ops.node_copies;
+        check( copies > 0 && copies <= tree.statistics( ).shape.height,
+               "one path", name );
+        tree.insert( 500 );
+        check( tree.statistics( ).ops.node_copies == copies, "copied once",
+               name );
+    }
+
+    /// string_trait ordered by transparent_less: prefix compressed
+    /// nodes searched with C strings
+    struct transparent_string_trait: string_trait {
+        using less = transparent_less;
+    };
+
+    /// bytes that are not a std::string and don't convert to one;
+    /// a lookup with it can't build a key on the way
+    struct string_ref {
+
+        const char *data( ) const
+        {
+            return data_;
+        }
+
+        std::size_t size( ) const
+        {
+            return size_;
+        }
+
+        int compare( const std::string &other ) const
+        {
+            auto res = std::memcmp( data_, other.data( ),
+                                    std::min( size_, other.size( ) ) );
+            if( res != 0 ) {
+                return res;
+            }
+            return size_ < other.size( ) ? -1
+                 : ( size_ > other.size( ) ? 1 : 0 );
+        }
+
+        const char  *data_;
+        std::size_t  size_;
+    };
+
+    bool operator < ( const string_ref &l, const std::string &r )
+    {
+        return l.compare( r ) < 0;
+    }
+
+    bool operator < ( const std::string &l, const string_ref &r )
+    {
+        return r.compare( l ) > 0;
+    }
+
+    /// lookups and erase with probes of other types than the key:
+    /// C strings for std::string keys, narrower integers for wide ones
+    template <typename Trait>
+    void test_transparent_strings( const std::string &name )
+    {
+        using tree_type = btree<Trait, 6>;
+        using ref_type  = std::multiset<std::string>;
+
+        std::mt19937_64 rnd( 22 );
+        tree_type tree;
+        ref_type ref;
+        for( int i = 0; i < 3000; ++i ) {
+            auto k = url_of( rnd, 800 );
+            tree.insert( k );
+            ref.insert( k );
+        }
+
+        strings probes;
+        for( int i = 0; i < 300; ++i ) {
+            auto k = url_of( rnd, 900 );
+            k.resize( rnd( ) % 4 ? k.size( ) : k.size( ) / 2 );
+            probes.push_back( k );
+        }
+
+        for( auto &p: probes ) {
+            const char *k = p.c_str( );
+            string_ref  r = { p.data( ), p.size( ) };
+            auto count = ref.count( p );
+            check( ( tree.find( k ) != tree.end( ) ) == ( count > 0 )
+                   && ( tree.find( r ) != tree.end( ) ) == ( count > 0 ),
+                   "find", name );
+            auto lb = std::distance( tree.begin( ), tree.lower_bound( r ) );
+            auto ub = std::distance( tree.begin( ), tree.upper_bound( r ) );
+            check( lb == std::distance( ref.begin( ),
+                                        ref.lower_bound( p ) )
+                   && ub == std::distance( ref.begin( ),
+                                           ref.upper_bound( p ) ),
+                   "bounds", name );
+            auto range = tree.equal_range( k );
+            check( static_cast<std::size_t>( std::distance( range.first,
+                                                 range.second ) ) == count,
+                   "equal_range", name );
+        }
+
+        for( auto &p: probes ) {
+            tree.erase( string_ref { p.data( ), p.size( ) } );
+            auto f = ref.find( p );
+            if( f != ref.end( ) ) {
+                ref.erase( f );
+            }
+        }
+        check( strings( tree.begin( ), tree.end( ) )
+               == strings( ref.begin( ), ref.end( ) ), "erase", name );
+        check( tree.find( "no such key" ) == tree.end( ), "missing", name );
+    }
+
+    void test_transparent_integers( )
+    {
+        using tree_type = btree<value_trait<key_type, transparent_less>, 6>;
+        const std::string name = "transparent integers";
+
+        std::mt19937_64 rnd( 23 );
+        tree_type tree;
+        model ref;
+        for( int i = 0; i < 3000; ++i ) {
+            key_type k = rnd( ) % 1000;
+            tree.insert( k );
+            ref.insert( k );
+        }
+        for( std::uint16_t k = 0; k < 1010; k += 3 ) {
+            auto lb = std::distance( tree.begin( ), tree.lower_bound( k ) );
+            auto ub = std::distance( tree.begin( ), tree.upper_bound( k ) );
+            auto range = tree.equal_range( k );
+            check( lb == std::distance( ref.begin( ),
+                                        ref.lower_bound( k ) )
+                   && ub == std::distance( ref.begin( ),
+                                           ref.upper_bound( k ) )
+                   && std::distance( range.first, range.second ) == ub - lb,
+                   "bounds", name );
+            check( ( tree.find( k ) != tree.end( ) ) == ( ref.count( k ) > 0 ),
+                   "find", name );
+            tree.erase( k );
+            auto f = ref.find( k );
+            if( f != ref.end( ) ) {
+                ref.erase( f );
+            }
+        }
+        check( content_of( tree ) == content_of( ref ), "erase", name );
+    }
+
+    /// a set: insert replaces, erase removes the only value
+    void test_buffered_btree( )
+    {
+        using tree_type = buffered_btree<value_trait<key_type>, 8>;
+        const std::string name = "buffered_btree";
+
+        std::mt19937_64 rnd( 8 );
+        tree_type tree;
+        std::set<key_type> ref;
+
+        for( int round = 0; round < 5; ++round ) {
+            for( int i = 0; i < 5000; ++i ) {
+                key_type k = rnd( ) % 4000;
+                if( rnd( ) % 3 ) {
+                    tree.insert( k );
+                    ref.insert( k );
+                } else {
+                    tree.erase( k );
+                    ref.erase( k );
+                }
+            }
+            /// lookups see the messages still on the way down
+            for( int i = 0; i < 200; ++i ) {
+                key_type k = rnd( ) % 4000;
+                auto f = tree.find( k );
+                check( ( f != nullptr ) == ( ref.count( k ) > 0 )
+                       && ( !f || *f == k ), "find", name );
+            }
+            check( tree.size( ) == ref.size( ), "size", name );
+            check( walk_of( tree ) == values( ref.begin( ), ref.end( ) ),
+                   "for_each", name );
+        }
+    }
+
+    /// the newest message for a key wins, before and after a flush
+    void test_buffered_map( )
+    {
+        using tree_type = buffered_btree<map_trait<key_type, key_type>, 8>;
+        const std::string name = "buffered_btree map";
+
+        std::mt19937_64 rnd( 24 );
+        tree_type tree;
+        std::map<key_type, key_type> ref;
+
+        for( int round = 0; round < 4; ++round ) {
+            for( int i = 0; i < 6000; ++i ) {
+                key_type k = rnd( ) % 1500;
+                if( rnd( ) % 4 ) {
+                    key_type v = rnd( );
+                    tree.insert( std::make_pair( k, v ) );
+                    ref[k] = v;
+                } else {
+                    tree.erase( k );
+                    ref.erase( k );
+                }
+            }
+            if( round % 2 ) {
+                tree.flush( );
+            }
+            bool same = true;
+            for( key_type k = 0; k < 1500; ++k ) {
+                auto f = tree.find( k );
+                auto r = ref.find( k );
+                same = same && ( f != nullptr ) == ( r != ref.end( ) )
+                            && ( !f || f->second == r->second );
+            }
+            check( same, "find", name );
+            check( tree.size( ) == ref.size( ), "size", name );
+        }
+    }
+
+    /// the four set operations against the std algorithms,
+    /// on overlapping and on apart key ranges
+    void test_set_ops( )
+    {
+        using tree_type = btree<value_trait<key_type>, 6>;
+        const std::string name = "set ops";
+
+        std::mt19937_64 rnd( 6 );
+        for( int round = 0; round < 8; ++round ) {
+            key_type shift = round % 2 ? 100000 : 0;
+            values av, bv;
+            for( int i = 0; i < 3000; ++i ) {
+                av.push_back( rnd( ) % 2000 );
+            }
+            for( int i = 0; i < 1000 + round * 300; ++i ) {
+                bv.push_back( rnd( ) % 3000 + shift );
+            }
+            std::sort( av.begin( ), av.end( ) );
+            std::sort( bv.begin( ), bv.end( ) );
+            tree_type a( av.begin( ), av.end( ) );
+            tree_type b( bv.begin( ), bv.end( ) );
+
+            values res;
+            std::merge( av.begin( ), av.end( ), bv.begin( ), bv.end( ),
+                        std::back_inserter( res ) );
+            check( content_of( tree_type::merge( a, b ) ) == res,
+                   "merge", name );
+
+            res.clear( );
+            std::set_union( av.begin( ), av.end( ), bv.begin( ), bv.end( ),
+                            std::back_inserter( res ) );
+            check( content_of( tree_type::set_union( a, b ) ) == res,
+                   "set_union", name );
+
+            res.clear( );
+            std::set_intersection( av.begin( ), av.end( ),
+                                   bv.begin( ), bv.end( ),
+                                   std::back_inserter( res ) );
+            check( content_of( tree_type::set_intersection( a, b ) ) == res,
+                   "set_intersection", name );
+
+            res.clear( );
+            std::set_difference( av.begin( ), av.end( ),
+                                 bv.begin( ), bv.end( ),
+                                 std::back_inserter( res ) );
+            check( content_of( tree_type::set_difference( a, b ) ) == res,
+                   "set_difference", name );
+
+            check( content_of( a ) == av && content_of( b ) == bv,
+                   "operands", name );
+        }
+
+        values some = { 1, 2, 2, 5 };
+        tree_type empty;
+        tree_type full( some.begin( ), some.end( ) );
+        check( content_of( tree_type::merge( empty, full ) ) == some
+               && content_of( tree_type::set_union( full, empty ) ) == some
+               && tree_type::set_intersection( full, empty ).empty( )
+               && content_of( tree_type::set_difference( full, empty ) )
+                  == some
+               && tree_type::set_difference( empty, full ).empty( ),
+               "empty operand", name );
+    }
+
+    /// rank, select, range counts and sums against the model,
+    /// after single updates and after batches
+    template <std::size_t NodeMax, typename Deletion>
+    void test_summaries( const std::string &name )
+    {
+        using tree_type = btree<value_trait<key_type>, NodeMax,
+                                slab_allocator< >, stats::disabled,
+                                summary::counted<summary::sum<key_type> >,
+                                Deletion>;
+
+        std::mt19937_64 rnd( 3 );
+        tree_type tree;
+        model ref;
+        for( int i = 0; i < 6000; ++i ) {
+            key_type k = rnd( ) % 2000;
+            if( rnd( ) % 3 ) {
+                tree.insert( k );
+                ref.insert( k );
+            } else if( ref.count( k ) ) {
+                tree.erase( k );
+                ref.erase( ref.find( k ) );
+            }
+        }
+        values batch;
+        for( int i = 0; i < 500; ++i ) {
+            batch.push_back( rnd( ) % 2000 );
+        }
+        tree.insert_batch( batch.begin( ), batch.end( ) );
+        ref.insert( batch.begin( ), batch.end( ) );
+        std::shuffle( batch.begin( ), batch.end( ), rnd );
+        batch.resize( 300 );
+        tree.erase_batch( batch.begin( ), batch.end( ) );
+        for( auto k: batch ) {
+            ref.erase( ref.find( k ) );
+        }
+
+        for( int i = 0; i < 200; ++i ) {
+            key_type lo = rnd( ) % 2100;
+            key_type hi = rnd( ) % 2100;
+            auto l = ref.lower_bound( lo );
+            auto h = ref.lower_bound( hi );
+            auto rank = static_cast<std::size_t>(
+                            std::distance( ref.begin( ), l ) );
+            check( tree.rank( lo ) == rank, "rank", name );
+
+            key_type sum = 0;
+            std::size_t count = 0;
+            if( lo < hi ) {
+                for( auto b = l; b != h; ++b ) {
+                    sum += *b;
+                    ++count;
+                }
+            }
+            check( tree.count_range( lo, hi ) == count, "count_range", name );
+            check( tree.aggregate( lo, hi ) == sum, "aggregate", name );
+
+            auto sel = tree.select( rank );
+            check( ( sel == tree.end( ) ) == ( l == ref.end( ) )
+                   && ( l == ref.end( ) || *sel == *l ), "select", name );
+        }
+        key_type total = 0;
+        for( auto v: ref ) {
+            total += v;
+        }
+        check( tree.aggregate( ) == total, "aggregate all", name );
+    }
+
+    /// erased leaf values stay as tombstones until their leaf is
+    /// purged; lookups and walks skip them, compact drops them all
+    void test_tombstones( )
+    {
+        using tree_type = btree<value_trait<key_type>, 8, slab_allocator< >,
+                                stats::disabled, summary::none,
+                                deletion::lazy<100> >;
+        const std::string name = "tombstones";
+
+        std::mt19937_64 rnd( 25 );
+        tree_type tree;
+        model ref;
+        for( int i = 0; i < 5000; ++i ) {
+            key_type k = rnd( ) % 3000;
+            tree.insert( k );
+            ref.insert( k );
+        }
+        for( int i = 0; i < 1000; ++i ) {
+            key_type k = rnd( ) % 3000;
+            tree.erase( k );
+            auto f = ref.find( k );
+            if( f != ref.end( ) ) {
+                ref.erase( f );
+            }
+        }
+        check( tree.statistics( ).shape.values > tree.size( ),
+               "tombstones kept", name );
+        check( tree.size( ) == ref.size( ), "size", name );
+        check( content_of( tree ) == content_of( ref ), "content", name );
+        check( reverse_of( tree ) == values( ref.rbegin( ), ref.rend( ) ),
+               "reverse", name );
+        check_bounds( tree, ref, rnd, 3000, name );
+
+        /// values come back over their own tombstones
+        for( key_type k = 0; k < 3000; k += 7 ) {
+            tree.insert( k );
+            ref.insert( k );
+        }
+        check( content_of( tree ) == content_of( ref ), "reinsert", name );
+
+        tree.compact( );
+        check( tree.statistics( ).shape.values == tree.size( ),
+               "compacted", name );
+        check( content_of( tree ) == content_of( ref ), "after compact",
+               name );
+    }
+
+    /// a churned tree packed by compact and by compact_step
+    /// between updates, with and without tombstones
+    template <typename Tree>
+    void test_compaction( const std::string &name )
+    {
+        std::mt19937_64 rnd( 5 );
+        Tree tree;
+        model ref;
+
+        for( int i = 0; i < 20000; ++i ) {
+            key_type k = rnd( ) % 8000;
+            tree.insert( k );
+            ref.insert( k );
+        }
+        for( int i = 0; i < 15000; ++i ) {
+            key_type k = rnd( ) % 8000;
+            tree.erase( k );
+            auto f = ref.find( k );
+            if( f != ref.end( ) ) {
+                ref.erase( f );
+            }
+        }
+
+        bool done = false;
+        while( !done ) {
+            auto res = tree.compact_step( 32 );
+            done = res.done;
+            key_type k = rnd( ) % 8000;
+            tree.insert( k );
+            ref.insert( k );
+            tree.erase( k + 1 );
+            auto f = ref.find( k + 1 );
+            if( f != ref.end( ) ) {
+                ref.erase( f );
+            }
+        }
+        check( content_of( tree ) == content_of( ref ), "compact_step", name );
+
+        auto before = tree.statistics( ).shape.nodes;
+        auto res    = tree.compact( );
+        auto after  = tree.statistics( ).shape.nodes;
+        check( content_of( tree ) == content_of( ref ), "compact", name );
+        check( before - after == res.nodes_freed, "nodes_freed", name );
+        check( res.done, "done", name );
+        check_bounds( tree, ref, rnd, 8000, name );
+    }
+
+    /// bytes_freed counts what the pool really lets go: all the merged
+    /// nodes of a heap tree; nothing while a snapshot holds every node
+    /// the compaction copies; the merged nodes once it is gone
+    void test_compaction_bytes( )
+    {
+        using heap_tree   = btree<value_trait<key_type>, 8, heap_allocator>;
+        using shared_tree = btree<value_trait<key_type>, 8,
+                                  shared_allocator>;
+        const std::string name = "compaction bytes";
+
+        std::mt19937_64 rnd( 26 );
+        values input;
+        for( int i = 0; i < 8000; ++i ) {
+            input.push_back( rnd( ) % 8000 );
+        }
+        std::sort( input.begin( ), input.end( ) );
+        values keep;
+        for( std::size_t i = 0; i < input.size( ); i += 5 ) {
+            keep.push_back( input[i] );
+        }
+
+        heap_tree heap( input.begin( ), input.end( ), 0.7 );
+        shared_tree shared( input.begin( ), input.end( ), 0.7 );
+        for( std::size_t i = 0; i < input.size( ); ++i ) {
+            if( i % 5 ) {
+                heap.erase( input[i] );
+                shared.erase( input[i] );
+            }
+        }
+
+        auto res = heap.compact( );
+        check( res.nodes_freed > 0 && res.bytes_freed
+                    == res.nodes_freed * sizeof(typename heap_tree::bnode),
+               "heap", name );
+
+        auto twin = shared.snapshot( );
+        auto held = shared.compact( );
+        check( held.nodes_freed > 0 && held.bytes_freed == 0,
+               "held by a snapshot", name );
+        check( content_of( shared ) == keep && content_of( twin ) == keep,
+               "content", name );
+
+        twin = shared_tree( );
+        values left;
+        for( std::size_t i = 0; i < keep.size( ); ++i ) {
+            if( i % 3 ) {
+                shared.erase( keep[i] );
+            } else {
+                left.push_back( keep[i] );
+            }
+        }
+        auto own = shared.compact( );
+        check( own.nodes_freed > 0 && own.bytes_freed
+                == own.nodes_freed * sizeof(typename shared_tree::bnode),
+               "released", name );
+        check( content_of( shared ) == left, "after release", name );
+    }
+
+    /// a frozen tree and its saved image against the sorted values
+    void test_frozen_btree( const std::string &dir )
+    {
+        using tree_type = btree<value_trait<key_type>, 16>;
+        const std::string name = "frozen_btree";
+        const std::string path = dir + "/btree_test.frz";
+
+        std::mt19937_64 rnd( 10 );
+        for( std::size_t count: { 0, 1, 7, 8, 9, 100, 5000 } ) {
+            tree_type tree;
+            for( std::size_t i = 0; i < count; ++i ) {
+                tree.insert( rnd( ) % ( count * 2 + 1 ) );
+            }
+            values sorted = content_of( tree );
+
+            auto frozen = freeze( tree );
+            auto small  = freeze<3>( tree );
+            check( frozen.save( path ), "save", name );
+            auto opened = decltype(frozen)::open( path );
+            check( opened.is_open( ), "open", name );
+
+            values probes;
+            for( std::size_t i = 0; i < 300; ++i ) {
+                probes.push_back( rnd( ) % ( count * 2 + 3 ) );
+            }
+            std::vector<decltype(frozen.begin( ))> batch;
+            frozen.lower_bound_batch( probes.begin( ), probes.end( ),
+                                      std::back_inserter( batch ) );
+
+            check( values( frozen.begin( ), frozen.end( ) ) == sorted,
+                   "content", name );
+            check( values( opened.begin( ), opened.end( ) ) == sorted,
+                   "opened content", name );
+
+            for( std::size_t i = 0; i < probes.size( ); ++i ) {
+                auto k  = probes[i];
+                auto lb = static_cast<std::size_t>( std::distance(
+                            sorted.begin( ),
+                            std::lower_bound( sorted.begin( ), sorted.end( ),
+                                              k ) ) );
+                auto ub = static_cast<std::size_t>( std::distance(
+                            sorted.begin( ),
+                            std::upper_bound( sorted.begin( ), sorted.end( ),
+                                              k ) ) );
+                check( frozen.lower_bound( k ).index( ) == lb
+                       && small.lower_bound( k ).index( ) == lb
+                       && opened.lower_bound( k ).index( ) == lb
+                       && batch[i].index( ) == lb, "lower_bound", name );
+                check( frozen.upper_bound( k ).index( ) == ub
+                       && small.upper_bound( k ).index( ) == ub,
+                       "upper_bound", name );
+                check( frozen.contains( k ) == ( lb != ub ), "contains",
+                       name );
+            }
+        }
+        std::remove( path.c_str( ) );
+    }
+
+}
+
+int main( int argc, char *argv[] )
+{
+    std::string dir = argc > 1 ? argv[1] : ".";
+
+    test_disk_round_trip( dir );
+
+    test_bulk_load( );
+
+    test_iterators<4>( "iterators 4" );
+    test_iterators<5>( "iterators 5" );
+    test_iterators<64>( "iterators 64" );
+
+    test_allocator<heap_allocator>( "heap pool" );
+    test_allocator<slab_allocator< > >( "slab pool" );
+    test_allocator<slab_allocator<256, 128> >( "slab pool small chunks" );
+    test_allocator<slab_allocator<1> >( "slab pool node per chunk" );
+
+    test_search_types<search::binary>( "binary" );
+    test_search_types<search::branchless>( "branchless" );
+    test_search_types<search::linear>( "linear" );
+    test_search_types<search::simd>( "simd" );
+
+    test_bplus_tree( );
+
+    test_btree<btree<value_trait<key_type>, 3> >( "btree 3" );
+    test_btree<btree<value_trait<key_type>, 4> >( "btree 4" );
+    test_btree<btree<value_trait<key_type>, 6> >( "btree 6" );
+    test_btree<btree<value_trait<key_type>, 7, heap_allocator> >(
+                                                        "btree 7 heap" );
+    test_btree<btree<value_trait<key_type>, 64> >( "btree 64" );
+
+    test_map<layout::interleaved, key_type>( "map interleaved" );
+    test_map<layout::interleaved, std::string>( "map interleaved string" );
+    test_map<layout::split, key_type>( "map split" );
+    test_map<layout::split, std::string>( "map split string" );
+
+    test_concurrent_btree( );
+
+    test_batches<btree<value_trait<key_type>, 4> >( "batches 4" );
+    test_batches<btree<value_trait<key_type>, 7> >( "batches 7" );
+    test_batches<btree<value_trait<key_type>, 32> >( "batches 32" );
+
+    test_dyn_array_storage( );
+
+    test_dyn_array_moves<key_type>( "dyn_array moves" );
+    test_dyn_array_moves<std::string>( "dyn_array moves string" );
+
+    test_sized<sizing::cache_line * 4, summary::none, deletion::eager,
+               slab_allocator< > >( "sized" );
+    test_sized<sizing::cache_line * 4, summary::none, deletion::lazy< >,
+               slab_allocator< > >( "sized lazy" );
+    test_sized<sizing::cache_line * 4, summary::counted< >,
+               deletion::eager, slab_allocator< > >( "sized counted" );
+    test_sized<sizing::cache_line * 8, summary::none, deletion::eager,
+               shared_allocator>( "sized shared" );
+    test_sized<sizing::page, summary::counted<summary::sum<key_type> >,
+               deletion::lazy< >, shared_allocator>(
+                                            "sized shared counted lazy" );
+
+    test_prefix_array( );
+    test_string_keys<4>( "string keys 4" );
+    test_string_keys<16>( "string keys 16" );
+
+    test_task_pool( );
+    test_parallel( );
+
+    test_snapshots<deletion::eager>( "snapshots" );
+    test_snapshots<deletion::lazy< > >( "snapshots lazy" );
+
+    test_statistics( );
+    test_copy_statistics( );
+
+    test_transparent_strings<value_trait<std::string, transparent_less> >(
+                                                "transparent strings" );
+    test_transparent_strings<transparent_string_trait>(
+                                                "transparent prefix" );
+    test_transparent_integers( );
+
+    test_buffered_btree( );
+    test_buffered_map( );
+
+    test_set_ops( );
+
+    test_summaries<8, deletion::eager>( "summaries" );
+    test_summaries<4, deletion::eager>( "summaries 4" );
+    test_summaries<8, deletion::lazy< > >( "summaries lazy" );
+
+    test_btree<btree<value_trait<key_type>, 6, slab_allocator< >,
+                     stats::disabled, summary::none,
+                     deletion::lazy< > > >( "btree lazy" );
+    test_btree<btree<value_trait<key_type>, 5, slab_allocator< >,
+                     stats::disabled, summary::none,
+                     deletion::lazy<1> > >( "btree lazy 1" );
+    test_btree<btree<value_trait<key_type>, 9, shared_allocator,
+                     stats::disabled, summary::counted< >,
+                     deletion::lazy<100> > >( "btree lazy 100 counted" );
+    test_batches<btree<value_trait<key_type>, 6, slab_allocator< >,
+                       stats::disabled, summary::none,
+                       deletion::lazy< > > >( "batches lazy" );
+    test_tombstones( );
+
+    test_compaction<btree<value_trait<key_type>, 8> >( "compaction" );
+    test_compaction<btree<value_trait<key_type>, 8, slab_allocator< >,
+                          stats::disabled, summary::none,
+                          deletion::lazy< > > >( "compaction lazy" );
+    test_compaction<btree<value_trait<key_type>, 6, shared_allocator> >(
+                                                "compaction shared" );
+    test_compaction_bytes( );
+
+    test_frozen_btree( dir );
+
+    if( failures == 0 ) {
+        std::cout << "Ok!\n";
+    }
+    return failures;
+}
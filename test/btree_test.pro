@@ -0,0 +1,31 @@
+TEMPLATE = app
+CONFIG += console c++11 thread
+CONFIG -= app_bundle
+CONFIG -= qt
+
+SOURCES += btree_test.cpp
+
+INCLUDEPATH += /home/data/github/etool/include
+INCLUDEPATH += ../btree
+INCLUDEPATH += ../filealloc
+
+HEADERS += \
+    ../btree/btree.h \
+    ../btree/btree_deletion.h \
+    ../btree/btree_summary.h \
+    ../btree/btree_stats.h \
+    ../btree/buffered_btree.h \
+    ../btree/bplus_tree.h \
+    ../btree/concurrent_btree.h \
+    ../btree/dyn_array.h \
+    ../btree/epoch_manager.h \
+    ../btree/frozen_btree.h \
+    ../btree/node_allocator.h \
+    ../btree/node_search.h \
+    ../btree/node_layout.h \
+    ../btree/node_sizing.h \
+    ../btree/prefix_array.h \
+    ../btree/soa_array.h \
+    ../btree/task_pool.h \
+    ../btree/disk_btree.h \
+    ../filealloc/data_source.h